@@ -0,0 +1,81 @@
+/**
+ * @file mqtt_atomic.h
+ * @brief Atomic operations used by the lock-free parts of the client.
+ *
+ * Thin wrappers over the GCC __atomic builtins. On Cortex-M3/M4 these compile to
+ * LDREX/STREX loops, no RTOS lock is taken. Porting to a compiler without the
+ * builtins only requires re-implementing this file.
+ */
+
+#ifndef MQTT_ATOMIC_H_
+#define MQTT_ATOMIC_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+
+static inline uint32_t mqtt_atomic_load_u32(volatile uint32_t *pValue) {
+	return __atomic_load_n(pValue, __ATOMIC_ACQUIRE);
+}
+
+static inline void mqtt_atomic_store_u32(volatile uint32_t *pValue, uint32_t value) {
+	__atomic_store_n(pValue, value, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Compare and swap
+ *
+ * @return true if *pValue was expected and has been replaced by desired
+ */
+static inline bool mqtt_atomic_cas_u32(volatile uint32_t *pValue, uint32_t expected, uint32_t desired) {
+	return __atomic_compare_exchange_n(pValue, &expected, desired, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * @brief Compare and swap, reporting the value found
+ *
+ * @return true if *pValue was *pExpected and has been replaced by desired. Otherwise
+ *         false, and *pExpected holds the current value
+ */
+static inline bool mqtt_atomic_compare_exchange_u32(volatile uint32_t *pValue, uint32_t *pExpected,
+													uint32_t desired) {
+	return __atomic_compare_exchange_n(pValue, pExpected, desired, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+static inline uint32_t mqtt_atomic_exchange_u32(volatile uint32_t *pValue, uint32_t value) {
+	return __atomic_exchange_n(pValue, value, __ATOMIC_ACQ_REL);
+}
+
+static inline uint32_t mqtt_atomic_fetch_or_u32(volatile uint32_t *pValue, uint32_t bits) {
+	return __atomic_fetch_or(pValue, bits, __ATOMIC_ACQ_REL);
+}
+
+static inline uint32_t mqtt_atomic_fetch_add_u32(volatile uint32_t *pValue, uint32_t delta) {
+	return __atomic_fetch_add(pValue, delta, __ATOMIC_ACQ_REL);
+}
+
+static inline void *mqtt_atomic_load_ptr(void *volatile *ppValue) {
+	return __atomic_load_n(ppValue, __ATOMIC_ACQUIRE);
+}
+
+static inline void mqtt_atomic_store_ptr(void *volatile *ppValue, void *pValue) {
+	__atomic_store_n(ppValue, pValue, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Exchange a pointer
+ *
+ * @return the previous value of *ppValue
+ */
+static inline void *mqtt_atomic_exchange_ptr(void *volatile *ppValue, void *pValue) {
+	return __atomic_exchange_n(ppValue, pValue, __ATOMIC_ACQ_REL);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MQTT_ATOMIC_H_ */
@@ -40,9 +40,11 @@ extern "C" {
 /* Platform specific implementation header files */
 #include "network_interface.h"
 #include "timer_interface.h"
+#include "mqtt_timer_wheel.h"
 
 #ifdef _ENABLE_THREAD_SUPPORT_
 #include "threads_interface.h"
+#include "mqtt_tx_queue.h"
 #endif
 
 #define MAX_PACKET_ID 65535
@@ -139,6 +141,102 @@ extern const IoT_Client_Connect_Params iotClientConnectParamsDefault;
  */
 typedef void (*iot_disconnect_handler)(MQTT_Client *, void *);
 
+/**
+ * @brief Connect Timing
+ *
+ * Where the time of a connect or reconnect went, in ms. Phases the connect did not
+ * reach stay 0.
+ *
+ */
+typedef struct {
+	uint32_t startMs;		///< timer_now_raw_ms() the connect started
+	uint32_t linkCheckMs;	///< Checking the physical link
+	uint32_t dnsMs;			///< Resolving the host, close to 0 when served from the DNS cache
+	uint32_t tcpMs;			///< TCP connect, all addresses tried
+	uint32_t tlsMs;			///< TLS handshake
+	uint32_t connackMs;		///< CONNECT sent until CONNACK read
+	uint32_t resubscribeMs;	///< Resubscribing after a reconnect, 0 if nothing had to be resubscribed
+	uint32_t totalMs;		///< Whole connect including resubscribe
+	IoT_Error_t result;		///< Outcome of the connect
+	bool isReconnect;		///< Made by auto-reconnect or mqtt_attempt_reconnect
+} IoT_Connect_Timing;
+
+/**
+ * @brief Connect Timing Callback Handler Type
+ *
+ * Defining a TYPE for definition of connect timing callback function pointers.
+ * Called after every connect and reconnect attempt, successful or not.
+ *
+ */
+typedef void (*iot_connect_timing_handler)(MQTT_Client *, const IoT_Connect_Timing *, void *);
+
+#define MQTT_STATS_PACKET_TYPES         (16)	///< Indexed by MQTT control packet type (MessageTypes)
+#define MQTT_STATS_HISTOGRAM_BUCKETS    (16)
+
+/**
+ * @brief Latency Histogram
+ *
+ * Bucket 0 counts samples of 0 ms, bucket n samples of 2^(n-1) to 2^n - 1 ms. The last
+ * bucket also counts everything longer.
+ *
+ */
+typedef struct {
+	uint32_t buckets[MQTT_STATS_HISTOGRAM_BUCKETS];
+} IoT_Latency_Histogram;
+
+/**
+ * @brief Client Statistics
+ *
+ * Running totals since mqtt_init. Counters wrap at 2^32, compare snapshots by difference.
+ *
+ */
+typedef struct {
+	uint32_t bytesSent;
+	uint32_t bytesReceived;
+	uint32_t packetsSent[MQTT_STATS_PACKET_TYPES];		///< Per packet type, a batched write counts each packet
+	uint32_t packetsReceived[MQTT_STATS_PACKET_TYPES];	///< Per packet type
+	uint32_t ackTimeouts;		///< PUBACKs, SUBACKs and UNSUBACKs not received in time
+	uint32_t rxTooLargeDrops;	///< Packets dropped because they did not fit the RX buffer
+	uint32_t selectCalls;		///< select() calls of the network layer
+	uint32_t recvCalls;			///< recv()/ssl_recv() calls of the network layer
+	uint32_t sendCalls;			///< send()/ssl_send() calls of the network layer
+	uint32_t handlerCalls;		///< Subscription handler invocations
+	uint32_t handlerTimeMs;		///< Time spent in subscription handlers, read with timer_now_raw_ms()
+	IoT_Latency_Histogram yieldIteration;	///< One pass of the yield loop, including the socket wait
+	IoT_Latency_Histogram pubackLatency;	///< QoS1 PUBLISH sent until PUBACK read
+	IoT_Latency_Histogram subackLatency;	///< SUBSCRIBE sent until SUBACK read
+} IoT_Client_Stats;
+
+/**
+ * @brief Reconnect Backoff Jitter Type
+ *
+ * Defining a type for how auto-reconnect spreads its attempts over time.
+ *
+ */
+typedef enum {
+	BACKOFF_JITTER_NONE = 0,		///< Wait doubles from baseWaitMs up to maxWaitMs, same for every device
+	BACKOFF_JITTER_FULL = 1,		///< Random wait between baseWaitMs and the doubled wait
+	BACKOFF_JITTER_DECORRELATED = 2	///< Random wait between baseWaitMs and three times the previous wait
+} BackoffJitterType;
+
+/**
+ * @brief Reconnect Backoff Parameters
+ *
+ * Defining a type for the auto-reconnect schedule. Jitter keeps a fleet of devices
+ * from reconnecting in lockstep after a broker failover.
+ *
+ */
+typedef struct {
+	BackoffJitterType jitter;	///< How waits are randomized
+	uint32_t firstWaitMs;		///< Wait before the first attempt after a disconnect, jittered from 0 unless jitter is NONE
+	uint32_t baseWaitMs;		///< First back-off step once the first attempt failed and the shortest wait after it, 0 = MQTT_MIN_RECONNECT_WAIT_INTERVAL
+	uint32_t maxWaitMs;			///< Cap of a single wait, 0 = MQTT_MAX_RECONNECT_WAIT_INTERVAL
+	uint32_t maxAttempts;		///< Failed attempts before NETWORK_RECONNECT_TIMED_OUT_ERROR, 0 = retry forever
+} IoT_Backoff_Params;
+
+#define IoT_Backoff_Params_initializer { BACKOFF_JITTER_DECORRELATED, MQTT_FIRST_RECONNECT_WAIT_INTERVAL, \
+		MQTT_MIN_RECONNECT_WAIT_INTERVAL, MQTT_MAX_RECONNECT_WAIT_INTERVAL, MQTT_MAX_RECONNECT_ATTEMPTS }
+
 /**
  * @brief MQTT Initialization Parameters
  *
@@ -161,6 +259,11 @@ typedef struct {
 	bool isUseSSL;                          ///< is used ssl connect
 	iot_disconnect_handler disconnectHandler;	///< Callback to be invoked upon connection loss
 	void *disconnectHandlerData;			///< Data to pass as argument when disconnect handler is called
+	IoT_Backoff_Params reconnectBackoff;		///< Auto-reconnect schedule
+	unsigned char *pWriteBuf;			///< TX buffer of writeBufSize bytes owned by the caller. NULL = allocated with MQTT_MALLOC
+	size_t writeBufSize;				///< Size of the TX buffer, bounds every outgoing packet. 0 = MQTT_TX_BUF_LEN
+	unsigned char *pReadBuf;			///< RX buffer of readBufSize bytes owned by the caller. NULL = allocated with MQTT_MALLOC
+	size_t readBufSize;				///< Size of the RX buffer, larger incoming packets are dropped. 0 = MQTT_RX_BUF_LEN
 #ifdef _ENABLE_THREAD_SUPPORT_
 	bool isBlockOnThreadLockEnabled;		///< Timeout for Thread blocking calls. Set to 0 to block until lock is obtained. In milliseconds
 #endif
@@ -168,9 +271,11 @@ typedef struct {
 extern const IoT_Client_Init_Params iotClientInitParamsDefault;
 
 #ifdef _ENABLE_THREAD_SUPPORT_
-#define IoT_Client_Init_Params_initializer { true, NULL, 0, NULL, NULL, NULL, 2000, 20000, 5000, false, false, false, NULL, NULL, false }
+#define IoT_Client_Init_Params_initializer { true, NULL, 0, NULL, NULL, NULL, 2000, 20000, 5000, false, false, false, NULL, NULL, \
+		IoT_Backoff_Params_initializer, NULL, 0, NULL, 0, false }
 #else
-#define IoT_Client_Init_Params_initializer { true, NULL, 0, NULL, NULL, NULL, 2000, 20000, 5000, false, false, false, NULL, NULL }
+#define IoT_Client_Init_Params_initializer { true, NULL, 0, NULL, NULL, NULL, 2000, 20000, 5000, false, false, false, NULL, NULL, \
+		IoT_Backoff_Params_initializer, NULL, 0, NULL, 0 }
 #endif
 
 /**
@@ -219,8 +324,48 @@ typedef struct _MessageHandlers {
 	QoS qos;
 	pApplicationHandler_t pApplicationHandler;
 	void *pApplicationHandlerData;
+	bool isConflated;	///< Only the newest message of a burst is delivered to the handler
 } MessageHandlers;   /* Message handlers are indexed by subscription topic */
 
+/**
+ * @brief Conflated Message
+ *
+ * Defining a type for the latest-value staging area of conflated subscriptions.
+ * Holds a copy of the newest pending message until the burst it arrived in is drained.
+ * Nothing is staged across yields, mqtt_yield delivers what is pending before it returns.
+ *
+ */
+#if MQTT_NUM_SUBSCRIBE_HANDLERS > 32
+#error "MQTT_NUM_SUBSCRIBE_HANDLERS must fit in the 32 bit handler masks"
+#endif
+
+typedef struct _ConflatedMessage {
+	uint32_t pendingHandlerMask;	///< Bit n set = messageHandlers[n] has a pending delivery
+	uint16_t topicNameLen;
+	IoT_Publish_Message_Params params;
+	unsigned char buf[MQTT_CONFLATE_BUF_LEN];	///< Topic name followed by payload
+} ConflatedMessage;
+
+typedef struct _PendingRequest PendingRequest;
+
+#ifdef _ENABLE_THREAD_SUPPORT_
+/**
+ * @brief Pending Request
+ *
+ * An acked request sent by an application task while the network I/O task owns the
+ * socket. The I/O task completes it when it reads the ack carrying the same packet id.
+ *
+ */
+struct _PendingRequest {
+	uint8_t packetType;	///< Expected ack type, 0 = slot free
+	uint16_t packetId;	///< Packet id the ack must carry
+	unsigned char *pBuf;	///< Where the ack packet is copied to
+	size_t bufLen;
+	IoT_Error_t result;	///< MQTT_SUCCESS once the ack is in pBuf, set before doneSem is posted
+	IoT_Semaphore_t doneSem;
+};
+#endif
+
 /**
  * @brief MQTT Client Status
  *
@@ -229,64 +374,177 @@ typedef struct _MessageHandlers {
  *
  */
 typedef struct _ClientStatus {
-	ClientState clientState;
+	volatile uint32_t clientState;	///< A ClientState, changed with compare-and-swap only
 	bool isPingOutstanding;
+	uint8_t pingMisses;	///< PINGREQs in a row that went unanswered, reset by any PINGRESP
 	bool isAutoReconnectEnabled;
+	bool isSessionPresent;	///< Session-present flag of the last CONNACK
 } ClientStatus;
 
+#ifdef _ENABLE_STATE_TRACE_
+/**
+ * @brief Client State Trace Entry
+ *
+ * One attempted state transition. Refused transitions are recorded too, with the
+ * state that was found instead of the expected one.
+ *
+ */
+typedef struct _ClientStateTraceEntry {
+	uint32_t timeMs;	///< timer_now_ms() at the attempt
+	uint8_t fromState;	///< State the caller expected
+	uint8_t toState;	///< State the caller asked for
+	uint8_t actualState;	///< State found
+	uint8_t isApplied;	///< 1 = transition done, 0 = refused
+} ClientStateTraceEntry;
+
+/**
+ * @brief Client State Trace
+ *
+ * Ring of the last MQTT_STATE_TRACE_LEN transitions. Slots are claimed atomically,
+ * an entry being written concurrently with mqtt_get_state_trace may read torn.
+ *
+ */
+typedef struct _ClientStateTrace {
+	volatile uint32_t next;
+	ClientStateTraceEntry entries[MQTT_STATE_TRACE_LEN];
+} ClientStateTrace;
+#endif
+
 /**
  * @brief MQTT Client Data
  *
  * Defining a type for MQTT Client Data
- * Contains data used by the MQTT Client
+ * Contains the fields read or written on every yield, publish and packet. Kept small
+ * so that, together with ClientStatus, it spans one or two cache lines per client.
  *
  */
 typedef struct _ClientData {
-	uint16_t nextPacketId;
+	volatile uint32_t nextPacketId;	///< Advanced with compare-and-swap, tasks take packet ids concurrently
 
 	uint32_t packetTimeoutMs;
 	uint32_t commandTimeoutMs;
 	uint16_t keepAliveInterval;
-	uint32_t currentReconnectWaitInterval;
-	uint32_t counterNetworkDisconnected;
+#ifdef _ENABLE_NONBLOCKING_CONNECT_
+	uint8_t connectStep;	///< Step of a non-blocking connect, 0 = none
+#endif
+#ifdef _ENABLE_THREAD_SUPPORT_
+	volatile bool isBackgroundRunning;
+#endif
+	uint32_t pingIntervalMs;	///< Idle time before a PINGREQ is sent, at most keepAliveInterval
+	volatile uint32_t lastSendMs;	///< timer_now_ms() of the last packet written, any packet resets the broker's keepalive
+	uint32_t lastReceiveMs;	///< timer_now_ms() of the last packet read
+	volatile uint32_t rttEstimate;	///< SRTT << 16 | RTTVAR in ms from PINGRESPs and PUBACKs of directly written, non-DUP publishes, 0 = no sample yet
+	uint32_t pingSentMs;	///< timer_now_raw_ms() the outstanding PINGREQ was sent at
+	volatile uint32_t isLivenessProbeDue;	///< Set on write errors and ack timeouts, the keepalive task pings at once
+#ifdef _ENABLE_KEEPALIVE_PROBE_
+	uint32_t probeIdleMs;	///< Idle period the outstanding PINGREQ was sent after
+	uint32_t probeGoodMs;	///< Longest idle period the path is known to survive, kept across reconnects
+	bool isProbeSettled;	///< A probe failed, pingIntervalMs is no longer raised
+#endif
 
-	/* The below values are initialized with the
-	 * lengths of the TX/RX buffers and never modified
-	 * afterwards */
+	/* The below values are set by mqtt_init from the
+	 * init params and never modified afterwards */
 	size_t writeBufSize;
 	size_t readBufSize;
 
-	unsigned char writeBuf[MQTT_TX_BUF_LEN];
-	unsigned char readBuf[MQTT_RX_BUF_LEN];
+	unsigned char *writeBuf;
+	unsigned char *readBuf;
+} ClientData;
+
+/**
+ * @brief MQTT Client Cold Data
+ *
+ * Defining a type for the MQTT Client fields only used on connect, reconnect,
+ * subscribe and message delivery: connect options, handlers, back-off state and
+ * the background mode bookkeeping. Stored after the hot fields so they do not
+ * share cache lines with them.
+ *
+ */
+typedef struct _ClientColdData {
+	volatile uint32_t subscriptionGeneration;	///< Bumped whenever the local subscription set changes
+	volatile uint32_t brokerSubscriptionGeneration;	///< Generation the broker's subscriptions are known to match
+	uint32_t currentReconnectWaitInterval;	///< Last back-off wait
+	uint32_t reconnectAttempts;	///< Failed attempts since the connection was lost
+	uint32_t backoffRandomState;	///< xorshift32 state for jitter, 0 = not seeded yet
+	IoT_Backoff_Params reconnectBackoff;
+	uint32_t counterNetworkDisconnected;
+#ifdef _ENABLE_NONBLOCKING_CONNECT_
+	bool isReconnectStep;	///< The non-blocking connect in progress is an auto-reconnect
+	bool isReconnectSessionExpected;	///< isSessionExpected of that reconnect, see mqtt_attempt_reconnect
+#endif
+
+	bool isWriteBufOwned;	///< writeBuf came from MQTT_MALLOC and is released by mqtt_free
+	bool isReadBufOwned;	///< readBuf came from MQTT_MALLOC and is released by mqtt_free
 
 #ifdef _ENABLE_THREAD_SUPPORT_
 	bool isBlockOnThreadLockEnabled;
-	IoT_Mutex_t state_change_mutex;
 	IoT_Mutex_t tls_read_mutex;
-	IoT_Mutex_t tls_write_mutex;
+	IoT_Mutex_t tls_write_mutex;	///< Held from serializing into writeBuf until the packet is sent
+	IoT_Mutex_t tls_send_mutex;	///< Held while a packet is written to the network. Control packets take only this one
+	IoT_Mutex_t pending_mutex;	///< Guards pendingRequests and reservedHandlerMask
+	PendingRequest pendingRequests[MQTT_MAX_PENDING_REQUESTS];
+	uint32_t reservedHandlerMask;	///< Message handlers claimed by subscribes waiting for their SUBACK
+	IoT_Thread_t backgroundThread;
+	volatile bool isBackgroundStopRequested;	///< Set by mqtt_stop_background, the I/O task clears isBackgroundRunning once out of yield
+	IoT_Semaphore_t background_exit_sem;
+	TxQueue txQueue;	///< Publishes serialized by application tasks, drained by the I/O task
+	IoT_Semaphore_t txWakeSem;	///< Posted after each push, wakes the I/O task out of its socket wait
+	TxBufferPool txPool;
 #endif
 
 	IoT_Client_Connect_Params options;
 
 	MessageHandlers messageHandlers[MQTT_NUM_SUBSCRIBE_HANDLERS];
+	ConflatedMessage conflatedMessage;
 	iot_disconnect_handler disconnectHandler;
 
 	void *disconnectHandlerData;
-} ClientData;
+
+	IoT_Connect_Timing connectTiming;	///< Phases of the last connect or reconnect attempt
+	uint32_t connackStartMs;	///< timer_now_raw_ms() when CONNECT was sent
+	iot_connect_timing_handler connectTimingHandler;
+	void *connectTimingHandlerData;
+
+#ifdef _ENABLE_HEALTH_REPORT_
+	const char *pHealthReportTopic;	///< Caller owned, kept by reference
+	uint16_t healthReportTopicLen;
+	volatile uint32_t healthReportIntervalMs;	///< 0 = not reporting, written by mqtt_health_report_start/stop
+	bool isHealthReportArmed;	///< healthReportDeadline runs for the current interval, yield task only
+	uint32_t healthReportSeq;
+	uint32_t healthReportHeapMin;	///< Lowest free heap seen by the reporter, 0 = not sampled yet
+	IoT_Latency_Histogram healthReportLastRtt;	///< stats.pubackLatency at the previous report
+#endif
+} ClientColdData;
 
 /**
  * @brief MQTT Client
  *
  * Defining a type for MQTT Client
+ * Ordered by access frequency: status and hot data first, then the statistics (byte and
+ * packet counters are written for every packet), the timer wheel (its header is read on
+ * every yield), the network stack (function pointers first) and the cold data last.
  *
  */
 struct _Client {
-	Timer pingTimer;
-	Timer reconnectDelayTimer;
-
 	ClientStatus clientStatus;
 	ClientData clientData;
+	IoT_Client_Stats stats;
+
+	TimerWheel timerWheel;
+	TimerWheelEntry pingDeadline;
+	TimerWheelEntry reconnectDeadline;
+#ifdef _ENABLE_NONBLOCKING_CONNECT_
+	TimerWheelEntry connectDeadline;	///< CONNACK of a non-blocking connect is due
+#endif
+#ifdef _ENABLE_HEALTH_REPORT_
+	TimerWheelEntry healthReportDeadline;
+#endif
+
 	Network networkStack;
+	ClientColdData clientCold;
+#ifdef _ENABLE_STATE_TRACE_
+	ClientStateTrace stateTrace;
+#endif
 };
 
 /**
@@ -350,6 +608,30 @@ ClientState mqtt_get_client_state(MQTT_Client *pClient);
  */
 bool mqtt_is_autoreconnect_enabled(MQTT_Client *pClient);
 
+/**
+ * @brief Did the broker keep the session of the last connection?
+ *
+ * Session-present flag of the last CONNACK. Only ever true when connecting with
+ * isCleanSession = false. Auto-reconnect then skips resubscribing.
+ *
+ * @param pClient Reference to the IoT Client
+ *
+ * @return true = the broker still had our session and subscriptions
+ */
+bool mqtt_is_session_present(MQTT_Client *pClient);
+
+/**
+ * @brief Smoothed round trip time to the broker
+ *
+ * Estimated from PINGREQ/PINGRESP and QoS1 PUBLISH/PUBACK exchanges the way TCP does.
+ * A PINGREQ that gets no PINGRESP within a few round trips marks the connection dead.
+ *
+ * @param pClient Reference to the IoT Client
+ *
+ * @return uint32_t smoothed RTT in ms, 0 if nothing was measured yet
+ */
+uint32_t mqtt_get_smoothed_rtt_ms(MQTT_Client *pClient);
+
 /**
  * @brief Set the IoT Client disconnect handler
  *
@@ -365,6 +647,79 @@ bool mqtt_is_autoreconnect_enabled(MQTT_Client *pClient);
 IoT_Error_t mqtt_set_disconnect_handler(MQTT_Client *pClient, iot_disconnect_handler pDisconnectHandler,
 												void *pDisconnectHandlerData);
 
+/**
+ * @brief Set the IoT Client connect timing handler
+ *
+ * Called to set a handler receiving the phase timings of every connect and reconnect
+ * attempt, e.g. to report them to a fleet dashboard. The handler runs on the task that
+ * connected, keep it short.
+ *
+ * @param pClient Reference to the IoT Client
+ * @param pHandler Reference to the new handler, NULL to remove it
+ * @param pHandlerData Reference to the data to be passed as argument when the handler is called
+ *
+ * @return IoT_Error_t Type defining successful/failed API call
+ */
+IoT_Error_t mqtt_set_connect_timing_handler(MQTT_Client *pClient, iot_connect_timing_handler pHandler,
+											void *pHandlerData);
+
+/**
+ * @brief Read the phase timings of the last connect
+ *
+ * Called to find out whether the link, DNS, TCP, the TLS handshake, the broker or
+ * resubscribing took the time of the last connect or reconnect attempt.
+ *
+ * @param pClient Reference to the IoT Client
+ * @param pTiming Where the timings are copied to
+ *
+ * @return IoT_Error_t Type defining successful/failed API call
+ */
+IoT_Error_t mqtt_get_connect_timing(MQTT_Client *pClient, IoT_Connect_Timing *pTiming);
+
+/**
+ * @brief Read the client statistics
+ *
+ * Called to take a snapshot of the traffic counters and latency histograms. Counters
+ * updated by other tasks during the copy may be one step apart from each other.
+ *
+ * @param pClient Reference to the IoT Client
+ * @param pStats Where the statistics are copied to
+ *
+ * @return IoT_Error_t Type defining successful/failed API call
+ */
+IoT_Error_t mqtt_get_stats(MQTT_Client *pClient, IoT_Client_Stats *pStats);
+
+#ifdef _ENABLE_HEALTH_REPORT_
+/**
+ * @brief Start publishing health records
+ *
+ * Every intervalMs the yield loop encodes a compact JSON record into a stack buffer of
+ * MQTT_HEALTH_REPORT_BUF_LEN bytes and publishes it with QoS 0 on pTopicName:
+ * sequence number, uptime, disconnects, PUBACK round-trip percentiles of the interval,
+ * smoothed RTT, ack timeouts, traffic, TX queue depth, free heap and its low watermark,
+ * unused stack of the background task and the last TLS handshake time. Nothing is
+ * allocated. Records are only sent while connected, a failed send is not retried.
+ *
+ * @param pClient Reference to the IoT Client
+ * @param pTopicName Diagnostics topic, kept by reference, use a string that lives as long as the client
+ * @param topicNameLen Length of the topic name
+ * @param intervalMs Time between records, must not be 0
+ *
+ * @return IoT_Error_t Type defining successful/failed API call
+ */
+IoT_Error_t mqtt_health_report_start(MQTT_Client *pClient, const char *pTopicName, uint16_t topicNameLen,
+									 uint32_t intervalMs);
+
+/**
+ * @brief Stop publishing health records
+ *
+ * @param pClient Reference to the IoT Client
+ *
+ * @return IoT_Error_t Type defining successful/failed API call
+ */
+IoT_Error_t mqtt_health_report_stop(MQTT_Client *pClient);
+#endif
+
 /**
  * @brief Enable or Disable AutoReconnect on Network Disconnect
  *
@@ -377,6 +732,43 @@ IoT_Error_t mqtt_set_disconnect_handler(MQTT_Client *pClient, iot_disconnect_han
  */
 IoT_Error_t mqtt_autoreconnect_set_status(MQTT_Client *pClient, bool newStatus);
 
+/**
+ * @brief Enable or Disable latest-value delivery for a subscription
+ *
+ * Called to mark an existing subscription as conflated. When several PUBLISH packets
+ * for a conflated subscription are read back to back, only the newest one is passed
+ * to the application handler once the burst has been drained. QoS1 acknowledgements
+ * are still sent for every message.
+ * Merging only happens within one mqtt_yield call: the burst ends when the socket has
+ * nothing more to read or the yield returns, whichever comes first. A burst spread
+ * over several yields is delivered once per yield.
+ *
+ * @param pClient Reference to the IoT Client
+ * @param pTopicName Topic filter the subscription was made with
+ * @param topicNameLen Length of the topic filter
+ * @param isConflated set to true to enable and false to disable conflation
+ *
+ * @return IoT_Error_t Type defining successful/failed API call
+ */
+IoT_Error_t mqtt_set_subscription_conflate(MQTT_Client *pClient, const char *pTopicName, uint16_t topicNameLen,
+										   bool isConflated);
+
+#ifdef _ENABLE_STATE_TRACE_
+/**
+ * @brief Read the client state transition trace
+ *
+ * Called to copy the most recent state transitions, oldest first. Useful to find out
+ * which operation held the client when calls fail with MQTT_CLIENT_NOT_IDLE_ERROR.
+ *
+ * @param pClient Reference to the IoT Client
+ * @param pEntries Array the entries are copied to
+ * @param maxEntries Length of pEntries
+ *
+ * @return uint32_t the number of entries copied
+ */
+uint32_t mqtt_get_state_trace(MQTT_Client *pClient, ClientStateTraceEntry *pEntries, uint32_t maxEntries);
+#endif
+
 /**
  * @brief Get count of Network Disconnects
  *
@@ -34,6 +34,20 @@ extern "C" {
 #include "mqtt_log.h"
 #include "mqtt_client_interface.h"
 
+/* Largest ack the client waits for. Subscribe requests carry one topic, so SUBACK is 5 bytes */
+#define MQTT_ACK_PACKET_MAX_LEN 8
+
+/**
+ * @brief Resubscribe Batch
+ *
+ * SUBSCRIBEs written right behind CONNECT on reconnect, still waiting for their SUBACKs.
+ *
+ */
+typedef struct {
+	uint16_t packetIds[MQTT_NUM_SUBSCRIBE_HANDLERS];
+	uint32_t count;
+} ResubscribeBatch;
+
 /* Enum order should match the packet ids array defined in MQTTFormat.c */
 typedef enum msgTypes {
 	UNKNOWN = -1,
@@ -98,8 +112,18 @@ void mqtt_internal_write_char(unsigned char **pptr, unsigned char c);
 void mqtt_internal_write_utf8_string(unsigned char **pptr, const char *string, uint16_t stringLen);
 
 IoT_Error_t mqtt_internal_send_packet(MQTT_Client *pClient, size_t length, Timer *pTimer);
+IoT_Error_t mqtt_internal_send_control(MQTT_Client *pClient, const unsigned char *pPacket, size_t length,
+									   Timer *pTimer);
 IoT_Error_t mqtt_internal_cycle_read(MQTT_Client *pClient, Timer *pTimer, uint8_t *pPacketType);
-IoT_Error_t mqtt_internal_wait_for_read(MQTT_Client *pClient, uint8_t packetType, Timer *pTimer);
+IoT_Error_t mqtt_internal_wait_for_read(MQTT_Client *pClient, uint8_t packetType, PendingRequest *pRequest,
+										Timer *pTimer, unsigned char *pAckBuf, size_t ackBufLen);
+IoT_Error_t mqtt_internal_expect_ack(MQTT_Client *pClient, uint8_t packetType, uint16_t packetId,
+									 unsigned char *pAckBuf, size_t ackBufLen, PendingRequest **ppRequest);
+IoT_Error_t mqtt_internal_cancel_ack(MQTT_Client *pClient, PendingRequest *pRequest);
+#ifdef _ENABLE_THREAD_SUPPORT_
+void mqtt_internal_fail_pending_requests(MQTT_Client *pClient, IoT_Error_t rc);
+#endif
+IoT_Error_t mqtt_internal_flush_conflated(MQTT_Client *pClient);
 IoT_Error_t mqtt_internal_serialize_zero(unsigned char *pTxBuf, size_t txBufLen,
 												 MessageTypes packetType, size_t *pSerializedLength);
 IoT_Error_t mqtt_internal_deserialize_publish(uint8_t *dup, QoS *qos,
@@ -108,9 +132,41 @@ IoT_Error_t mqtt_internal_deserialize_publish(uint8_t *dup, QoS *qos,
 													  unsigned char **payload, size_t *payloadLen,
 													  unsigned char *pRxBuf, size_t rxBufLen);
 
+IoT_Error_t mqtt_internal_serialize_resubscribe(MQTT_Client *pClient, unsigned char *pTxBuf, size_t txBufLen,
+												ResubscribeBatch *pBatch, size_t *pSerializedLen);
+IoT_Error_t mqtt_internal_complete_resubscribe(MQTT_Client *pClient, ResubscribeBatch *pBatch);
+void mqtt_internal_note_subscription_change(MQTT_Client *pClient, bool isAcked);
+void mqtt_internal_note_subscriptions_synced(MQTT_Client *pClient);
+bool mqtt_internal_is_subscription_drift(MQTT_Client *pClient);
+
+void mqtt_internal_schedule_deadline(MQTT_Client *pClient, TimerWheelEntry *pEntry, uint32_t delay_ms);
+#ifdef _ENABLE_NONBLOCKING_CONNECT_
+IoT_Error_t mqtt_internal_connect_step(MQTT_Client *pClient, uint32_t timeout_ms);
+IoT_Error_t mqtt_internal_reconnect_start(MQTT_Client *pClient);
+#endif
+void mqtt_internal_start_keepalive(MQTT_Client *pClient);
+void mqtt_internal_handle_pingresp(MQTT_Client *pClient);
+void mqtt_internal_request_liveness_probe(MQTT_Client *pClient);
+void mqtt_internal_note_rtt(MQTT_Client *pClient, uint32_t sampleMs);
+void mqtt_internal_stats_add_sample(IoT_Latency_Histogram *pHistogram, uint32_t sampleMs);
+#ifdef _ENABLE_HEALTH_REPORT_
+void mqtt_internal_health_report_init(MQTT_Client *pClient);
+void mqtt_internal_health_report(MQTT_Client *pClient);
+#endif
+IoT_Error_t mqtt_internal_publish(MQTT_Client *pClient, const char *pTopicName, uint16_t topicNameLen,
+								  IoT_Publish_Message_Params *pParams);
+
 IoT_Error_t mqtt_set_client_state(MQTT_Client *pClient, ClientState expectedCurrentState,
 										  ClientState newState);
 
+void mqtt_internal_force_client_state(MQTT_Client *pClient, ClientState newState);
+
+bool mqtt_internal_is_background_caller(MQTT_Client *pClient);
+IoT_Error_t mqtt_internal_lock_tx(MQTT_Client *pClient);
+void mqtt_internal_unlock_tx(MQTT_Client *pClient);
+IoT_Error_t mqtt_internal_lock_send(MQTT_Client *pClient);
+void mqtt_internal_unlock_send(MQTT_Client *pClient);
+
 #ifdef _ENABLE_THREAD_SUPPORT_
 
 IoT_Error_t mqtt_client_lock_mutex(MQTT_Client *pClient, IoT_Mutex_t *pMutex);
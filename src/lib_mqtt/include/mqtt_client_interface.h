@@ -45,7 +45,8 @@ extern "C" {
 /**
  * @brief MQTT Client Initialization Function
  *
- * Called to initialize the MQTT Client
+ * Called to initialize the MQTT Client. pClient must be new or released with mqtt_free,
+ * initializing a client again without mqtt_free leaks its buffers, locks and semaphores.
  *
  * @param pClient Reference to the IoT Client
  * @param pInitParams Pointer to MQTT connection parameters
@@ -54,6 +55,20 @@ extern "C" {
  */
 IoT_Error_t mqtt_init(MQTT_Client *pClient, IoT_Client_Init_Params *pInitParams);
 
+/**
+ * @brief MQTT Client Release Function
+ *
+ * Called to release the TX/RX buffers mqtt_init allocated with MQTT_MALLOC and, in
+ * thread builds, its locks and semaphores. Buffers passed in the init params are left to
+ * the caller. The client must be disconnected and, in background mode, stopped. Call
+ * mqtt_init again before reusing the client.
+ *
+ * @param pClient Reference to the IoT Client
+ *
+ * @return IoT_Error_t Type defining successful/failed API call
+ */
+IoT_Error_t mqtt_free(MQTT_Client *pClient);
+
 /**
  * @brief MQTT Connection Function
  *
@@ -66,6 +81,23 @@ IoT_Error_t mqtt_init(MQTT_Client *pClient, IoT_Client_Init_Params *pInitParams)
  */
 IoT_Error_t mqtt_connect(MQTT_Client *pClient, IoT_Client_Connect_Params *pConnectParams);
 
+#ifdef _ENABLE_NONBLOCKING_CONNECT_
+/**
+ * @brief Start a non-blocking MQTT connection
+ *
+ * Called to connect without blocking the calling task. Keep calling mqtt_yield(), it
+ * returns MQTT_CONNECT_IN_PROGRESS until the connect is done and then its result.
+ * Each mqtt_yield() spends at most its timeout on the connect. Auto-reconnect connects
+ * the same way, mqtt_yield() returns NETWORK_ATTEMPTING_RECONNECT while it is under way.
+ *
+ * @param pClient Reference to the IoT Client
+ * @param pConnectParams Pointer to MQTT connection parameters
+ *
+ * @return MQTT_CONNECT_IN_PROGRESS, or an IoT Error Type if the connect could not be started
+ */
+IoT_Error_t mqtt_connect_start(MQTT_Client *pClient, IoT_Client_Connect_Params *pConnectParams);
+#endif
+
 /**
  * @brief Publish an MQTT message on a topic
  *
@@ -73,6 +105,9 @@ IoT_Error_t mqtt_connect(MQTT_Client *pClient, IoT_Client_Connect_Params *pConne
  * @note Call is blocking.  In the case of a QoS 0 message the function returns
  * after the message was successfully passed to the TLS layer.  In the case of QoS 1
  * the function returns after the receipt of the PUBACK control packet.
+ * In background mode the message is queued for the network I/O task. If all pooled
+ * buffers stay in use for MQTT_TX_POOL_WAIT_MS the call fails with MQTT_TX_QUEUE_FULL_ERROR,
+ * the message may be published again later.
  *
  * @param pClient Reference to the IoT Client
  * @param pTopicName Topic Name to publish to
@@ -176,6 +211,37 @@ IoT_Error_t mqtt_yield(MQTT_Client *pClient, uint32_t timeout_ms);
  */
 IoT_Error_t mqtt_attempt_reconnect(MQTT_Client *pClient);
 
+#ifdef _ENABLE_THREAD_SUPPORT_
+/**
+ * @brief Start the network I/O task
+ *
+ * Called after connect to hand the socket to a library-owned task that runs yield
+ * continuously. Once started, any number of application tasks may call publish,
+ * subscribe and unsubscribe concurrently; acknowledgements are read by the I/O task
+ * and passed back to the waiting caller. Message handlers run on the I/O task.
+ * Calling yield or resubscribe from other tasks returns MQTT_CLIENT_NOT_IDLE_ERROR.
+ *
+ * @param pClient Reference to the IoT Client
+ *
+ * @return An IoT Error Type defining successful/failed start
+ */
+IoT_Error_t mqtt_start_background(MQTT_Client *pClient);
+
+/**
+ * @brief Stop the network I/O task
+ *
+ * Called to stop the task started by mqtt_start_background. Blocks until the task
+ * has left yield, at most MQTT_BACKGROUND_STOP_TIMEOUT_MS. After a timeout the task
+ * still owns the socket and stops on its own, call again to wait for it. Must not be
+ * called from a message handler.
+ *
+ * @param pClient Reference to the IoT Client
+ *
+ * @return MQTT_SUCCESS once stopped, MQTT_REQUEST_TIMEOUT_ERROR if the task is still in yield
+ */
+IoT_Error_t mqtt_stop_background(MQTT_Client *pClient);
+#endif
+
 #ifdef __cplusplus
 }
 #endif
@@ -23,6 +23,8 @@ extern "C" {
  * Values greater than 0 are specific non-error return codes
  */
 typedef enum {
+	/** Returned by the non-blocking connect while the connection is still being set up */
+			MQTT_CONNECT_IN_PROGRESS = 7,
 	/** Returned when the Network physical layer is connected */
 			NETWORK_PHYSICAL_LAYER_CONNECTED = 6,
 	/** Returned when the Network is manually disconnected */
@@ -136,6 +138,10 @@ typedef enum {
 			MUTEX_UNLOCK_ERROR = -48,
 	/** Mutex destroy failed */
 			MUTEX_DESTROY_ERROR = -49,
+	/** The TX or RX buffer could not be allocated with MQTT_MALLOC */
+			MQTT_BUFFER_ALLOC_ERROR = -50,
+	/** Background mode: no pooled TX buffer came free in time, the publish was not sent */
+			MQTT_TX_QUEUE_FULL_ERROR = -51,
 } IoT_Error_t;
 
 #ifdef __cplusplus
@@ -7,7 +7,8 @@
  * out) the IOT_* statement in the makefile disables that log level.
  *
  * It is expected that the macros below will be modified or replaced when porting to
- * specific hardware platforms as printf may not be the desired behavior.
+ * specific hardware platforms as printf may not be the desired behavior. Defining
+ * _ENABLE_BINARY_LOG_ replaces printf with deferred binary records, see below.
  */
 
 #ifndef _MQTT_LOG_H
@@ -19,16 +20,108 @@ extern "C" {
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
 #include "mico_rtos.h"
+#include "../user_config/mqtt_config.h"
+#include "mqtt_trace.h"
 
 extern mico_mutex_t stdio_tx_mutex;
 
+#ifdef _ENABLE_BINARY_LOG_
+/*
+ * Binary log: a log call stores a fixed size record (time, level, function, line,
+ * address of the format string and up to MQTT_LOG_MAX_ARGS arguments) in a lock-free
+ * ring and returns, it never takes stdio_tx_mutex nor formats text. Records are turned
+ * into text later by mqtt_log_drain(), normally on the low priority task started with
+ * mqtt_log_start_drain(), or read raw with mqtt_log_read() and decoded off the device
+ * with the format addresses resolved from the firmware image.
+ *
+ * Arguments are stored as 32 bit integers and must be integer conversions (%d, %u, %x).
+ * Strings are not copied, do not log %s in this mode.
+ */
+#define MQTT_LOG_MAX_ARGS   (4)
+
+typedef enum {
+	MQTT_LOG_LEVEL_TRACE = 0,
+	MQTT_LOG_LEVEL_DEBUG = 1,
+	MQTT_LOG_LEVEL_INFO = 2,
+	MQTT_LOG_LEVEL_WARN = 3,
+	MQTT_LOG_LEVEL_ERROR = 4
+} MqttLogLevel;
+
+/**
+ * @brief Binary Log Record
+ */
+typedef struct _MqttLogRecord {
+	uint32_t timeMs;	///< timer_now_ms() at the call
+	const char *pFunction;	///< __func__ of the caller
+	const char *pFormat;	///< Format string, its address identifies the call site
+	uint16_t line;
+	uint8_t level;		///< A MqttLogLevel
+	uint8_t argCount;
+	uint32_t args[MQTT_LOG_MAX_ARGS];
+} MqttLogRecord;
+
+/**
+ * @brief Store a record, never blocks, safe from any task
+ */
+void mqtt_log_record(uint8_t level, const char *pFunction, uint16_t line, const char *pFormat, uint8_t argCount,
+					 uint32_t a0, uint32_t a1, uint32_t a2, uint32_t a3);
+
+/**
+ * @brief Take the oldest record, single reader only
+ *
+ * @param pRecord Receives the record
+ * @param pDropped Receives the records lost to overwriting since the last call, may be NULL
+ *
+ * @return true if a record was returned, false if the ring is empty
+ */
+bool mqtt_log_read(MqttLogRecord *pRecord, uint32_t *pDropped);
+
+/**
+ * @brief Print up to maxRecords records as text, single reader only
+ *
+ * @return number of records printed
+ */
+uint32_t mqtt_log_drain(uint32_t maxRecords);
+
+/**
+ * @brief Start the low priority task that drains the ring to stdout
+ *
+ * @return kNoErr on success
+ */
+OSStatus mqtt_log_start_drain(void);
+
+#define _MQTT_LOG_CAT(a, b) _MQTT_LOG_CAT_(a, b)
+#define _MQTT_LOG_CAT_(a, b) a##b
+#define _MQTT_LOG_NARGS(...) _MQTT_LOG_NARGS_(__VA_ARGS__, 4, 3, 2, 1, 0)
+#define _MQTT_LOG_NARGS_(fmt, a0, a1, a2, a3, n, ...) n
+
+#define _MQTT_LOG_0(level, fmt) \
+	mqtt_log_record(level, __func__, __LINE__, fmt, 0, 0, 0, 0, 0)
+#define _MQTT_LOG_1(level, fmt, a0) \
+	mqtt_log_record(level, __func__, __LINE__, fmt, 1, (uint32_t) (a0), 0, 0, 0)
+#define _MQTT_LOG_2(level, fmt, a0, a1) \
+	mqtt_log_record(level, __func__, __LINE__, fmt, 2, (uint32_t) (a0), (uint32_t) (a1), 0, 0)
+#define _MQTT_LOG_3(level, fmt, a0, a1, a2) \
+	mqtt_log_record(level, __func__, __LINE__, fmt, 3, (uint32_t) (a0), (uint32_t) (a1), (uint32_t) (a2), 0)
+#define _MQTT_LOG_4(level, fmt, a0, a1, a2, a3) \
+	mqtt_log_record(level, __func__, __LINE__, fmt, 4, (uint32_t) (a0), (uint32_t) (a1), (uint32_t) (a2), \
+					(uint32_t) (a3))
+
+#define MQTT_LOG_BINARY(level, ...) \
+	_MQTT_LOG_CAT(_MQTT_LOG_, _MQTT_LOG_NARGS(__VA_ARGS__))(level, __VA_ARGS__)
+#endif
+
 /**
  * @brief Debug level logging macro.
  *
  * Macro to expose function, line number as well as desired log message.
  */
-#ifdef ENABLE_IOT_DEBUG
+#if defined(ENABLE_IOT_DEBUG) && defined(_ENABLE_BINARY_LOG_)
+#define IOT_DEBUG(...) MQTT_LOG_BINARY(MQTT_LOG_LEVEL_DEBUG, __VA_ARGS__)
+#elif defined(ENABLE_IOT_DEBUG)
 #define IOT_DEBUG(...)    \
 	{\
     mico_rtos_lock_mutex( &stdio_tx_mutex ); \
@@ -44,9 +137,29 @@ extern mico_mutex_t stdio_tx_mutex;
 /**
  * @brief Debug level trace logging macro.
  *
- * Macro to print message function entry and exit
+ * Macro to print message function entry and exit. With _ENABLE_FUNC_TRACE_ they store
+ * timestamped begin/end events in the trace ring instead, see mqtt_trace.h. The return
+ * value is evaluated once.
  */
-#ifdef ENABLE_IOT_TRACE
+#if defined(_ENABLE_FUNC_TRACE_)
+#define FUNC_ENTRY { MQTT_TRACE_BEGIN(__func__); }
+#define FUNC_EXIT { MQTT_TRACE_END(__func__, 0); }
+#define FUNC_EXIT_RC(x)    \
+	{\
+	__typeof__(x) _funcExitRc = (x); \
+	MQTT_TRACE_END(__func__, _funcExitRc); \
+	return _funcExitRc; \
+	}
+#elif defined(ENABLE_IOT_TRACE) && defined(_ENABLE_BINARY_LOG_)
+#define FUNC_ENTRY { MQTT_LOG_BINARY(MQTT_LOG_LEVEL_TRACE, "FUNC_ENTRY"); }
+#define FUNC_EXIT { MQTT_LOG_BINARY(MQTT_LOG_LEVEL_TRACE, "FUNC_EXIT"); }
+#define FUNC_EXIT_RC(x)    \
+	{\
+	__typeof__(x) _funcExitRc = (x); \
+	MQTT_LOG_BINARY(MQTT_LOG_LEVEL_TRACE, "FUNC_EXIT Return Code : %d", _funcExitRc); \
+	return _funcExitRc; \
+	}
+#elif defined(ENABLE_IOT_TRACE)
 #define FUNC_ENTRY    \
 	{\
     mico_rtos_lock_mutex( &stdio_tx_mutex ); \
@@ -61,10 +174,11 @@ extern mico_mutex_t stdio_tx_mutex;
 	}
 #define FUNC_EXIT_RC(x)    \
 	{\
+	__typeof__(x) _funcExitRc = (x); \
     mico_rtos_lock_mutex( &stdio_tx_mutex ); \
-	printf("FUNC_EXIT:   %s L#%d Return Code : %d \r\n", __func__, __LINE__, x);  \
+	printf("FUNC_EXIT:   %s L#%d Return Code : %d \r\n", __func__, __LINE__, (int) _funcExitRc);  \
 	mico_rtos_unlock_mutex( &stdio_tx_mutex );\
-	return x; \
+	return _funcExitRc; \
 	}
 #else
 #define FUNC_ENTRY
@@ -78,7 +192,9 @@ extern mico_mutex_t stdio_tx_mutex;
  *
  * Macro to expose desired log message.  Info messages do not include automatic function names and line numbers.
  */
-#ifdef ENABLE_IOT_INFO
+#if defined(ENABLE_IOT_INFO) && defined(_ENABLE_BINARY_LOG_)
+#define IOT_INFO(...) MQTT_LOG_BINARY(MQTT_LOG_LEVEL_INFO, __VA_ARGS__)
+#elif defined(ENABLE_IOT_INFO)
 #define IOT_INFO(...)    \
 	{\
     mico_rtos_lock_mutex( &stdio_tx_mutex ); \
@@ -95,7 +211,9 @@ extern mico_mutex_t stdio_tx_mutex;
  *
  * Macro to expose function, line number as well as desired log message.
  */
-#ifdef ENABLE_IOT_WARN
+#if defined(ENABLE_IOT_WARN) && defined(_ENABLE_BINARY_LOG_)
+#define IOT_WARN(...) MQTT_LOG_BINARY(MQTT_LOG_LEVEL_WARN, __VA_ARGS__)
+#elif defined(ENABLE_IOT_WARN)
 #define IOT_WARN(...)   \
 	{ \
     mico_rtos_lock_mutex( &stdio_tx_mutex ); \
@@ -113,7 +231,9 @@ extern mico_mutex_t stdio_tx_mutex;
  *
  * Macro to expose function, line number as well as desired log message.
  */
-#ifdef ENABLE_IOT_ERROR
+#if defined(ENABLE_IOT_ERROR) && defined(_ENABLE_BINARY_LOG_)
+#define IOT_ERROR(...) MQTT_LOG_BINARY(MQTT_LOG_LEVEL_ERROR, __VA_ARGS__)
+#elif defined(ENABLE_IOT_ERROR)
 #define IOT_ERROR(...)  \
 	{ \
     mico_rtos_lock_mutex( &stdio_tx_mutex ); \
@@ -0,0 +1,145 @@
+/**
+ * @file mqtt_mempool.h
+ * @brief Fixed-block memory pool and per-message arena.
+ *
+ * A block pool hands out blocks of one size from storage the caller sizes at build
+ * time, alloc and free are O(1) and lock-free. An arena is a bump allocator over one
+ * buffer: everything a message needs is taken from it and released at once by
+ * resetting it after the publish or callback. Together they keep memory use bounded
+ * and the heap from fragmenting on long-running devices.
+ */
+
+#ifndef MQTT_MEMPOOL_H_
+#define MQTT_MEMPOOL_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+#include "../user_config/mqtt_config.h"
+
+/**
+ * @brief Block size rounded up so every block stays pointer aligned
+ */
+#define MEM_POOL_ALIGN(size) ((((size) + sizeof(void *) - 1) / sizeof(void *)) * sizeof(void *))
+
+/**
+ * @brief Length of a void * array large enough to back a pool, use it to declare the storage
+ */
+#define MEM_POOL_STORAGE_WORDS(blockSize, blockCount) ((MEM_POOL_ALIGN(blockSize) / sizeof(void *)) * (blockCount))
+
+/**
+ * @brief Static initializer, equivalent to mem_pool_init on the same arguments
+ */
+#define MEM_POOL_INITIALIZER(pStorage, blockSize, blockCount) \
+		{ (unsigned char *) (pStorage), MEM_POOL_ALIGN(blockSize), (blockCount), 0, 0, 0, 0 }
+
+/**
+ * @brief Fixed-Block Memory Pool
+ *
+ * Freed blocks are kept on a list threaded through the blocks themselves. Blocks never
+ * handed out are taken in order from nextFresh, so a zero-filled pool needs no linking
+ * and can be set up by MEM_POOL_INITIALIZER. freeHead holds the index + 1 of the first
+ * free block in the low 16 bits and a change counter in the high 16 bits, which stops a
+ * compare-and-swap from succeeding on a block that was taken and returned meanwhile.
+ */
+typedef struct _MemBlockPool {
+	unsigned char *pBase;
+	size_t blockSize;
+	uint32_t blockCount;
+	volatile uint32_t freeHead;
+	volatile uint32_t nextFresh;
+	volatile uint32_t inUse;
+	volatile uint32_t peakInUse;	///< Most blocks in use at once since init, sizes blockCount
+} MemBlockPool;
+
+/**
+ * @brief Per-Message Arena
+ *
+ * Bump allocator owned by one task, not safe to share without locking.
+ */
+typedef struct _MemArena {
+	unsigned char *pBase;
+	size_t size;
+	size_t used;
+	size_t peakUsed;	///< Largest used since init, sizes the arena
+} MemArena;
+
+/**
+ * @brief Set up a pool over caller storage
+ *
+ * @param pPool Pool to initialize
+ * @param pStorage Pointer aligned storage of MEM_POOL_STORAGE_WORDS(blockSize, blockCount) words
+ * @param blockSize Usable bytes per block
+ * @param blockCount Number of blocks, at most 65535
+ */
+void mem_pool_init(MemBlockPool *pPool, void *pStorage, size_t blockSize, uint32_t blockCount);
+
+/**
+ * @brief Take a block, never blocks, safe to call from any task
+ *
+ * @param pPool Pool to allocate from
+ *
+ * @return a block of pPool->blockSize bytes or NULL if all are in use
+ */
+void *mem_pool_alloc(MemBlockPool *pPool);
+
+/**
+ * @brief Return a block to its pool, safe to call from any task
+ *
+ * @param pPool Pool the block was taken from
+ * @param pBlock Block to return, NULL is ignored
+ */
+void mem_pool_free(MemBlockPool *pPool, void *pBlock);
+
+/**
+ * @brief Set up an arena over caller storage
+ *
+ * @param pArena Arena to initialize
+ * @param pStorage Pointer aligned storage
+ * @param size Size of the storage
+ */
+void mem_arena_init(MemArena *pArena, void *pStorage, size_t size);
+
+/**
+ * @brief Take len bytes, pointer aligned
+ *
+ * @param pArena Arena to allocate from
+ * @param len Bytes needed
+ *
+ * @return the memory or NULL if the arena is full, nothing is taken then
+ */
+void *mem_arena_alloc(MemArena *pArena, size_t len);
+
+/**
+ * @brief Release everything taken from the arena at once
+ *
+ * @param pArena Arena to reset
+ */
+void mem_arena_reset(MemArena *pArena);
+
+#ifdef _ENABLE_STATIC_MEMPOOL_
+/**
+ * @brief MQTT_MALLOC backend, takes a block of the library pool
+ *
+ * @param size Bytes needed, at most MQTT_MEMPOOL_BLOCK_SIZE
+ *
+ * @return a block or NULL if size is too large or the pool is empty
+ */
+void *mqtt_mempool_alloc(size_t size);
+
+/**
+ * @brief MQTT_FREE backend, returns a block to the library pool
+ *
+ * @param pBlock Block taken with mqtt_mempool_alloc
+ */
+void mqtt_mempool_free(void *pBlock);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MQTT_MEMPOOL_H_ */
@@ -0,0 +1,135 @@
+/**
+ * @file mqtt_timer_wheel.h
+ * @brief Hierarchical timer wheel for client deadlines.
+ *
+ * Keepalive, reconnect and other per-client deadlines are kept in a three level
+ * hashed timer wheel. Scheduling and cancelling are O(1). The owner advances the
+ * wheel once per loop iteration and can ask for the time until the next deadline
+ * to bound how long it blocks on the network.
+ *
+ * Only deadlines that outlive a call live here. The timeout bounding a single
+ * blocking call (command, packet and ack timeouts) stays a Timer on the stack.
+ */
+
+#ifndef MQTT_TIMER_WHEEL_H_
+#define MQTT_TIMER_WHEEL_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "../user_config/mqtt_config.h"
+
+#define TIMER_WHEEL_LEVEL_BITS      (6)
+#define TIMER_WHEEL_LEVEL_SLOTS     (1 << TIMER_WHEEL_LEVEL_BITS)
+#define TIMER_WHEEL_LEVEL_MASK      (TIMER_WHEEL_LEVEL_SLOTS - 1)
+#define TIMER_WHEEL_LEVELS          (3)
+#define TIMER_WHEEL_NO_DEADLINE     (0xFFFFFFFF)
+
+typedef struct _TimerWheelEntry TimerWheelEntry;
+
+/**
+ * @brief Timer Wheel Callback Type
+ *
+ * Invoked from timer_wheel_advance() when an entry expires. The entry is no longer
+ * scheduled when the callback runs and may be rescheduled from within it.
+ */
+typedef void (*TimerWheelCallback)(TimerWheelEntry *pEntry, void *pData);
+
+/**
+ * @brief Timer Wheel Entry
+ *
+ * A deadline. Embedded in the structure that owns it, never allocated by the wheel.
+ */
+struct _TimerWheelEntry {
+	TimerWheelEntry *pNext;
+	TimerWheelEntry **ppPrevNext;	///< Address of the pointer that points to this entry, NULL if not scheduled
+	uint32_t expiryTick;
+	uint8_t level;			///< Wheel level the entry currently sits in
+	TimerWheelCallback callback;	///< Optional, may be NULL
+	void *pData;
+};
+
+/**
+ * @brief Timer Wheel
+ *
+ * Level 0 has one slot per tick (MQTT_TIMER_WHEEL_TICK_MS), each higher level
+ * covers TIMER_WHEEL_LEVEL_SLOTS times the span of the level below. Deadlines
+ * beyond the last level are parked in it and re-cascaded until due.
+ */
+typedef struct {
+	uint32_t currentTick;		///< Next tick to be processed
+	uint32_t currentTickMs;		///< Monotonic time at which currentTick is due
+	uint32_t level0Count;		///< Entries in level 0, lets advance skip empty runs
+	uint32_t scheduledCount;
+	TimerWheelEntry *slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_LEVEL_SLOTS];
+} TimerWheel;
+
+/**
+ * @brief Initialize a timer wheel
+ *
+ * @param pWheel - wheel to initialize
+ * @param now_ms - current monotonic time, see timer_now_ms()
+ */
+void timer_wheel_init(TimerWheel *pWheel, uint32_t now_ms);
+
+/**
+ * @brief Initialize a timer wheel entry
+ *
+ * @param pEntry - entry to initialize
+ * @param callback - function called when the entry expires, may be NULL
+ * @param pData - argument passed to the callback
+ */
+void timer_wheel_entry_init(TimerWheelEntry *pEntry, TimerWheelCallback callback, void *pData);
+
+/**
+ * @brief Schedule or reschedule an entry
+ *
+ * @param pWheel - wheel to schedule in
+ * @param pEntry - entry, removed first if already scheduled
+ * @param now_ms - current monotonic time
+ * @param delay_ms - expire this many milliseconds from now
+ */
+void timer_wheel_schedule(TimerWheel *pWheel, TimerWheelEntry *pEntry, uint32_t now_ms, uint32_t delay_ms);
+
+/**
+ * @brief Cancel an entry
+ *
+ * Does nothing if the entry is not scheduled.
+ */
+void timer_wheel_cancel(TimerWheel *pWheel, TimerWheelEntry *pEntry);
+
+/**
+ * @brief Is the entry waiting to expire?
+ *
+ * @return bool - true = scheduled, false = expired, cancelled or never scheduled
+ */
+bool timer_wheel_is_scheduled(TimerWheelEntry *pEntry);
+
+/**
+ * @brief Expire all entries that are due
+ *
+ * Runs the callback of every entry whose deadline is at or before now_ms.
+ *
+ * @param pWheel - wheel to advance
+ * @param now_ms - current monotonic time
+ */
+void timer_wheel_advance(TimerWheel *pWheel, uint32_t now_ms);
+
+/**
+ * @brief Time until the next deadline
+ *
+ * @param pWheel - wheel to query
+ * @param now_ms - current monotonic time
+ * @return uint32_t - milliseconds until the earliest scheduled entry is due, 0 if one is
+ *         overdue, TIMER_WHEEL_NO_DEADLINE if nothing is scheduled
+ */
+uint32_t timer_wheel_next_deadline_ms(TimerWheel *pWheel, uint32_t now_ms);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MQTT_TIMER_WHEEL_H_ */
@@ -0,0 +1,78 @@
+/**
+ * @file mqtt_trace.h
+ * @brief Timestamped begin/end trace points.
+ *
+ * With _ENABLE_FUNC_TRACE_ FUNC_ENTRY/FUNC_EXIT_RC and the MQTT_TRACE_* macros store
+ * events of a few words in a lock-free ring: microsecond timestamp, task, name and the
+ * return code. mqtt_trace_dump() prints the ring as text that tools/mqtt_trace2chrome.py
+ * turns into Chrome/Perfetto trace JSON. Without it the macros compile to nothing.
+ *
+ * Timestamps only have microsecond resolution on Linux or with MQTT_TIMER_US_SOURCE()
+ * defined. Otherwise MiCO falls back to the millisecond tick, and spans shorter than
+ * 1 ms (most select/recv calls and handlers) show up as 0.
+ */
+
+#ifndef MQTT_TRACE_H_
+#define MQTT_TRACE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "../user_config/mqtt_config.h"
+
+#ifdef _ENABLE_FUNC_TRACE_
+
+#define MQTT_TRACE_PHASE_BEGIN	'B'
+#define MQTT_TRACE_PHASE_END	'E'
+
+/**
+ * @brief Trace Event
+ */
+typedef struct _MqttTraceEvent {
+	uint32_t timeUs;	///< timer_now_us() at the event, wraps every 71 minutes, whole ms without MQTT_TIMER_US_SOURCE() on MiCO
+	uint32_t task;		///< MQTT_TRACE_TASK_ID() of the caller
+	const char *pName;	///< __func__ or a string literal, never copied
+	int32_t value;		///< Return code of an end event
+	uint8_t phase;		///< MQTT_TRACE_PHASE_BEGIN or MQTT_TRACE_PHASE_END
+} MqttTraceEvent;
+
+/**
+ * @brief Store an event, never blocks, safe from any task
+ */
+void mqtt_trace_event(uint8_t phase, const char *pName, int32_t value);
+
+/**
+ * @brief Copy the events in the ring, oldest first
+ *
+ * Recording is paused while copying. Events a task is still writing are skipped.
+ *
+ * @param pEvents Receives the events
+ * @param maxEvents Size of pEvents
+ *
+ * @return number of events copied
+ */
+uint32_t mqtt_trace_snapshot(MqttTraceEvent *pEvents, uint32_t maxEvents);
+
+/**
+ * @brief Print the ring for tools/mqtt_trace2chrome.py and empty it
+ *
+ * Recording is paused while printing, call it from a task that is not being traced
+ * or accept the gap. Events a task is still writing are left out and counted as lost.
+ */
+void mqtt_trace_dump(void);
+
+#define MQTT_TRACE_BEGIN(name) mqtt_trace_event(MQTT_TRACE_PHASE_BEGIN, (name), 0)
+#define MQTT_TRACE_END(name, value) mqtt_trace_event(MQTT_TRACE_PHASE_END, (name), (int32_t) (value))
+#else
+#define MQTT_TRACE_BEGIN(name)
+#define MQTT_TRACE_END(name, value)
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MQTT_TRACE_H_ */
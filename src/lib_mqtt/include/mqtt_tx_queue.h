@@ -0,0 +1,128 @@
+/**
+ * @file mqtt_tx_queue.h
+ * @brief Lock-free outbound packet queue and buffer pool.
+ *
+ * Publishing tasks serialize into a buffer taken from a fixed pool and push it on a
+ * multi-producer/single-consumer queue. The network I/O task is the only consumer:
+ * it pops the buffers, copies them back to back into the TX buffer, sends them with
+ * one write and returns them to the pool. Neither side takes a lock.
+ */
+
+#ifndef MQTT_TX_QUEUE_H_
+#define MQTT_TX_QUEUE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+#include "../user_config/mqtt_config.h"
+
+#if MQTT_TX_POOL_COUNT < 1 || MQTT_TX_POOL_COUNT > 32
+#error "MQTT_TX_POOL_COUNT must fit in the 32 bit free mask"
+#endif
+
+#if MQTT_TX_POOL_BUF_LEN >= MQTT_TX_BUF_LEN
+#error "MQTT_TX_POOL_BUF_LEN must be smaller than MQTT_TX_BUF_LEN"
+#endif
+
+/**
+ * @brief TX Queue Node
+ *
+ * Intrusive link, embedded first in every queued item.
+ */
+typedef struct _TxQueueNode {
+	struct _TxQueueNode *volatile pNext;
+} TxQueueNode;
+
+/**
+ * @brief TX Queue
+ *
+ * Intrusive MPSC queue (D. Vyukov). Producers only touch pHead with an atomic exchange,
+ * the consumer owns pTail. The stub node keeps the queue non-empty so push never has
+ * to look at the tail.
+ */
+typedef struct _TxQueue {
+	TxQueueNode *volatile pHead;
+	TxQueueNode *pTail;
+	TxQueueNode stub;
+} TxQueue;
+
+/**
+ * @brief TX Buffer
+ *
+ * One serialized packet waiting to be sent.
+ */
+typedef struct _TxBuffer {
+	TxQueueNode node;
+	uint32_t len;
+	unsigned char buf[MQTT_TX_POOL_BUF_LEN];
+} TxBuffer;
+
+/**
+ * @brief TX Buffer Pool
+ *
+ * Fixed set of TX buffers, bit n of freeMask set = buffers[n] is free.
+ */
+typedef struct _TxBufferPool {
+	volatile uint32_t freeMask;
+	TxBuffer buffers[MQTT_TX_POOL_COUNT];
+} TxBufferPool;
+
+/**
+ * @brief Initialize an empty queue
+ *
+ * @param pQueue Queue to initialize
+ */
+void tx_queue_init(TxQueue *pQueue);
+
+/**
+ * @brief Append a node, safe to call from any number of tasks
+ *
+ * @param pQueue Queue to push on
+ * @param pNode Node to append, must not be queued already
+ */
+void tx_queue_push(TxQueue *pQueue, TxQueueNode *pNode);
+
+/**
+ * @brief Remove the oldest node, consumer task only
+ *
+ * May return NULL while a producer is half way through a push. The node
+ * will be returned by a later call.
+ *
+ * @param pQueue Queue to pop from
+ *
+ * @return the oldest node or NULL
+ */
+TxQueueNode *tx_queue_pop(TxQueue *pQueue);
+
+/**
+ * @brief Mark every buffer of the pool free
+ *
+ * @param pPool Pool to initialize
+ */
+void tx_pool_init(TxBufferPool *pPool);
+
+/**
+ * @brief Take a free buffer, never blocks
+ *
+ * @param pPool Pool to allocate from
+ *
+ * @return a buffer or NULL if all are in use
+ */
+TxBuffer *tx_pool_alloc(TxBufferPool *pPool);
+
+/**
+ * @brief Return a buffer to its pool
+ *
+ * @param pPool Pool the buffer was taken from
+ * @param pBuffer Buffer to return
+ */
+void tx_pool_free(TxBufferPool *pPool, TxBuffer *pBuffer);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MQTT_TX_QUEUE_H_ */
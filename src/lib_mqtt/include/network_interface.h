@@ -42,6 +42,30 @@ typedef struct {
 	bool isUseSSL;                     ///< is used ssl connect
 } TLSConnectParams;
 
+/**
+ * @brief Network Connect Timing
+ *
+ * Time spent in each phase of the last connect in ms, filled in by the platform.
+ * Phases the connect did not reach stay 0.
+ */
+typedef struct {
+	uint32_t linkCheckMs;                ///< Checking the physical link
+	uint32_t dnsMs;                      ///< Resolving the host, close to 0 when served from the DNS cache
+	uint32_t tcpMs;                      ///< TCP connect, all addresses tried
+	uint32_t tlsMs;                      ///< TLS handshake
+} NetworkConnectTiming;
+
+/**
+ * @brief Network Call Counters
+ *
+ * Socket calls made by the network layer since iot_tls_init, reported by mqtt_get_stats.
+ */
+typedef struct {
+	uint32_t selectCalls;
+	uint32_t recvCalls;                  ///< recv() or ssl_recv()
+	uint32_t sendCalls;                  ///< send() or ssl_send()
+} NetworkCallCounters;
+
 /**
  * @brief Network Structure
  *
@@ -55,9 +79,17 @@ struct Network {
 	IoT_Error_t (*disconnect)(Network *);    ///< Function pointer pointing to the network function to disconnect from the network
 	IoT_Error_t (*isConnected)(Network *);    ///< Function pointer pointing to the network function to check if TLS is connected
 	IoT_Error_t (*destroy)(Network *);        ///< Function pointer pointing to the network function to destroy the network object
+#ifdef _ENABLE_NONBLOCKING_CONNECT_
+	IoT_Error_t (*connectStep)(Network *, TLSConnectParams *);    ///< Function pointer pointing to the network function advancing a non-blocking connect
+#endif
+#ifdef _ENABLE_THREAD_SUPPORT_
+	IoT_Error_t (*wait)(Network *, int, Timer *);    ///< Function pointer pointing to the network function waiting for incoming data or a wake-up descriptor
+#endif
 
 	TLSConnectParams tlsConnectParams;        ///< TLSConnect params structure containing the common connection parameters
 	TLSDataParams tlsDataParams;            ///< TLSData params structure containing the connection data parameters that are specific to the library being used
+	NetworkConnectTiming connectTiming;    ///< Phase durations of the last connect
+	NetworkCallCounters callCounters;      ///< Socket calls, for statistics
 };
 
 /**
@@ -95,6 +127,21 @@ IoT_Error_t iot_tls_init(Network *pNetwork, char *pRootCALocation, char *pDevice
  */
 IoT_Error_t iot_tls_connect(Network *pNetwork, TLSConnectParams *TLSParams);
 
+#ifdef _ENABLE_NONBLOCKING_CONNECT_
+/**
+ * @brief Advance a non-blocking connect
+ *
+ * Does what iot_tls_connect does without blocking the caller. Each call makes as much
+ * progress as possible and returns, call again until the result is not MQTT_CONNECT_IN_PROGRESS.
+ * iot_tls_disconnect abandons a connect in progress.
+ *
+ * @param pNetwork - Pointer to a Network struct defining the network interface.
+ * @param TLSParams - TLSConnectParams defines the properties of the TLS connection, used by the first call.
+ * @return IoT_Error_t - MQTT_CONNECT_IN_PROGRESS, successful connection or TLS error
+ */
+IoT_Error_t iot_tls_connect_step(Network *pNetwork, TLSConnectParams *TLSParams);
+#endif
+
 /**
  * @brief Write bytes to the network socket
  *
@@ -119,6 +166,21 @@ IoT_Error_t iot_tls_write(Network *, unsigned char *, size_t, Timer *, size_t *)
  */
 IoT_Error_t iot_tls_read(Network *, unsigned char *, size_t, Timer *, size_t *);
 
+#ifdef _ENABLE_THREAD_SUPPORT_
+/**
+ * @brief Wait for incoming data or a wake-up
+ *
+ * Blocks until the connection has data to read, wakeFd becomes readable or the timer
+ * expires, whichever comes first. Reads nothing.
+ *
+ * @param pNetwork - Pointer to a Network struct defining the network interface.
+ * @param wakeFd - descriptor that ends the wait when readable, -1 = none
+ * @param timer - longest to wait
+ * @return IoT_Error_t - MQTT_SUCCESS if data can be read, NETWORK_SSL_NOTHING_TO_READ otherwise
+ */
+IoT_Error_t iot_tls_wait(Network *pNetwork, int wakeFd, Timer *timer);
+#endif
+
 /**
  * @brief Disconnect from network socket
  *
@@ -16,13 +16,12 @@
 extern "C" {
 #endif
 
-/**
- * The platform specific timer header that defines the Timer struct
- */
-#include "threads_platform.h"
-
+#include <stdbool.h>
+#include <stdint.h>
 #include <mqtt_error.h>
 
+#define IOT_THREAD_WAIT_FOREVER 0xFFFFFFFF
+
 /**
  * @brief Mutex Type
  *
@@ -33,6 +32,33 @@ extern "C" {
  */
 typedef struct _IoT_Mutex_t IoT_Mutex_t;
 
+/**
+ * @brief Semaphore Type
+ *
+ * Forward declaration of a counting semaphore struct. Used to hand results
+ * from the network I/O task back to waiting application tasks.
+ *
+ */
+typedef struct _IoT_Semaphore_t IoT_Semaphore_t;
+
+/**
+ * @brief Thread Type
+ *
+ * Forward declaration of a thread struct.
+ *
+ */
+typedef struct _IoT_Thread_t IoT_Thread_t;
+
+/**
+ * @brief Thread entry function type
+ */
+typedef void (*IoT_Thread_Routine_t)(void *pArg);
+
+/**
+ * The platform specific threads header that defines the Mutex, Semaphore and Thread structs
+ */
+#include "threads_platform.h"
+
 /**
  * @brief Initialize the provided mutex
  *
@@ -85,6 +111,98 @@ IoT_Error_t aws_iot_thread_mutex_unlock(IoT_Mutex_t *);
  */
 IoT_Error_t aws_iot_thread_mutex_destroy(IoT_Mutex_t *);
 
+/**
+ * @brief Initialize the provided semaphore
+ *
+ * Call this function to initialize a binary semaphore. It starts out taken
+ *
+ * @param IoT_Semaphore_t - pointer to the semaphore to be initialized
+ * @return IoT_Error_t - error code indicating result of operation
+ */
+IoT_Error_t aws_iot_thread_sem_init(IoT_Semaphore_t *);
+
+/**
+ * @brief Wait on the provided semaphore
+ *
+ * Call this function to take the semaphore, blocking for at most timeout_ms
+ *
+ * @param IoT_Semaphore_t - pointer to the semaphore
+ * @param timeout_ms - maximum time to block. 0 polls
+ * @return IoT_Error_t - MQTT_SUCCESS if taken, MQTT_REQUEST_TIMEOUT_ERROR otherwise
+ */
+IoT_Error_t aws_iot_thread_sem_wait(IoT_Semaphore_t *, uint32_t timeout_ms);
+
+/**
+ * @brief Post the provided semaphore
+ *
+ * Call this function to wake up one waiter
+ *
+ * @param IoT_Semaphore_t - pointer to the semaphore
+ * @return IoT_Error_t - error code indicating result of operation
+ */
+IoT_Error_t aws_iot_thread_sem_post(IoT_Semaphore_t *);
+
+/**
+ * @brief Destroy the provided semaphore
+ *
+ * @param IoT_Semaphore_t - pointer to the semaphore to be destroyed
+ * @return IoT_Error_t - error code indicating result of operation
+ */
+IoT_Error_t aws_iot_thread_sem_destroy(IoT_Semaphore_t *);
+
+/**
+ * @brief Get a descriptor to select() on together with sockets
+ *
+ * The descriptor is readable while the semaphore is posted. Selecting does not take
+ * the semaphore, call aws_iot_thread_sem_wait for that.
+ *
+ * @param IoT_Semaphore_t - pointer to the semaphore
+ * @return the descriptor, -1 if the platform has none
+ */
+int aws_iot_thread_sem_event_fd(IoT_Semaphore_t *);
+
+/**
+ * @brief Start a new thread
+ *
+ * Call this function to run routine(pArg) in a new thread. The thread deletes
+ * itself when routine returns.
+ *
+ * @param IoT_Thread_t - pointer to the thread handle, must stay valid while the thread runs
+ * @param routine - thread entry function
+ * @param pArg - argument passed to routine
+ * @param pName - thread name
+ * @param stackSize - stack size in bytes
+ * @return IoT_Error_t - error code indicating result of operation
+ */
+IoT_Error_t aws_iot_thread_create(IoT_Thread_t *, IoT_Thread_Routine_t routine, void *pArg,
+								  const char *pName, uint32_t stackSize);
+
+/**
+ * @brief Is the calling thread the provided thread?
+ *
+ * @param IoT_Thread_t - pointer to the thread handle
+ * @return true if called from that thread
+ */
+bool aws_iot_thread_is_current(IoT_Thread_t *);
+
+/**
+ * @brief Stack the provided thread has never used
+ *
+ * Call this function to find how close a thread created with aws_iot_thread_create
+ * came to overflowing its stack since it started. Needs _ENABLE_STACK_WATERMARK_.
+ *
+ * @param IoT_Thread_t - pointer to the thread handle
+ * @return bytes of stack never touched, 0 if unknown
+ */
+uint32_t aws_iot_thread_stack_unused(IoT_Thread_t *);
+
+/**
+ * @brief Sleep the calling thread
+ *
+ * @param sleep_ms - time to sleep in milliseconds
+ */
+void aws_iot_thread_sleep(uint32_t sleep_ms);
+
 #ifdef __cplusplus
 }
 #endif
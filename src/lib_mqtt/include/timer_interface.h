@@ -98,6 +98,70 @@ uint32_t left_ms(Timer *);
  */
 void init_timer(Timer *);
 
+/**
+ * @brief Current monotonic time (milliseconds)
+ *
+ * Returns the monotonic millisecond tick used by all timers. Not affected by
+ * wall clock (NTP/SNTP) adjustments. Wraps around every 49.7 days, timers
+ * handle the wrap as long as no single timeout exceeds 24.8 days.
+ * Returns the cached value while a cached-now section is active.
+ *
+ * @return uint32_t - current tick in milliseconds
+ */
+uint32_t timer_now_ms(void);
+
+/**
+ * @brief Current monotonic time (milliseconds), never cached
+ *
+ * Same tick as timer_now_ms() but always read, even inside a cached-now section.
+ * For measurements that must not see the tick frozen, such as connect phases and
+ * handler run time.
+ *
+ * @return uint32_t - current tick in milliseconds
+ */
+uint32_t timer_now_raw_ms(void);
+
+/**
+ * @brief Read the current time in microseconds
+ *
+ * Timestamp for trace points, never cached. Uses MQTT_TIMER_US_SOURCE() when it is
+ * defined, otherwise the millisecond tick scaled up on MiCO. Wraps every 71 minutes.
+ *
+ * @return uint32_t - current time in microseconds
+ */
+uint32_t timer_now_us(void);
+
+/**
+ * @brief Sleep the calling task
+ *
+ * Used between polls of work that cannot be waited on, such as a connect in progress.
+ *
+ * @param sleep_ms - time to sleep in milliseconds
+ */
+void timer_sleep_ms(uint32_t sleep_ms);
+
+/**
+ * @brief Start a cached-now section
+ *
+ * Snapshots the tick so that timer checks until the matching timer_end_cached_now()
+ * are plain integer compares. Sections may be nested. Has no effect when thread
+ * support is enabled, as the cache is not per thread.
+ */
+void timer_begin_cached_now(void);
+
+/**
+ * @brief Refresh the cached tick
+ *
+ * Re-reads the tick if a cached-now section is active. Called once per loop
+ * iteration and after calls that may block.
+ */
+void timer_refresh_cached_now(void);
+
+/**
+ * @brief End a cached-now section
+ */
+void timer_end_cached_now(void);
+
 #ifdef __cplusplus
 }
 #endif
@@ -18,6 +18,12 @@ $(NAME)_SOURCES := ./src/mqtt_client_common_internal.c \
 				   ./src/mqtt_client_unsubscribe.c \
 				   ./src/mqtt_client_yield.c \
 				   ./src/mqtt_client.c \
+				   ./src/mqtt_client_health.c \
+				   ./src/mqtt_timer_wheel.c \
+				   ./src/mqtt_tx_queue.c \
+				   ./src/mqtt_mempool.c \
+				   ./src/mqtt_log.c \
+				   ./src/mqtt_trace.c \
 				   ./platform/network_platform.c \
 				   ./platform/threads_platform.c \
 				   ./platform/timer_platform.c
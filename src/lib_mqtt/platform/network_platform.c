@@ -23,8 +23,10 @@ extern "C"
 
 #include "mqtt_error.h"
 #include "mqtt_log.h"
+#include "mqtt_atomic.h"
 #include "network_platform.h"
 #include "common.h"
+#include <stdlib.h>
 #include "debug.h"
 #include "../user_config/mqtt_config.h"
 
@@ -56,23 +58,33 @@ static void _iot_tls_set_connect_params( Network *pNetwork, char *pRootCALocatio
     pNetwork->tlsConnectParams.isUseSSL = isUseSSLFlag;
 }
 
-static OSStatus socket_gethostbyname( const char * domain, uint8_t * addr, uint8_t addrLen )
+/* Time since *pPhaseStartMs, which moves on to now for the next phase. Uses the raw
+ * tick, the yield loop may have the cached one frozen during a non-blocking connect */
+static uint32_t _iot_tls_lap( uint32_t *pPhaseStartMs )
 {
-    struct hostent* host = NULL;
-    struct in_addr in_addr;
-    char **pptr = NULL;
-    char *ip_addr = NULL;
-    LinkStatusTypeDef link_status;
+    uint32_t now_ms = timer_now_raw_ms( );
+    uint32_t elapsed_ms = now_ms - *pPhaseStartMs;
 
-    if ( addr == NULL || addrLen < 16 )
-    {
-        return kGeneralErr;
-    }
+    *pPhaseStartMs = now_ms;
+    return elapsed_ms;
+}
+
+static bool socket_is_link_up( void )
+{
+    LinkStatusTypeDef link_status;
 
     memset( &link_status, 0, sizeof(link_status) );
     micoWlanGetLinkStatus( &link_status );
 
-    if(link_status.is_connected == false)
+    return link_status.is_connected == true;
+}
+
+static OSStatus socket_gethostbyname( const char * domain, uint32_t *pAddrs, uint8_t maxAddrs, uint8_t *pAddrCount )
+{
+    struct hostent* host = NULL;
+    uint8_t count = 0;
+
+    if ( pAddrs == NULL || pAddrCount == NULL || maxAddrs == 0 )
     {
         return kGeneralErr;
     }
@@ -83,34 +95,264 @@ static OSStatus socket_gethostbyname( const char * domain, uint8_t * addr, uint8
         return kGeneralErr;
     }
 
-    pptr = host->h_addr_list;
-    in_addr.s_addr = *(uint32_t *) (*pptr);
-    ip_addr = inet_ntoa( in_addr );
-    memset( addr, 0, addrLen );
-    memcpy( addr, ip_addr, strlen( ip_addr ) );
+    while ( count < maxAddrs && host->h_addr_list[count] != NULL )
+    {
+        memcpy( &pAddrs[count], host->h_addr_list[count], sizeof(uint32_t) );
+        count++;
+    }
 
+    if ( count == 0 )
+    {
+        return kGeneralErr;
+    }
+
+    *pAddrCount = count;
     return kNoErr;
 }
 
-static OSStatus socket_tcp_connect( int *fd, char *ipstr, uint16_t port )
+#ifdef _ENABLE_DNS_RESOLVER_TASK_
+/**
+ * @brief Resolve handed to the resolver task
+ *
+ * Owned as described at HelperJobState. Carries its own copy of the host name, the
+ * Network and its connect params may be gone before the resolve returns.
+ */
+struct _DNSResolveJob {
+    volatile uint32_t state;                    ///< HelperJobState, changed with compare-and-swap
+    bool isResolved;
+    uint8_t addrCount;
+    uint32_t addrs[MQTT_DNS_CACHE_MAX_ADDRS];
+    char host[1];                               ///< Allocated to the length of the host name
+};
+
+static void _dns_cache_refresh_thread( mico_thread_arg_t arg )
+{
+    DNSResolveJob *pJob = (DNSResolveJob *) (uintptr_t) arg;
+
+    pJob->isResolved = socket_is_link_up( )
+                       && kNoErr == socket_gethostbyname( pJob->host, pJob->addrs, MQTT_DNS_CACHE_MAX_ADDRS,
+                                                          &pJob->addrCount );
+
+    if ( !mqtt_atomic_cas_u32( &pJob->state, HELPER_JOB_RUNNING, HELPER_JOB_DONE ) )
+    {
+        /* Abandoned, nobody else references the job any more */
+        free( pJob );
+    }
+
+    mico_rtos_delete_thread( NULL );
+}
+
+/* Taken over on the next connect, the connecting task is the only writer of the cache */
+static void _dns_cache_start_refresh( DNSCacheParams *pCache )
+{
+    DNSResolveJob *pJob;
+    size_t hostLen;
+
+    if ( pCache->pRefresh != NULL )
+    {
+        return;
+    }
+
+    hostLen = strlen( pCache->pHost );
+    pJob = (DNSResolveJob *) malloc( sizeof(DNSResolveJob) + hostLen );
+    if ( pJob == NULL )
+    {
+        return;
+    }
+    memcpy( pJob->host, pCache->pHost, hostLen + 1 );
+    pJob->state = HELPER_JOB_RUNNING;
+    pJob->isResolved = false;
+    pJob->addrCount = 0;
+
+    if ( kNoErr != mico_rtos_create_thread( NULL, MICO_APPLICATION_PRIORITY, "dns refresh", _dns_cache_refresh_thread,
+                                            MQTT_DNS_REFRESH_STACK_SIZE, (mico_thread_arg_t) (uintptr_t) pJob ) )
+    {
+        free( pJob );
+        return;
+    }
+    pCache->pRefresh = pJob;
+}
+
+/* Use what the resolver task found once it is done */
+static void _dns_cache_take_refresh( DNSCacheParams *pCache, uint32_t now_ms )
+{
+    DNSResolveJob *pJob = pCache->pRefresh;
+
+    if ( pJob == NULL || mqtt_atomic_load_u32( &pJob->state ) != HELPER_JOB_DONE )
+    {
+        return;
+    }
+
+    pCache->pRefresh = NULL;
+    if ( pJob->isResolved )
+    {
+        memcpy( pCache->addrs, pJob->addrs, sizeof(pCache->addrs) );
+        pCache->addrCount = pJob->addrCount;
+        pCache->addrIndex = 0;
+        pCache->expiresMs = now_ms + MQTT_DNS_CACHE_TTL_MS;
+    }
+    free( pJob );
+}
+
+/* Stop waiting for the resolver task, a running task frees its job itself */
+static void _dns_cache_abort_refresh( DNSCacheParams *pCache )
+{
+    DNSResolveJob *pJob = pCache->pRefresh;
+
+    if ( pJob == NULL )
+    {
+        return;
+    }
+
+    pCache->pRefresh = NULL;
+    if ( !mqtt_atomic_cas_u32( &pJob->state, HELPER_JOB_RUNNING, HELPER_JOB_ABANDONED ) )
+    {
+        /* Finished meanwhile, the job is ours */
+        free( pJob );
+    }
+}
+#endif
+
+/* Start over when the destination host changed */
+static void _dns_cache_set_host( DNSCacheParams *pCache, const char *pHost )
+{
+    if ( pCache->pHost == NULL || strcmp( pCache->pHost, pHost ) != 0 )
+    {
+#ifdef _ENABLE_DNS_RESOLVER_TASK_
+        _dns_cache_abort_refresh( pCache );
+#endif
+        pCache->pHost = pHost;
+        pCache->addrCount = 0;
+    }
+}
+
+#ifdef _ENABLE_DNS_ASYNC_REFRESH_
+/* Cached addresses are used while being refreshed, but not for longer than MQTT_DNS_CACHE_STALE_MAX_MS past expiry */
+static bool _dns_cache_is_usable( DNSCacheParams *pCache, uint32_t now_ms )
+{
+    return pCache->addrCount > 0 && (int32_t) (now_ms - pCache->expiresMs) < MQTT_DNS_CACHE_STALE_MAX_MS;
+}
+#endif
+
+/*
+ * Make sure the DNS cache holds addresses for pHost. Resolves only when the cache is
+ * empty or stale, and keeps using stale addresses if resolving fails.
+ */
+static OSStatus _dns_cache_resolve( DNSCacheParams *pCache, const char *pHost )
+{
+    uint32_t now_ms = timer_now_ms( );
+
+    _dns_cache_set_host( pCache, pHost );
+
+#ifdef _ENABLE_DNS_ASYNC_REFRESH_
+    _dns_cache_take_refresh( pCache, now_ms );
+
+    if ( _dns_cache_is_usable( pCache, now_ms ) )
+    {
+        if ( (int32_t) (pCache->expiresMs - now_ms) <= MQTT_DNS_CACHE_REFRESH_AHEAD_MS )
+        {
+            _dns_cache_start_refresh( pCache );
+        }
+        return kNoErr;
+    }
+#else
+    if ( pCache->addrCount > 0 && (int32_t) (pCache->expiresMs - now_ms) > 0 )
+    {
+        return kNoErr;
+    }
+#endif
+
+    if ( kNoErr == socket_gethostbyname( pHost, pCache->addrs, MQTT_DNS_CACHE_MAX_ADDRS, &pCache->addrCount ) )
+    {
+        pCache->addrIndex = 0;
+        pCache->expiresMs = timer_now_ms( ) + MQTT_DNS_CACHE_TTL_MS;
+        return kNoErr;
+    }
+
+    /* DNS is down or overloaded, e.g. right after an AP reboot. Stale addresses beat none */
+    aws_platform_log("resolve failed, %d stale addresses", pCache->addrCount);
+    return (pCache->addrCount > 0) ? kNoErr : kGeneralErr;
+}
+
+#ifdef _ENABLE_NONBLOCKING_CONNECT_
+/*
+ * _dns_cache_resolve without blocking: an empty or stale entry is resolved on the
+ * resolver task and kInProgressErr returned until it is done.
+ */
+static OSStatus _dns_cache_resolve_step( DNSCacheParams *pCache, const char *pHost, bool *pIsResolving )
+{
+    uint32_t now_ms = timer_now_ms( );
+
+    _dns_cache_set_host( pCache, pHost );
+    _dns_cache_take_refresh( pCache, now_ms );
+
+#ifdef _ENABLE_DNS_ASYNC_REFRESH_
+    if ( _dns_cache_is_usable( pCache, now_ms ) )
+    {
+        if ( (int32_t) (pCache->expiresMs - now_ms) <= MQTT_DNS_CACHE_REFRESH_AHEAD_MS )
+        {
+            _dns_cache_start_refresh( pCache );
+        }
+        *pIsResolving = false;
+        return kNoErr;
+    }
+#else
+    if ( pCache->addrCount > 0 && (int32_t) (pCache->expiresMs - now_ms) > 0 )
+    {
+        *pIsResolving = false;
+        return kNoErr;
+    }
+#endif
+
+    if ( !*pIsResolving )
+    {
+        *pIsResolving = true;
+        _dns_cache_start_refresh( pCache );
+        return kInProgressErr;
+    }
+
+    if ( pCache->pRefresh != NULL )
+    {
+        return kInProgressErr;
+    }
+
+    /* The resolver task failed, stale addresses beat none */
+    *pIsResolving = false;
+    aws_platform_log("resolve failed, %d stale addresses", pCache->addrCount);
+    return (pCache->addrCount > 0) ? kNoErr : kGeneralErr;
+}
+#endif
+
+static OSStatus socket_set_timeouts( int fd )
 {
-    OSStatus err = kNoErr;
     int opt = 0, retVal = 0;
+
+    opt = MQTT_TCP_SOCKET_TIMEOUT_MS;
+    retVal = setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, (void *)&opt,sizeof(opt));
+    require_string(retVal >= 0, exit, "SO_SNDTIMEO setsockopt error!");
+
+    opt = MQTT_TCP_SOCKET_TIMEOUT_MS;
+    retVal = setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, (char *)&opt,sizeof(opt));
+    require_string(retVal >= 0, exit, "SO_RCVTIMEO setsockopt error!");
+
+    return kNoErr;
+    exit:
+    return kGeneralErr;
+}
+
+static OSStatus socket_tcp_connect( int *fd, uint32_t addr_be, uint16_t port )
+{
+    OSStatus err = kNoErr;
     struct sockaddr_in addr;
 
     *fd = socket( AF_INET, SOCK_STREAM, IPPROTO_TCP );
     require_action( IsValidSocket( *fd ), exit, aws_platform_log("ERROR: Unable to create the tcp_client.") );
 
-    opt = 3000; //3000ms
-    retVal = setsockopt(*fd, SOL_SOCKET, SO_SNDTIMEO, (void *)&opt,sizeof(opt));
-    require_string(retVal >= 0, exit, "SO_SNDTIMEO setsockopt error!");
-
-    opt = 3000; //3000ms
-    retVal = setsockopt(*fd, SOL_SOCKET, SO_RCVTIMEO, (char *)&opt,sizeof(opt));
-    require_string(retVal >= 0, exit, "SO_RCVTIMEO setsockopt error!");
+    err = socket_set_timeouts( *fd );
+    require_noerr( err, exit );
 
     addr.sin_family = AF_INET;
-    addr.sin_addr.s_addr = inet_addr( ipstr );
+    addr.sin_addr.s_addr = addr_be;
     addr.sin_port = htons( port );
 
     err = connect( *fd, (struct sockaddr *) &addr, sizeof(addr) );
@@ -126,10 +368,168 @@ static OSStatus socket_tcp_connect( int *fd, char *ipstr, uint16_t port )
     return kGeneralErr;
 }
 
+/*
+ * Connect to the cached addresses in turn, starting with the one that worked last.
+ * When none answers the entry is marked stale so the next connect resolves again.
+ */
+static OSStatus _dns_cache_connect( DNSCacheParams *pCache, int *fd, uint16_t port )
+{
+    uint8_t tries, index;
+
+    for ( tries = 0; tries < pCache->addrCount; tries++ )
+    {
+        index = (uint8_t) ((pCache->addrIndex + tries) % pCache->addrCount);
+        if ( kNoErr == socket_tcp_connect( fd, pCache->addrs[index], port ) )
+        {
+            pCache->addrIndex = index;
+            return kNoErr;
+        }
+        aws_platform_log("tcp connect to address %d failed", index);
+    }
+
+    pCache->expiresMs = timer_now_ms( );
+    return kGeneralErr;
+}
+
+#ifdef _ENABLE_NONBLOCKING_CONNECT_
+/* Start connecting to one address, completion is polled with socket_tcp_connect_poll */
+static OSStatus socket_tcp_connect_start( int *fd, uint32_t addr_be, uint16_t port )
+{
+    int flags;
+    struct sockaddr_in addr;
+
+    *fd = socket( AF_INET, SOCK_STREAM, IPPROTO_TCP );
+    require_action( IsValidSocket( *fd ), exit, aws_platform_log("ERROR: Unable to create the tcp_client.") );
+
+    flags = fcntl( *fd, F_GETFL, 0 );
+    if ( flags < 0 || fcntl( *fd, F_SETFL, flags | O_NONBLOCK ) < 0 )
+    {
+        close( *fd );
+        *fd = -1;
+        goto exit;
+    }
+
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = addr_be;
+    addr.sin_port = htons( port );
+
+    /* Returns at once, a refused or unreachable address shows up in SO_ERROR */
+    (void) connect( *fd, (struct sockaddr *) &addr, sizeof(addr) );
+
+    return kNoErr;
+    exit:
+    return kGeneralErr;
+}
+
+/* kInProgressErr until the socket is writable, then back to blocking mode with timeouts */
+static OSStatus socket_tcp_connect_poll( int fd )
+{
+    fd_set writefds;
+    struct timeval t;
+    int flags, so_error = 0;
+    socklen_t optlen = sizeof(so_error);
+
+    FD_ZERO( &writefds );
+    FD_SET( fd, &writefds );
+    t.tv_sec = 0;
+    t.tv_usec = 0;
+
+    if ( select( fd + 1, NULL, &writefds, NULL, &t ) <= 0 || !FD_ISSET( fd, &writefds ) )
+    {
+        return kInProgressErr;
+    }
+
+    if ( getsockopt( fd, SOL_SOCKET, SO_ERROR, &so_error, &optlen ) < 0 || so_error != 0 )
+    {
+        return kGeneralErr;
+    }
+
+    flags = fcntl( fd, F_GETFL, 0 );
+    if ( flags < 0 || fcntl( fd, F_SETFL, flags & ~O_NONBLOCK ) < 0 )
+    {
+        return kGeneralErr;
+    }
+
+    return socket_set_timeouts( fd );
+}
+#endif
+
+#ifdef _ENABLE_SSL_SUPPORT_
+/* ssl_set_client_cert and ssl_connect work on state global to the SSL library. A handshake
+ * abandoned by a non-blocking connect keeps running while the next connect starts, so
+ * handshakes take turns. 0 = no mutex yet, 1 = being created, 2 = ready */
+static mico_mutex_t tls_handshake_mutex;
+static volatile uint32_t tls_handshake_mutex_state = 0;
+
+static void _iot_tls_handshake_lock( void )
+{
+    if ( mqtt_atomic_cas_u32( &tls_handshake_mutex_state, 0, 1 ) )
+    {
+        (void) mico_rtos_init_mutex( &tls_handshake_mutex );
+        mqtt_atomic_store_u32( &tls_handshake_mutex_state, 2 );
+    }
+    while ( mqtt_atomic_load_u32( &tls_handshake_mutex_state ) != 2 )
+    {
+        mico_rtos_thread_msleep( 1 );
+    }
+    (void) mico_rtos_lock_mutex( &tls_handshake_mutex );
+}
+
+/* Pick the certificates of the next handshake from the connect params */
+static void _iot_tls_select_certs( Network *pNetwork )
+{
+    pNetwork->tlsDataParams.clicert = NULL;
+    pNetwork->tlsDataParams.pkey = NULL;
+    if ( (pNetwork->tlsConnectParams.pDeviceCertLocation != NULL)
+         && (pNetwork->tlsConnectParams.pDevicePrivateKeyLocation != NULL) )
+    {
+        pNetwork->tlsDataParams.clicert = pNetwork->tlsConnectParams.pDeviceCertLocation;
+        pNetwork->tlsDataParams.pkey = pNetwork->tlsConnectParams.pDevicePrivateKeyLocation;
+        aws_platform_log("use client ca");
+    }
+
+    if ( (pNetwork->tlsConnectParams.ServerVerificationFlag == true) )
+    {
+        pNetwork->tlsDataParams.cacert = pNetwork->tlsConnectParams.pRootCALocation;
+        aws_platform_log("use server ca");
+    } else
+    {
+        pNetwork->tlsDataParams.cacert = NULL;
+    }
+}
+
+/* Run the TLS handshake on a connected socket, blocks until done. Takes the certificates
+ * by value so a handshake task never reads the Network */
+static mico_ssl_t _iot_tls_handshake( int fd, const char *clicert, const char *pkey, char *cacert )
+{
+    mico_ssl_t ssl;
+    int ssl_errno = 0;
+    int root_ca_len = 0;
+
+    _iot_tls_handshake_lock( );
+
+    if ( clicert != NULL && pkey != NULL )
+    {
+        ssl_set_client_cert( clicert, pkey );
+    }
+    if ( cacert != NULL )
+    {
+        root_ca_len = strlen( cacert );
+    }
+    ssl = ssl_connect( fd, root_ca_len, cacert, &ssl_errno );
+    aws_platform_log("fd: %d, err:  %d", fd ,ssl_errno);
+    (void) mico_rtos_unlock_mutex( &tls_handshake_mutex );
+
+    return ssl;
+}
+#endif
+
 static int socket_send( Network *pNetwork, void *data, size_t len )
 {
     int ret = 0;
 
+    pNetwork->callCounters.sendCalls++;
+    MQTT_TRACE_BEGIN( "send" );
     if ( pNetwork->tlsConnectParams.isUseSSL == true )
     {
 #ifdef _ENABLE_SSL_SUPPORT_
@@ -139,6 +539,7 @@ static int socket_send( Network *pNetwork, void *data, size_t len )
     {
         ret = send( pNetwork->tlsDataParams.server_fd, data, len, 0);
     }
+    MQTT_TRACE_END( "send", ret );
 
     return ret;
 }
@@ -161,9 +562,20 @@ IoT_Error_t iot_tls_init( Network *pNetwork, char *pRootCALocation, char *pDevic
     pNetwork->disconnect = iot_tls_disconnect;
     pNetwork->isConnected = iot_tls_is_connected;
     pNetwork->destroy = iot_tls_destroy;
+#ifdef _ENABLE_THREAD_SUPPORT_
+    pNetwork->wait = iot_tls_wait;
+#endif
+#ifdef _ENABLE_NONBLOCKING_CONNECT_
+    pNetwork->connectStep = iot_tls_connect_step;
+    pNetwork->tlsDataParams.connectStep.phase = CONNECT_PHASE_IDLE;
+    pNetwork->tlsDataParams.connectStep.fd = -1;
+    pNetwork->tlsDataParams.connectStep.pHandshake = NULL;
+#endif
 
     pNetwork->tlsDataParams.server_fd = -1;
     pNetwork->tlsDataParams.ssl = NULL;
+    memset( &pNetwork->tlsDataParams.dnsCache, 0, sizeof(DNSCacheParams) );
+    memset( &pNetwork->callCounters, 0, sizeof(NetworkCallCounters) );
 
     if ( pNetwork->tlsConnectParams.isUseSSL == true )
     {
@@ -197,11 +609,9 @@ IoT_Error_t iot_tls_is_connected( Network *pNetwork )
 IoT_Error_t iot_tls_connect( Network *pNetwork, TLSConnectParams *params )
 {
     OSStatus err = kNoErr;
+    uint32_t phaseStartMs;
 
-    char ipstr[16] = {0};
     int socket_fd = -1;
-    int errno;
-    int root_ca_len = 0;
 
     if ( NULL == pNetwork )
     {
@@ -219,15 +629,30 @@ IoT_Error_t iot_tls_connect( Network *pNetwork, TLSConnectParams *params )
                                      params->isUseSSL );
     }
 
-    err = socket_gethostbyname( pNetwork->tlsConnectParams.pDestinationURL, (uint8_t *) ipstr, sizeof(ipstr) );
+    memset( &pNetwork->connectTiming, 0, sizeof(NetworkConnectTiming) );
+    phaseStartMs = timer_now_raw_ms( );
+
+    /* Fail at once without a link instead of waiting for DNS or TCP to time out */
+    if ( !socket_is_link_up( ) )
+    {
+        pNetwork->connectTiming.linkCheckMs = _iot_tls_lap( &phaseStartMs );
+        aws_platform_log("ERROR: link is down.");
+        return TCP_CONNECTION_ERROR;
+    }
+    pNetwork->connectTiming.linkCheckMs = _iot_tls_lap( &phaseStartMs );
+
+    err = _dns_cache_resolve( &pNetwork->tlsDataParams.dnsCache, pNetwork->tlsConnectParams.pDestinationURL );
+    pNetwork->connectTiming.dnsMs = _iot_tls_lap( &phaseStartMs );
     if ( err != kNoErr )
     {
         aws_platform_log("ERROR: Unable to resolute the host address.");
         return TCP_CONNECTION_ERROR;
     }
-    aws_platform_log("host:%s, ip:%s", pNetwork->tlsConnectParams.pDestinationURL, ipstr);
+    aws_platform_log("host:%s, %d addresses", pNetwork->tlsConnectParams.pDestinationURL,
+                     pNetwork->tlsDataParams.dnsCache.addrCount);
 
-    err = socket_tcp_connect( &socket_fd, ipstr, pNetwork->tlsConnectParams.DestinationPort );
+    err = _dns_cache_connect( &pNetwork->tlsDataParams.dnsCache, &socket_fd, pNetwork->tlsConnectParams.DestinationPort );
+    pNetwork->connectTiming.tcpMs = _iot_tls_lap( &phaseStartMs );
     if ( err != kNoErr )
     {
         aws_platform_log("ERROR: Unable to resolute the tcp connect");
@@ -238,29 +663,11 @@ IoT_Error_t iot_tls_connect( Network *pNetwork, TLSConnectParams *params )
     if ( pNetwork->tlsConnectParams.isUseSSL == true )
     {
 #ifdef _ENABLE_SSL_SUPPORT_
-        if ( (pNetwork->tlsConnectParams.pDeviceCertLocation != NULL)
-             && (pNetwork->tlsConnectParams.pDevicePrivateKeyLocation != NULL) )
-        {
-            pNetwork->tlsDataParams.clicert = pNetwork->tlsConnectParams.pDeviceCertLocation;
-            pNetwork->tlsDataParams.pkey = pNetwork->tlsConnectParams.pDevicePrivateKeyLocation;
-            ssl_set_client_cert( pNetwork->tlsDataParams.clicert, pNetwork->tlsDataParams.pkey );
-            aws_platform_log("use client ca");
-        }
-
-        if ( (pNetwork->tlsConnectParams.ServerVerificationFlag == true) )
-        {
-            pNetwork->tlsDataParams.cacert = pNetwork->tlsConnectParams.pRootCALocation;
-            root_ca_len = strlen( pNetwork->tlsDataParams.cacert );
-            aws_platform_log("use server ca");
-        } else
-        {
-            pNetwork->tlsDataParams.cacert = NULL;
-            root_ca_len = 0;
-        }
-        pNetwork->tlsDataParams.ssl = ssl_connect( socket_fd,
-                                                   root_ca_len,
-                                                   pNetwork->tlsDataParams.cacert, &errno );
-        aws_platform_log("fd: %d, err:  %d", socket_fd ,errno);
+        _iot_tls_select_certs( pNetwork );
+        pNetwork->tlsDataParams.ssl = _iot_tls_handshake( socket_fd, pNetwork->tlsDataParams.clicert,
+                                                          pNetwork->tlsDataParams.pkey,
+                                                          pNetwork->tlsDataParams.cacert );
+        pNetwork->connectTiming.tlsMs = _iot_tls_lap( &phaseStartMs );
         if ( pNetwork->tlsDataParams.ssl == NULL )
         {
             aws_platform_log("ssl connect err");
@@ -281,6 +688,272 @@ IoT_Error_t iot_tls_connect( Network *pNetwork, TLSConnectParams *params )
     return MQTT_SUCCESS;
 }
 
+#ifdef _ENABLE_NONBLOCKING_CONNECT_
+/**
+ * @brief TLS handshake handed to a helper task
+ *
+ * Allocated by the connecting task, owned as described at HelperJobState. An abandoned
+ * task closes the ssl and socket itself. Certificates are referenced, not copied, they
+ * must stay valid.
+ */
+struct _TLSHandshakeJob {
+    volatile uint32_t state;                    ///< HelperJobState, changed with compare-and-swap
+    int fd;
+    const char *clicert;
+    const char *pkey;
+    char *cacert;
+    mico_ssl_t ssl;                             ///< Result, NULL = failed
+};
+
+/* Close whatever the job still holds and free it, only by its owner */
+static void _iot_tls_handshake_job_free( TLSHandshakeJob *pJob )
+{
+#ifdef _ENABLE_SSL_SUPPORT_
+    if ( pJob->ssl != NULL )
+    {
+        ssl_close( pJob->ssl );
+    }
+#endif
+    if ( pJob->fd != -1 )
+    {
+        close( pJob->fd );
+    }
+    free( pJob );
+}
+
+#ifdef _ENABLE_SSL_SUPPORT_
+static void _iot_tls_handshake_thread( mico_thread_arg_t arg )
+{
+    TLSHandshakeJob *pJob = (TLSHandshakeJob *) (uintptr_t) arg;
+
+    pJob->ssl = _iot_tls_handshake( pJob->fd, pJob->clicert, pJob->pkey, pJob->cacert );
+
+    if ( !mqtt_atomic_cas_u32( &pJob->state, HELPER_JOB_RUNNING, HELPER_JOB_DONE ) )
+    {
+        /* Abandoned, nobody else references the job any more */
+        _iot_tls_handshake_job_free( pJob );
+    }
+
+    mico_rtos_delete_thread( NULL );
+}
+
+/* Hand the connected socket to a new handshake task, pStep->fd is the job's from here on */
+static IoT_Error_t _iot_tls_handshake_start( Network *pNetwork )
+{
+    ConnectStepParams *pStep = &pNetwork->tlsDataParams.connectStep;
+    TLSHandshakeJob *pJob;
+
+    pJob = (TLSHandshakeJob *) malloc( sizeof(TLSHandshakeJob) );
+    if ( pJob == NULL )
+    {
+        return SSL_CONNECTION_ERROR;
+    }
+
+    _iot_tls_select_certs( pNetwork );
+    pJob->state = HELPER_JOB_RUNNING;
+    pJob->fd = pStep->fd;
+    pJob->clicert = pNetwork->tlsDataParams.clicert;
+    pJob->pkey = pNetwork->tlsDataParams.pkey;
+    pJob->cacert = pNetwork->tlsDataParams.cacert;
+    pJob->ssl = NULL;
+
+    if ( kNoErr != mico_rtos_create_thread( NULL, MICO_APPLICATION_PRIORITY, "tls handshake",
+                                            _iot_tls_handshake_thread, MQTT_TLS_HANDSHAKE_STACK_SIZE,
+                                            (mico_thread_arg_t) (uintptr_t) pJob ) )
+    {
+        free( pJob );
+        return SSL_CONNECTION_ERROR;
+    }
+
+    pStep->fd = -1;
+    pStep->pHandshake = pJob;
+    return MQTT_SUCCESS;
+}
+#endif
+
+static IoT_Error_t _iot_tls_connect_step_fail( Network *pNetwork, IoT_Error_t rc )
+{
+    ConnectStepParams *pStep = &pNetwork->tlsDataParams.connectStep;
+
+    if ( pStep->fd != -1 )
+    {
+        close( pStep->fd );
+        pStep->fd = -1;
+    }
+    pStep->phase = CONNECT_PHASE_IDLE;
+    return rc;
+}
+
+/* Give up on a connect in progress. A running handshake is detached and cleans up after itself */
+static void _iot_tls_connect_step_abort( Network *pNetwork )
+{
+    ConnectStepParams *pStep = &pNetwork->tlsDataParams.connectStep;
+    TLSHandshakeJob *pJob = pStep->pHandshake;
+
+    if ( pJob != NULL )
+    {
+        pStep->pHandshake = NULL;
+        if ( !mqtt_atomic_cas_u32( &pJob->state, HELPER_JOB_RUNNING, HELPER_JOB_ABANDONED ) )
+        {
+            /* Finished meanwhile, the job is ours */
+            _iot_tls_handshake_job_free( pJob );
+        }
+    }
+
+    if ( pStep->phase != CONNECT_PHASE_IDLE )
+    {
+        (void) _iot_tls_connect_step_fail( pNetwork, MQTT_SUCCESS );
+    }
+}
+
+IoT_Error_t iot_tls_connect_step( Network *pNetwork, TLSConnectParams *params )
+{
+    ConnectStepParams *pStep;
+    DNSCacheParams *pCache;
+    TLSHandshakeJob *pJob;
+    OSStatus err = kNoErr;
+
+    if ( NULL == pNetwork )
+    {
+        return NULL_VALUE_ERROR;
+    }
+
+    pStep = &pNetwork->tlsDataParams.connectStep;
+    pCache = &pNetwork->tlsDataParams.dnsCache;
+
+    switch ( pStep->phase )
+    {
+        case CONNECT_PHASE_IDLE:
+            if ( NULL != params )
+            {
+                _iot_tls_set_connect_params( pNetwork, params->pRootCALocation, params->pDeviceCertLocation,
+                                             params->pDevicePrivateKeyLocation,
+                                             params->pDestinationURL,
+                                             params->DestinationPort,
+                                             params->timeout_ms,
+                                             params->ServerVerificationFlag,
+                                             params->isUseSSL );
+            }
+            pStep->fd = -1;
+            pStep->isResolving = false;
+            memset( &pNetwork->connectTiming, 0, sizeof(NetworkConnectTiming) );
+            pStep->phaseStartMs = timer_now_raw_ms( );
+
+            if ( !socket_is_link_up( ) )
+            {
+                pNetwork->connectTiming.linkCheckMs = _iot_tls_lap( &pStep->phaseStartMs );
+                aws_platform_log("ERROR: link is down.");
+                return TCP_CONNECTION_ERROR;
+            }
+            pNetwork->connectTiming.linkCheckMs = _iot_tls_lap( &pStep->phaseStartMs );
+            pStep->phase = CONNECT_PHASE_RESOLVE;
+            /* no break */
+
+        case CONNECT_PHASE_RESOLVE:
+            err = _dns_cache_resolve_step( pCache, pNetwork->tlsConnectParams.pDestinationURL, &pStep->isResolving );
+            if ( err == kInProgressErr )
+            {
+                return MQTT_CONNECT_IN_PROGRESS;
+            }
+            pNetwork->connectTiming.dnsMs = _iot_tls_lap( &pStep->phaseStartMs );
+            if ( err != kNoErr )
+            {
+                aws_platform_log("ERROR: Unable to resolute the host address.");
+                return _iot_tls_connect_step_fail( pNetwork, TCP_CONNECTION_ERROR );
+            }
+            aws_platform_log("host:%s, %d addresses", pNetwork->tlsConnectParams.pDestinationURL, pCache->addrCount);
+
+            pStep->addrTries = 0;
+            pStep->phase = CONNECT_PHASE_TCP;
+            pStep->tcpStartMs = timer_now_ms( );
+            if ( kNoErr != socket_tcp_connect_start( &pStep->fd, pCache->addrs[pCache->addrIndex],
+                                                     pNetwork->tlsConnectParams.DestinationPort ) )
+            {
+                return _iot_tls_connect_step_fail( pNetwork, TCP_CONNECTION_ERROR );
+            }
+            return MQTT_CONNECT_IN_PROGRESS;
+
+        case CONNECT_PHASE_TCP:
+            err = socket_tcp_connect_poll( pStep->fd );
+            if ( err == kInProgressErr && timer_now_ms( ) - pStep->tcpStartMs < MQTT_TCP_SOCKET_TIMEOUT_MS )
+            {
+                return MQTT_CONNECT_IN_PROGRESS;
+            }
+            if ( err != kNoErr )
+            {
+                /* Try the next cached address, the one that connects is tried first next time */
+                aws_platform_log("tcp connect to address %d failed", pCache->addrIndex);
+                close( pStep->fd );
+                pStep->fd = -1;
+                if ( ++pStep->addrTries >= pCache->addrCount )
+                {
+                    pNetwork->connectTiming.tcpMs = _iot_tls_lap( &pStep->phaseStartMs );
+                    pCache->expiresMs = timer_now_ms( );
+                    return _iot_tls_connect_step_fail( pNetwork, TCP_CONNECTION_ERROR );
+                }
+                pCache->addrIndex = (uint8_t) ((pCache->addrIndex + 1) % pCache->addrCount);
+                pStep->tcpStartMs = timer_now_ms( );
+                if ( kNoErr != socket_tcp_connect_start( &pStep->fd, pCache->addrs[pCache->addrIndex],
+                                                         pNetwork->tlsConnectParams.DestinationPort ) )
+                {
+                    return _iot_tls_connect_step_fail( pNetwork, TCP_CONNECTION_ERROR );
+                }
+                return MQTT_CONNECT_IN_PROGRESS;
+            }
+            aws_platform_log("tcp connected fd: %d", pStep->fd);
+            pNetwork->connectTiming.tcpMs = _iot_tls_lap( &pStep->phaseStartMs );
+
+            if ( pNetwork->tlsConnectParams.isUseSSL == true )
+            {
+#ifdef _ENABLE_SSL_SUPPORT_
+                if ( MQTT_SUCCESS != _iot_tls_handshake_start( pNetwork ) )
+                {
+                    return _iot_tls_connect_step_fail( pNetwork, SSL_CONNECTION_ERROR );
+                }
+                pStep->phase = CONNECT_PHASE_TLS;
+                return MQTT_CONNECT_IN_PROGRESS;
+#endif
+            }
+
+            pNetwork->tlsDataParams.server_fd = pStep->fd;
+            pStep->fd = -1;
+            pStep->phase = CONNECT_PHASE_IDLE;
+            return MQTT_SUCCESS;
+
+        case CONNECT_PHASE_TLS:
+            pJob = pStep->pHandshake;
+            if ( pJob == NULL )
+            {
+                break;
+            }
+            if ( mqtt_atomic_load_u32( &pJob->state ) != HELPER_JOB_DONE )
+            {
+                return MQTT_CONNECT_IN_PROGRESS;
+            }
+            pStep->pHandshake = NULL;
+            pNetwork->connectTiming.tlsMs = _iot_tls_lap( &pStep->phaseStartMs );
+
+            if ( pJob->ssl == NULL )
+            {
+                aws_platform_log("ssl connect err");
+                _iot_tls_handshake_job_free( pJob );
+                return _iot_tls_connect_step_fail( pNetwork, SSL_CONNECTION_ERROR );
+            }
+            pNetwork->tlsDataParams.ssl = pJob->ssl;
+            pNetwork->tlsDataParams.server_fd = pJob->fd;
+            free( pJob );
+            aws_platform_log("ssl connected");
+            pStep->phase = CONNECT_PHASE_IDLE;
+            return MQTT_SUCCESS;
+
+        default:
+            break;
+    }
+
+    return _iot_tls_connect_step_fail( pNetwork, TCP_CONNECTION_ERROR );
+}
+#endif
+
 IoT_Error_t iot_tls_write( Network *pNetwork, unsigned char *pMsg, size_t len, Timer *timer,
 size_t *written_len )
 {
@@ -294,6 +967,7 @@ size_t *written_len )
     {
         while ( (!has_timer_expired( timer )) && ((ret = socket_send( pNetwork, pMsg + written_so_far, len - written_so_far )) <= 0) )
         {
+            timer_refresh_cached_now( );
             if ( ret < 0 )
             {
                 aws_platform_log(" failed");
@@ -346,10 +1020,16 @@ size_t *read_len )
 #ifdef _ENABLE_SSL_SUPPORT_
             if ( ssl_pending( pNetwork->tlsDataParams.ssl ) )
             {
+                pNetwork->callCounters.recvCalls++;
+                MQTT_TRACE_BEGIN( "ssl_recv" );
                 ret = ssl_recv( pNetwork->tlsDataParams.ssl, pMsg, len );
+                MQTT_TRACE_END( "ssl_recv", ret );
             } else
             {
+                pNetwork->callCounters.selectCalls++;
+                MQTT_TRACE_BEGIN( "select" );
                 ret = select( fd + 1, &readfds, NULL, NULL, &t );
+                MQTT_TRACE_END( "select", ret );
                 aws_platform_log("select ret %d", ret);
                 if ( ret <= 0 )
                 {
@@ -361,12 +1041,18 @@ size_t *read_len )
                     aws_platform_log("fd is set err");
                     break;
                 }
+                pNetwork->callCounters.recvCalls++;
+                MQTT_TRACE_BEGIN( "ssl_recv" );
                 ret = ssl_recv( pNetwork->tlsDataParams.ssl, pMsg, len );
+                MQTT_TRACE_END( "ssl_recv", ret );
             }
 #endif
         } else
         {
+            pNetwork->callCounters.selectCalls++;
+            MQTT_TRACE_BEGIN( "select" );
             ret = select( fd + 1, &readfds, NULL, NULL, &t );
+            MQTT_TRACE_END( "select", ret );
             aws_platform_log("select ret %d", ret);
             if ( ret <= 0 )
             {
@@ -378,7 +1064,10 @@ size_t *read_len )
                 aws_platform_log("fd is set err");
                 break;
             }
+            pNetwork->callCounters.recvCalls++;
+            MQTT_TRACE_BEGIN( "recv" );
             ret = recv( pNetwork->tlsDataParams.server_fd, pMsg, len, 0 );
+            MQTT_TRACE_END( "recv", ret );
         }
 
         if ( ret >= 0 )
@@ -393,6 +1082,7 @@ size_t *read_len )
         }
 
         // Evaluate timeout after the read to make sure read is done at least once
+        timer_refresh_cached_now( );
         if ( has_timer_expired( timer ) )
         {
             aws_platform_log("read time out");
@@ -417,8 +1107,59 @@ size_t *read_len )
     }
 }
 
+#ifdef _ENABLE_THREAD_SUPPORT_
+IoT_Error_t iot_tls_wait( Network *pNetwork, int wakeFd, Timer *timer )
+{
+    int fd = pNetwork->tlsDataParams.server_fd;
+    int max_fd = fd;
+    int ret;
+    fd_set readfds;
+    struct timeval t;
+    int time_out = left_ms( timer );
+
+#ifdef _ENABLE_SSL_SUPPORT_
+    /* Decrypted data already buffered does not make the socket readable */
+    if ( pNetwork->tlsConnectParams.isUseSSL == true && ssl_pending( pNetwork->tlsDataParams.ssl ) )
+    {
+        return MQTT_SUCCESS;
+    }
+#endif
+
+    FD_ZERO( &readfds );
+    FD_SET( fd, &readfds );
+    if ( wakeFd >= 0 )
+    {
+        FD_SET( wakeFd, &readfds );
+        if ( wakeFd > max_fd )
+        {
+            max_fd = wakeFd;
+        }
+    }
+
+    t.tv_sec = time_out / 1000;
+    t.tv_usec = (time_out % 1000) * 1000;
+
+    pNetwork->callCounters.selectCalls++;
+    MQTT_TRACE_BEGIN( "select" );
+    ret = select( max_fd + 1, &readfds, NULL, NULL, &t );
+    MQTT_TRACE_END( "select", ret );
+    aws_platform_log("wait select ret %d", ret);
+
+    if ( ret > 0 && FD_ISSET( fd, &readfds ) )
+    {
+        return MQTT_SUCCESS;
+    }
+
+    return NETWORK_SSL_NOTHING_TO_READ;
+}
+#endif
+
 IoT_Error_t iot_tls_disconnect( Network *pNetwork )
 {
+#ifdef _ENABLE_NONBLOCKING_CONNECT_
+    _iot_tls_connect_step_abort( pNetwork );
+#endif
+
     /* All other negative return values indicate connection needs to be reset.
      * No further action required since this is disconnect call */
     if ( pNetwork->tlsDataParams.ssl != NULL )
@@ -440,6 +1181,15 @@ IoT_Error_t iot_tls_disconnect( Network *pNetwork )
 
 IoT_Error_t iot_tls_destroy( Network *pNetwork )
 {
+#ifdef _ENABLE_NONBLOCKING_CONNECT_
+    /* Detach a handshake still running, it must not outlive us holding a reference */
+    _iot_tls_connect_step_abort( pNetwork );
+#endif
+#ifdef _ENABLE_DNS_RESOLVER_TASK_
+    /* Keep a finished refresh, detach one still running */
+    _dns_cache_take_refresh( &pNetwork->tlsDataParams.dnsCache, timer_now_ms( ) );
+    _dns_cache_abort_refresh( &pNetwork->tlsDataParams.dnsCache );
+#endif
     return MQTT_SUCCESS;
 }
 #ifdef __cplusplus
@@ -18,11 +18,78 @@
 
 #include "mico_socket.h"
 #include "mico_wlan.h"
+#include "../user_config/mqtt_config.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/* The non-blocking connect resolves on the same helper task as the async refresh */
+#if defined(_ENABLE_DNS_ASYNC_REFRESH_) || defined(_ENABLE_NONBLOCKING_CONNECT_)
+#define _ENABLE_DNS_RESOLVER_TASK_
+#endif
+
+#ifdef _ENABLE_DNS_RESOLVER_TASK_
+/**
+ * @brief State of a job handed to a helper task
+ *
+ * Jobs live on the heap. Whoever moves the state away from HELPER_JOB_RUNNING decides
+ * who frees the job, so a task never touches a Network that may be gone.
+ */
+typedef enum {
+    HELPER_JOB_RUNNING = 0,
+    HELPER_JOB_DONE = 1,                        ///< Result ready, the job belongs to the Network again
+    HELPER_JOB_ABANDONED = 2                    ///< The Network gave up on it, the task frees the job
+} HelperJobState;
+
+typedef struct _DNSResolveJob DNSResolveJob;
+#endif
+
+/**
+ * @brief DNS Cache
+ *
+ * Addresses resolved for the destination host, kept across connects so reconnects
+ * skip DNS while the entry is fresh. Addresses are IPv4 in network byte order.
+ */
+typedef struct _DNSCacheParams {
+    const char *pHost;                          ///< Host the addresses belong to, NULL = empty
+    uint32_t addrs[MQTT_DNS_CACHE_MAX_ADDRS];
+    uint8_t addrCount;
+    uint8_t addrIndex;                          ///< Address tried first, the last one that connected
+    uint32_t expiresMs;                         ///< timer_now_ms() the addresses go stale at
+#ifdef _ENABLE_DNS_RESOLVER_TASK_
+    DNSResolveJob *pRefresh;                    ///< Resolve on the helper task, running or not taken over yet, NULL = none
+#endif
+} DNSCacheParams;
+
+#ifdef _ENABLE_NONBLOCKING_CONNECT_
+typedef enum {
+    CONNECT_PHASE_IDLE = 0,
+    CONNECT_PHASE_RESOLVE = 1,
+    CONNECT_PHASE_TCP = 2,
+    CONNECT_PHASE_TLS = 3
+} ConnectPhase;
+
+typedef struct _TLSHandshakeJob TLSHandshakeJob;
+
+/**
+ * @brief Non-blocking Connect Parameters
+ *
+ * Progress of iot_tls_connect_step. The SSL library only offers a blocking handshake,
+ * it runs on a helper task working on a heap allocated TLSHandshakeJob. The task never
+ * touches the Network, so an abandoned handshake outlives a disconnect or the Network.
+ */
+typedef struct _ConnectStepParams {
+    ConnectPhase phase;
+    int fd;                                     ///< Socket being connected, -1 = none or handed to pHandshake
+    uint8_t addrTries;                          ///< Cached addresses tried so far
+    bool isResolving;                           ///< Waiting for the resolver task
+    uint32_t tcpStartMs;                        ///< timer_now_ms() the current TCP attempt started
+    uint32_t phaseStartMs;                      ///< timer_now_ms() the current phase started, for Network.connectTiming
+    TLSHandshakeJob *pHandshake;                ///< Handshake running on the helper task, NULL = none
+} ConnectStepParams;
+#endif
+
 /**
  * @brief TLS Connection Parameters
  *
@@ -35,6 +102,10 @@ typedef struct _TLSDataParams {
     char *cacert;
     const char *clicert;
     const char *pkey;
+    DNSCacheParams dnsCache;
+#ifdef _ENABLE_NONBLOCKING_CONNECT_
+    ConnectStepParams connectStep;
+#endif
 }TLSDataParams;
 
 #ifdef __cplusplus
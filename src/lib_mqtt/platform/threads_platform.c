@@ -17,6 +17,8 @@
 #include "../user_config/mqtt_config.h"
 #ifdef _ENABLE_THREAD_SUPPORT_
 
+#include "mqtt_atomic.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -30,6 +32,7 @@ extern "C" {
  * @return IoT_Error_t - error code indicating result of operation
  */
 IoT_Error_t aws_iot_thread_mutex_init(IoT_Mutex_t *pMutex) {
+	pMutex->users = 0;
 	if(0 != mico_rtos_init_mutex(&(pMutex->lock))) {
 		return MUTEX_INIT_ERROR;
 	}
@@ -47,8 +50,9 @@ IoT_Error_t aws_iot_thread_mutex_init(IoT_Mutex_t *pMutex) {
  * @return IoT_Error_t - error code indicating result of operation
  */
 IoT_Error_t aws_iot_thread_mutex_lock(IoT_Mutex_t *pMutex) {
-int rc = mico_rtos_lock_mutex(&(pMutex->lock));
-	if(0 != rc) {
+	(void) mqtt_atomic_fetch_add_u32(&(pMutex->users), 1);
+	if(0 != mico_rtos_lock_mutex(&(pMutex->lock))) {
+		(void) mqtt_atomic_fetch_add_u32(&(pMutex->users), (uint32_t) -1);
 		return MUTEX_LOCK_ERROR;
 	}
 
@@ -65,7 +69,17 @@ int rc = mico_rtos_lock_mutex(&(pMutex->lock));
  * @return IoT_Error_t - error code indicating result of operation
  */
 IoT_Error_t aws_iot_thread_mutex_trylock(IoT_Mutex_t *pMutex) {
-    return MUTEX_LOCK_ERROR;
+	/* No user means the mutex is free. A task calling lock right after may still get it
+	 * first, then this waits out that one critical section */
+	if(!mqtt_atomic_cas_u32(&(pMutex->users), 0, 1)) {
+		return MUTEX_LOCK_ERROR;
+	}
+	if(0 != mico_rtos_lock_mutex(&(pMutex->lock))) {
+		(void) mqtt_atomic_fetch_add_u32(&(pMutex->users), (uint32_t) -1);
+		return MUTEX_LOCK_ERROR;
+	}
+
+	return MQTT_SUCCESS;
 }
 
 /**
@@ -80,6 +94,7 @@ IoT_Error_t aws_iot_thread_mutex_unlock(IoT_Mutex_t *pMutex) {
 	if(0 != mico_rtos_unlock_mutex(&(pMutex->lock))) {
 		return MUTEX_UNLOCK_ERROR;
 	}
+	(void) mqtt_atomic_fetch_add_u32(&(pMutex->users), (uint32_t) -1);
 
 	return MQTT_SUCCESS;
 }
@@ -100,6 +115,207 @@ IoT_Error_t aws_iot_thread_mutex_destroy(IoT_Mutex_t *pMutex) {
 	return MQTT_SUCCESS;
 }
 
+/**
+ * @brief Initialize the provided semaphore
+ *
+ * The semaphore is binary and starts out taken
+ *
+ * @param IoT_Semaphore_t - pointer to the semaphore to be initialized
+ * @return IoT_Error_t - error code indicating result of operation
+ */
+IoT_Error_t aws_iot_thread_sem_init(IoT_Semaphore_t *pSem) {
+	pSem->eventFd = -1;
+	if(0 != mico_rtos_init_semaphore(&(pSem->sem), 1)) {
+		return MUTEX_INIT_ERROR;
+	}
+
+	return MQTT_SUCCESS;
+}
+
+/**
+ * @brief Wait on the provided semaphore
+ *
+ * @param IoT_Semaphore_t - pointer to the semaphore
+ * @param timeout_ms - maximum time to block
+ * @return IoT_Error_t - MQTT_REQUEST_TIMEOUT_ERROR if not posted in time
+ */
+IoT_Error_t aws_iot_thread_sem_wait(IoT_Semaphore_t *pSem, uint32_t timeout_ms) {
+	if(0 != mico_rtos_get_semaphore(&(pSem->sem), timeout_ms)) {
+		return MQTT_REQUEST_TIMEOUT_ERROR;
+	}
+
+	return MQTT_SUCCESS;
+}
+
+/**
+ * @brief Post the provided semaphore
+ *
+ * @param IoT_Semaphore_t - pointer to the semaphore
+ * @return IoT_Error_t - error code indicating result of operation
+ */
+IoT_Error_t aws_iot_thread_sem_post(IoT_Semaphore_t *pSem) {
+	if(0 != mico_rtos_set_semaphore(&(pSem->sem))) {
+		return MUTEX_UNLOCK_ERROR;
+	}
+
+	return MQTT_SUCCESS;
+}
+
+/**
+ * @brief Destroy the provided semaphore
+ *
+ * @param IoT_Semaphore_t - pointer to the semaphore to be destroyed
+ * @return IoT_Error_t - error code indicating result of operation
+ */
+IoT_Error_t aws_iot_thread_sem_destroy(IoT_Semaphore_t *pSem) {
+	if(0 <= pSem->eventFd) {
+		(void) mico_rtos_deinit_event_fd(pSem->eventFd);
+		pSem->eventFd = -1;
+	}
+	if(0 != mico_rtos_deinit_semaphore(&(pSem->sem))) {
+		return MUTEX_DESTROY_ERROR;
+	}
+
+	return MQTT_SUCCESS;
+}
+
+/**
+ * @brief Descriptor that select() reports readable while the semaphore is posted
+ *
+ * Created on first use and kept until the semaphore is destroyed.
+ *
+ * @param IoT_Semaphore_t - pointer to the semaphore
+ * @return the descriptor, -1 if it could not be created
+ */
+int aws_iot_thread_sem_event_fd(IoT_Semaphore_t *pSem) {
+	if(0 > pSem->eventFd) {
+		pSem->eventFd = mico_rtos_init_event_fd(pSem->sem);
+	}
+
+	return pSem->eventFd;
+}
+
+#ifdef _ENABLE_STACK_WATERMARK_
+#define IOT_THREAD_STACK_PAINT		0xA5A5A5A5u
+#define IOT_THREAD_STACK_PAINT_GAP	(64)	///< Left unpainted below the painting function's frame for its spilled locals
+
+/**
+ * @brief Fill the unused part of the calling thread's stack with a known pattern
+ *
+ * MiCO does not report stack high-water marks or the stack base. The bottom is derived
+ * from the entry frame, the stack size and MQTT_STACK_WATERMARK_RESERVE, the pattern is
+ * written from there up to just below this function's frame. Words still holding it
+ * later were never used.
+ *
+ * @param entryFrame - frame address of the thread entry function
+ */
+static void __attribute__((noinline)) _aws_iot_thread_paint_stack(IoT_Thread_t *pThread, uintptr_t entryFrame) {
+	uintptr_t top = ((uintptr_t) __builtin_frame_address(0) - IOT_THREAD_STACK_PAINT_GAP) & ~(uintptr_t) 3;
+	uintptr_t bottom, addr;
+
+	if(pThread->stackSize <= MQTT_STACK_WATERMARK_RESERVE + IOT_THREAD_STACK_PAINT_GAP) {
+		return;
+	}
+	bottom = (entryFrame - pThread->stackSize + MQTT_STACK_WATERMARK_RESERVE + 3) & ~(uintptr_t) 3;
+	if(bottom >= top) {
+		return;
+	}
+
+	for(addr = bottom; addr < top; addr += sizeof(uint32_t)) {
+		*(volatile uint32_t *) addr = IOT_THREAD_STACK_PAINT;
+	}
+	pThread->stackPaintWords = (uint32_t) ((top - bottom) / sizeof(uint32_t));
+	pThread->stackPaintBase = bottom;
+}
+#endif
+
+/**
+ * @brief MiCO thread entry, runs the routine and deletes the thread when it returns
+ */
+static void _aws_iot_thread_entry(mico_thread_arg_t arg) {
+	IoT_Thread_t *pThread = (IoT_Thread_t *) (uintptr_t) arg;
+
+#ifdef _ENABLE_STACK_WATERMARK_
+	_aws_iot_thread_paint_stack(pThread, (uintptr_t) __builtin_frame_address(0));
+#endif
+	pThread->routine(pThread->pArg);
+	mico_rtos_delete_thread(NULL);
+}
+
+/**
+ * @brief Start a new thread running routine(pArg)
+ *
+ * @param IoT_Thread_t - pointer to the thread handle, must outlive the thread
+ * @param routine - thread entry function
+ * @param pArg - argument passed to routine
+ * @param pName - thread name
+ * @param stackSize - stack size in bytes
+ * @return IoT_Error_t - error code indicating result of operation
+ */
+IoT_Error_t aws_iot_thread_create(IoT_Thread_t *pThread, IoT_Thread_Routine_t routine, void *pArg,
+								  const char *pName, uint32_t stackSize) {
+	pThread->routine = routine;
+	pThread->pArg = pArg;
+#ifdef _ENABLE_STACK_WATERMARK_
+	pThread->stackSize = stackSize;
+	pThread->stackPaintBase = 0;
+	pThread->stackPaintWords = 0;
+#endif
+	if(0 != mico_rtos_create_thread(&(pThread->thread), MICO_APPLICATION_PRIORITY, pName, _aws_iot_thread_entry,
+									stackSize, (mico_thread_arg_t) (uintptr_t) pThread)) {
+		return MQTT_FAILURE;
+	}
+
+	return MQTT_SUCCESS;
+}
+
+/**
+ * @brief Is the calling thread the provided thread?
+ *
+ * @param IoT_Thread_t - pointer to the thread handle
+ * @return true if called from that thread
+ */
+bool aws_iot_thread_is_current(IoT_Thread_t *pThread) {
+	return (kNoErr == mico_rtos_is_current_thread(&(pThread->thread))) ? true : false;
+}
+
+/**
+ * @brief Stack the provided thread has never used
+ *
+ * @param IoT_Thread_t - pointer to the thread handle
+ * @return bytes of stack never touched, 0 if unknown
+ */
+uint32_t aws_iot_thread_stack_unused(IoT_Thread_t *pThread) {
+#ifdef _ENABLE_STACK_WATERMARK_
+	volatile uint32_t *pPaint = (volatile uint32_t *) pThread->stackPaintBase;
+	uint32_t itr = 0;
+
+	if(NULL == pPaint) {
+		return 0;
+	}
+
+	/* The stack grows down, usage eats into the painted area from its top. Count the
+	 * untouched words from the bottom */
+	while(itr < pThread->stackPaintWords && IOT_THREAD_STACK_PAINT == pPaint[itr]) {
+		itr++;
+	}
+
+	return itr * sizeof(uint32_t);
+#else
+	(void) pThread;
+	return 0;
+#endif
+}
+
+/**
+ * @brief Sleep the calling thread
+ *
+ * @param sleep_ms - time to sleep in milliseconds
+ */
+void aws_iot_thread_sleep(uint32_t sleep_ms) {
+	mico_rtos_thread_msleep(sleep_ms);
+}
+
 #ifdef __cplusplus
 }
 #endif
@@ -29,10 +29,41 @@ extern "C" {
  * @brief Mutex Type
  *
  * definition of the Mutex	 struct. Platform specific
+ * Backed by a MiCO mutex for priority inheritance. MiCO has no non-blocking lock, trylock
+ * uses the count of tasks holding or waiting for the mutex instead.
  *
  */
 struct _IoT_Mutex_t {
 	mico_mutex_t lock;
+	volatile uint32_t users;	///< Tasks holding or blocked on lock
+};
+
+/**
+ * @brief Semaphore Type
+ *
+ * definition of the Semaphore struct. Platform specific
+ *
+ */
+struct _IoT_Semaphore_t {
+	mico_semaphore_t sem;
+	int eventFd;	///< From aws_iot_thread_sem_event_fd, -1 = not created yet
+};
+
+/**
+ * @brief Thread Type
+ *
+ * definition of the Thread struct. Platform specific
+ *
+ */
+struct _IoT_Thread_t {
+	mico_thread_t thread;
+	IoT_Thread_Routine_t routine;
+	void *pArg;
+#ifdef _ENABLE_STACK_WATERMARK_
+	uint32_t stackSize;
+	uintptr_t stackPaintBase;	///< Address of the deepest painted word, 0 until the thread runs
+	uint32_t stackPaintWords;
+#endif
 };
 
 #ifdef __cplusplus
@@ -15,7 +15,8 @@
 
 /**
  * @file timer.c
- * @brief Linux implementation of the timer interface.
+ * @brief Monotonic tick implementation of the timer interface.
+ * Uses the RTOS tick on MiCO and CLOCK_MONOTONIC on Linux.
  */
 
 #ifdef __cplusplus
@@ -28,45 +29,109 @@ extern "C" {
 #include <stdbool.h>
 
 #include "timer_platform.h"
+#include "../user_config/mqtt_config.h"
 
-bool has_timer_expired(Timer *timer) {
-	struct timeval now, res;
-	gettimeofday(&now, NULL);
-	timersub(&timer->end_time, &now, &res);
-	return res.tv_sec < 0 || (res.tv_sec == 0 && res.tv_usec <= 0);
+#if defined(__linux__)
+#include <time.h>
+#else
+#include "mico_rtos.h"
+#endif
+
+#ifndef _ENABLE_THREAD_SUPPORT_
+static uint32_t cachedNowMs = 0;
+static uint32_t cachedNowDepth = 0;
+#endif
+
+static uint32_t _timer_read_tick_ms(void) {
+#if defined(__linux__)
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint32_t) (((uint64_t) ts.tv_sec * 1000) + (ts.tv_nsec / 1000000));
+#else
+	return (uint32_t) mico_rtos_get_time();
+#endif
 }
 
-void countdown_ms(Timer *timer, uint32_t timeout) {
-	struct timeval now;
-#ifdef __cplusplus
-	struct timeval interval = {timeout / 1000, static_cast<int>((timeout % 1000) * 1000)};
+uint32_t timer_now_ms(void) {
+#ifndef _ENABLE_THREAD_SUPPORT_
+	if(0 != cachedNowDepth) {
+		return cachedNowMs;
+	}
+#endif
+	return _timer_read_tick_ms();
+}
+
+uint32_t timer_now_raw_ms(void) {
+	return _timer_read_tick_ms();
+}
+
+uint32_t timer_now_us(void) {
+#if defined(__linux__)
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint32_t) (((uint64_t) ts.tv_sec * 1000000) + (ts.tv_nsec / 1000));
+#elif defined(MQTT_TIMER_US_SOURCE)
+	return (uint32_t) MQTT_TIMER_US_SOURCE();
 #else
-	struct timeval interval = {timeout / 1000, (int)((timeout % 1000) * 1000)};
+	return (uint32_t) mico_rtos_get_time() * 1000;
 #endif
-	gettimeofday(&now, NULL);
-	timeradd(&now, &interval, &timer->end_time);
 }
 
-uint32_t left_ms(Timer *timer) {
-	struct timeval now, res;
-	uint32_t result_ms = 0;
-	gettimeofday(&now, NULL);
-	timersub(&timer->end_time, &now, &res);
-	if(res.tv_sec >= 0) {
-		result_ms = (uint32_t) (res.tv_sec * 1000 + res.tv_usec / 1000);
+void timer_sleep_ms(uint32_t sleep_ms) {
+#if defined(__linux__)
+	struct timespec ts;
+	ts.tv_sec = sleep_ms / 1000;
+	ts.tv_nsec = (long) (sleep_ms % 1000) * 1000000;
+	(void) nanosleep(&ts, NULL);
+#else
+	mico_rtos_thread_msleep(sleep_ms);
+#endif
+}
+
+void timer_begin_cached_now(void) {
+#ifndef _ENABLE_THREAD_SUPPORT_
+	if(0 == cachedNowDepth++) {
+		cachedNowMs = _timer_read_tick_ms();
+	}
+#endif
+}
+
+void timer_refresh_cached_now(void) {
+#ifndef _ENABLE_THREAD_SUPPORT_
+	if(0 != cachedNowDepth) {
+		cachedNowMs = _timer_read_tick_ms();
 	}
-	return result_ms;
+#endif
+}
+
+void timer_end_cached_now(void) {
+#ifndef _ENABLE_THREAD_SUPPORT_
+	if(0 != cachedNowDepth) {
+		cachedNowDepth--;
+	}
+#endif
+}
+
+bool has_timer_expired(Timer *timer) {
+	return (int32_t) (timer->end_time - timer_now_ms()) <= 0;
+}
+
+void countdown_ms(Timer *timer, uint32_t timeout) {
+	timer->end_time = timer_now_ms() + timeout;
+}
+
+uint32_t left_ms(Timer *timer) {
+	int32_t left = (int32_t) (timer->end_time - timer_now_ms());
+	return (left > 0) ? (uint32_t) left : 0;
 }
 
 void countdown_sec(Timer *timer, uint32_t timeout) {
-	struct timeval now;
-	struct timeval interval = {timeout, 0};
-	gettimeofday(&now, NULL);
-	timeradd(&now, &interval, &timer->end_time);
+	countdown_ms(timer, timeout * 1000);
 }
 
 void init_timer(Timer *timer) {
-	timer->end_time = (struct timeval) {0, 0};
+	/* An initialized timer is already expired */
+	timer->end_time = timer_now_ms();
 }
 
 #ifdef __cplusplus
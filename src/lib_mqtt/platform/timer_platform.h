@@ -23,15 +23,15 @@ extern "C" {
 /**
  * @file timer_platform.h
  */
-#include <sys/time.h>
-#include <sys/select.h>
+#include <stdint.h>
 #include "timer_interface.h"
 
 /**
  * definition of the Timer struct. Platform specific
+ * end_time is a monotonic millisecond tick, compared with wrap-around safe arithmetic
  */
 struct Timer {
-	struct timeval end_time;
+	uint32_t end_time;
 };
 
 #ifdef __cplusplus
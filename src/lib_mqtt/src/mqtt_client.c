@@ -24,7 +24,10 @@ extern "C" {
 #endif
 
 #include "mqtt_log.h"
+#include "mqtt_atomic.h"
 #include "mqtt_client_interface.h"
+#include "mqtt_client_common_internal.h"
+#include "mqtt_mempool.h"
 #include "../user_config/mqtt_config.h"
 
 #ifdef _ENABLE_THREAD_SUPPORT_
@@ -41,9 +44,49 @@ ClientState mqtt_get_client_state(MQTT_Client *pClient) {
 		return CLIENT_STATE_INVALID;
 	}
 
-	FUNC_EXIT_RC(pClient->clientStatus.clientState);
+	FUNC_EXIT_RC((ClientState) mqtt_atomic_load_u32(&(pClient->clientStatus.clientState)));
 }
 
+#ifdef _ENABLE_STATE_TRACE_
+#if (MQTT_STATE_TRACE_LEN & (MQTT_STATE_TRACE_LEN - 1)) != 0
+#error "MQTT_STATE_TRACE_LEN must be a power of two"
+#endif
+
+static void _mqtt_trace_client_state(MQTT_Client *pClient, ClientState fromState, ClientState toState,
+									 uint32_t actualState, bool isApplied) {
+	ClientStateTraceEntry *pEntry;
+	uint32_t slot;
+
+	slot = mqtt_atomic_fetch_add_u32(&(pClient->stateTrace.next), 1) & (MQTT_STATE_TRACE_LEN - 1);
+	pEntry = &(pClient->stateTrace.entries[slot]);
+	pEntry->timeMs = timer_now_ms();
+	pEntry->fromState = (uint8_t) fromState;
+	pEntry->toState = (uint8_t) toState;
+	pEntry->actualState = (uint8_t) actualState;
+	pEntry->isApplied = isApplied ? 1 : 0;
+}
+
+uint32_t mqtt_get_state_trace(MQTT_Client *pClient, ClientStateTraceEntry *pEntries, uint32_t maxEntries) {
+	uint32_t next, count, itr;
+
+	if(NULL == pClient || NULL == pEntries) {
+		return 0;
+	}
+
+	next = mqtt_atomic_load_u32(&(pClient->stateTrace.next));
+	count = (next < MQTT_STATE_TRACE_LEN) ? next : MQTT_STATE_TRACE_LEN;
+	if(count > maxEntries) {
+		count = maxEntries;
+	}
+
+	for(itr = 0; itr < count; itr++) {
+		pEntries[itr] = pClient->stateTrace.entries[(next - count + itr) & (MQTT_STATE_TRACE_LEN - 1)];
+	}
+
+	return count;
+}
+#endif
+
 #ifdef _ENABLE_THREAD_SUPPORT_
 IoT_Error_t mqtt_client_lock_mutex(MQTT_Client *pClient, IoT_Mutex_t *pMutex) {
 	FUNC_ENTRY;
@@ -53,7 +96,7 @@ IoT_Error_t mqtt_client_lock_mutex(MQTT_Client *pClient, IoT_Mutex_t *pMutex) {
 		FUNC_EXIT_RC(NULL_VALUE_ERROR);
 	}
 
-	if(false == pClient->clientData.isBlockOnThreadLockEnabled) {
+	if(false == pClient->clientCold.isBlockOnThreadLockEnabled) {
 		threadRc = aws_iot_thread_mutex_trylock(pMutex);
 	} else {
 		threadRc = aws_iot_thread_mutex_lock(pMutex);
@@ -76,67 +119,219 @@ IoT_Error_t mqtt_client_unlock_mutex(MQTT_Client *pClient, IoT_Mutex_t *pMutex)
 }
 #endif
 
+/**
+ * @brief Is this an application task calling while the network I/O task owns the socket?
+ *
+ * @param pClient Reference to the IoT Client
+ *
+ * @return true if the background task is running and the caller is another task
+ */
+bool mqtt_internal_is_background_caller(MQTT_Client *pClient) {
+#ifdef _ENABLE_THREAD_SUPPORT_
+	return pClient->clientData.isBackgroundRunning
+		   && !aws_iot_thread_is_current(&(pClient->clientCold.backgroundThread));
+#else
+	IOT_UNUSED(pClient);
+	return false;
+#endif
+}
+
+/**
+ * @brief Take ownership of the TX buffer
+ *
+ * Held from serializing a packet into writeBuf until it has been sent. Always blocks
+ * in background mode, the I/O task must not drop queued publishes because another task
+ * is sending. Control packets do not use writeBuf, see mqtt_internal_lock_send.
+ *
+ * @param pClient Reference to the IoT Client
+ *
+ * @return An IoT Error Type defining successful/failed locking
+ */
+IoT_Error_t mqtt_internal_lock_tx(MQTT_Client *pClient) {
+#ifdef _ENABLE_THREAD_SUPPORT_
+	if(pClient->clientData.isBackgroundRunning) {
+		return aws_iot_thread_mutex_lock(&(pClient->clientCold.tls_write_mutex));
+	}
+	return mqtt_client_lock_mutex(pClient, &(pClient->clientCold.tls_write_mutex));
+#else
+	IOT_UNUSED(pClient);
+	return MQTT_SUCCESS;
+#endif
+}
+
+void mqtt_internal_unlock_tx(MQTT_Client *pClient) {
+#ifdef _ENABLE_THREAD_SUPPORT_
+	(void) aws_iot_thread_mutex_unlock(&(pClient->clientCold.tls_write_mutex));
+#else
+	IOT_UNUSED(pClient);
+#endif
+}
+
+/**
+ * @brief Take ownership of the network for writing
+ *
+ * Held only while a packet is written, so control packets (PINGREQ, PUBACK, DISCONNECT),
+ * which never touch writeBuf, wait for at most the write in progress and not for a
+ * publish being serialized. Taken after the TX lock when both are needed.
+ *
+ * @param pClient Reference to the IoT Client
+ *
+ * @return An IoT Error Type defining successful/failed locking
+ */
+IoT_Error_t mqtt_internal_lock_send(MQTT_Client *pClient) {
+#ifdef _ENABLE_THREAD_SUPPORT_
+	if(pClient->clientData.isBackgroundRunning) {
+		return aws_iot_thread_mutex_lock(&(pClient->clientCold.tls_send_mutex));
+	}
+	return mqtt_client_lock_mutex(pClient, &(pClient->clientCold.tls_send_mutex));
+#else
+	IOT_UNUSED(pClient);
+	return MQTT_SUCCESS;
+#endif
+}
+
+void mqtt_internal_unlock_send(MQTT_Client *pClient) {
+#ifdef _ENABLE_THREAD_SUPPORT_
+	(void) aws_iot_thread_mutex_unlock(&(pClient->clientCold.tls_send_mutex));
+#else
+	IOT_UNUSED(pClient);
+#endif
+}
+
 IoT_Error_t mqtt_set_client_state(MQTT_Client *pClient, ClientState expectedCurrentState,
 										  ClientState newState) {
 	IoT_Error_t rc;
-#ifdef _ENABLE_THREAD_SUPPORT_
-	IoT_Error_t threadRc = MQTT_FAILURE;
-#endif
+	uint32_t actualState;
 
 	FUNC_ENTRY;
 	if(NULL == pClient) {
 		FUNC_EXIT_RC(NULL_VALUE_ERROR);
 	}
 
-#ifdef _ENABLE_THREAD_SUPPORT_
-	rc = mqtt_client_lock_mutex(pClient, &(pClient->clientData.state_change_mutex));
-	if(MQTT_SUCCESS != rc) {
-		return rc;
-	}
-#endif
-	if(expectedCurrentState == mqtt_get_client_state(pClient)) {
-		pClient->clientStatus.clientState = newState;
+	/* Lock-free, a single compare-and-swap on the state word */
+	actualState = (uint32_t) expectedCurrentState;
+	if(mqtt_atomic_compare_exchange_u32(&(pClient->clientStatus.clientState), &actualState, (uint32_t) newState)) {
 		rc = MQTT_SUCCESS;
 	} else {
 		rc = MQTT_UNEXPECTED_CLIENT_STATE_ERROR;
 	}
 
-#ifdef _ENABLE_THREAD_SUPPORT_
-	threadRc = mqtt_client_unlock_mutex(pClient, &(pClient->clientData.state_change_mutex));
-	if(MQTT_SUCCESS == rc && MQTT_SUCCESS != threadRc) {
-		rc = threadRc;
-	}
+#ifdef _ENABLE_STATE_TRACE_
+	_mqtt_trace_client_state(pClient, expectedCurrentState, newState, actualState, MQTT_SUCCESS == rc);
 #endif
 
 	FUNC_EXIT_RC(rc);
 }
 
+/**
+ * @brief Set the client state whatever it currently is
+ *
+ * Only for error paths that must win over any operation in progress, e.g. tearing
+ * down a dead connection.
+ *
+ * @param pClient Reference to the IoT Client
+ * @param newState State to set
+ */
+void mqtt_internal_force_client_state(MQTT_Client *pClient, ClientState newState) {
+	uint32_t previousState;
+
+	previousState = mqtt_atomic_exchange_u32(&(pClient->clientStatus.clientState), (uint32_t) newState);
+#ifdef _ENABLE_STATE_TRACE_
+	_mqtt_trace_client_state(pClient, (ClientState) previousState, newState, previousState, true);
+#else
+	IOT_UNUSED(previousState);
+#endif
+}
+
 IoT_Error_t mqtt_set_connect_params(MQTT_Client *pClient, IoT_Client_Connect_Params *pNewConnectParams) {
 	FUNC_ENTRY;
 	if(NULL == pClient || NULL == pNewConnectParams) {
 		FUNC_EXIT_RC(NULL_VALUE_ERROR);
 	}
 
-	pClient->clientData.options.isWillMsgPresent = pNewConnectParams->isWillMsgPresent;
-	pClient->clientData.options.MQTTVersion = pNewConnectParams->MQTTVersion;
-	pClient->clientData.options.pClientID = pNewConnectParams->pClientID;
-	pClient->clientData.options.clientIDLen = pNewConnectParams->clientIDLen;
-	pClient->clientData.options.pUsername = pNewConnectParams->pUsername;
-	pClient->clientData.options.usernameLen = pNewConnectParams->usernameLen;
-	pClient->clientData.options.pPassword = pNewConnectParams->pPassword;
-	pClient->clientData.options.passwordLen = pNewConnectParams->passwordLen;
-	pClient->clientData.options.will.pTopicName = pNewConnectParams->will.pTopicName;
-	pClient->clientData.options.will.topicNameLen = pNewConnectParams->will.topicNameLen;
-	pClient->clientData.options.will.pMessage = pNewConnectParams->will.pMessage;
-	pClient->clientData.options.will.msgLen = pNewConnectParams->will.msgLen;
-	pClient->clientData.options.will.qos = pNewConnectParams->will.qos;
-	pClient->clientData.options.will.isRetained = pNewConnectParams->will.isRetained;
-	pClient->clientData.options.keepAliveIntervalInSec = pNewConnectParams->keepAliveIntervalInSec;
-	pClient->clientData.options.isCleanSession = pNewConnectParams->isCleanSession;
+	pClient->clientCold.options.isWillMsgPresent = pNewConnectParams->isWillMsgPresent;
+	pClient->clientCold.options.MQTTVersion = pNewConnectParams->MQTTVersion;
+	pClient->clientCold.options.pClientID = pNewConnectParams->pClientID;
+	pClient->clientCold.options.clientIDLen = pNewConnectParams->clientIDLen;
+	pClient->clientCold.options.pUsername = pNewConnectParams->pUsername;
+	pClient->clientCold.options.usernameLen = pNewConnectParams->usernameLen;
+	pClient->clientCold.options.pPassword = pNewConnectParams->pPassword;
+	pClient->clientCold.options.passwordLen = pNewConnectParams->passwordLen;
+	pClient->clientCold.options.will.pTopicName = pNewConnectParams->will.pTopicName;
+	pClient->clientCold.options.will.topicNameLen = pNewConnectParams->will.topicNameLen;
+	pClient->clientCold.options.will.pMessage = pNewConnectParams->will.pMessage;
+	pClient->clientCold.options.will.msgLen = pNewConnectParams->will.msgLen;
+	pClient->clientCold.options.will.qos = pNewConnectParams->will.qos;
+	pClient->clientCold.options.will.isRetained = pNewConnectParams->will.isRetained;
+	pClient->clientCold.options.keepAliveIntervalInSec = pNewConnectParams->keepAliveIntervalInSec;
+	pClient->clientCold.options.isCleanSession = pNewConnectParams->isCleanSession;
 
 	FUNC_EXIT_RC(MQTT_SUCCESS);
 }
 
+#ifdef _ENABLE_THREAD_SUPPORT_
+/**
+ * @brief Release the locks and semaphores mqtt_init created
+ */
+static void _mqtt_destroy_sync(MQTT_Client *pClient) {
+	uint32_t i;
+
+	(void) aws_iot_thread_mutex_destroy(&(pClient->clientCold.tls_read_mutex));
+	(void) aws_iot_thread_mutex_destroy(&(pClient->clientCold.tls_write_mutex));
+	(void) aws_iot_thread_mutex_destroy(&(pClient->clientCold.tls_send_mutex));
+	(void) aws_iot_thread_mutex_destroy(&(pClient->clientCold.pending_mutex));
+	for(i = 0; i < MQTT_MAX_PENDING_REQUESTS; ++i) {
+		(void) aws_iot_thread_sem_destroy(&(pClient->clientCold.pendingRequests[i].doneSem));
+	}
+	(void) aws_iot_thread_sem_destroy(&(pClient->clientCold.background_exit_sem));
+	(void) aws_iot_thread_sem_destroy(&(pClient->clientCold.txWakeSem));
+}
+#endif
+
+static IoT_Error_t _mqtt_init_buffers(MQTT_Client *pClient, IoT_Client_Init_Params *pInitParams) {
+	ClientData *pData = &(pClient->clientData);
+
+	pData->writeBufSize = (0 != pInitParams->writeBufSize) ? pInitParams->writeBufSize : MQTT_TX_BUF_LEN;
+	pData->readBufSize = (0 != pInitParams->readBufSize) ? pInitParams->readBufSize : MQTT_RX_BUF_LEN;
+
+	/* Every fixed size packet (CONNECT header, acks, PINGREQ) must fit either buffer */
+	if(pData->writeBufSize < MQTT_ACK_PACKET_MAX_LEN) {
+		return MQTT_TX_BUFFER_TOO_SHORT_ERROR;
+	}
+	if(pData->readBufSize < MQTT_ACK_PACKET_MAX_LEN) {
+		return MQTT_RX_BUFFER_TOO_SHORT_ERROR;
+	}
+
+	if(NULL != pInitParams->pWriteBuf) {
+		pData->writeBuf = pInitParams->pWriteBuf;
+	} else {
+		pData->writeBuf = (unsigned char *) MQTT_MALLOC(pData->writeBufSize);
+		if(NULL == pData->writeBuf) {
+			IOT_ERROR("TX buffer allocation of %u bytes failed", (unsigned int) pData->writeBufSize);
+			return MQTT_BUFFER_ALLOC_ERROR;
+		}
+		pClient->clientCold.isWriteBufOwned = true;
+	}
+
+	if(NULL != pInitParams->pReadBuf) {
+		pData->readBuf = pInitParams->pReadBuf;
+	} else {
+		pData->readBuf = (unsigned char *) MQTT_MALLOC(pData->readBufSize);
+		if(NULL == pData->readBuf) {
+			IOT_ERROR("RX buffer allocation of %u bytes failed", (unsigned int) pData->readBufSize);
+			if(pClient->clientCold.isWriteBufOwned) {
+				MQTT_FREE(pData->writeBuf);
+				pClient->clientCold.isWriteBufOwned = false;
+			}
+			pData->writeBuf = NULL;
+			return MQTT_BUFFER_ALLOC_ERROR;
+		}
+		pClient->clientCold.isReadBufOwned = true;
+	}
+
+	return MQTT_SUCCESS;
+}
+
 IoT_Error_t mqtt_init(MQTT_Client *pClient, IoT_Client_Init_Params *pInitParams) {
 	uint32_t i;
 	IoT_Error_t rc;
@@ -165,21 +360,34 @@ IoT_Error_t mqtt_init(MQTT_Client *pClient, IoT_Client_Init_Params *pInitParams)
 	    }
 	}
 
+#ifdef _ENABLE_STATE_TRACE_
+	memset(&(pClient->stateTrace), 0, sizeof(ClientStateTrace));
+#endif
+
 	for(i = 0; i < MQTT_NUM_SUBSCRIBE_HANDLERS; ++i) {
-		pClient->clientData.messageHandlers[i].topicName = NULL;
-		pClient->clientData.messageHandlers[i].pApplicationHandler = NULL;
-		pClient->clientData.messageHandlers[i].pApplicationHandlerData = NULL;
-		pClient->clientData.messageHandlers[i].qos = QOS0;
+		pClient->clientCold.messageHandlers[i].topicName = NULL;
+		pClient->clientCold.messageHandlers[i].pApplicationHandler = NULL;
+		pClient->clientCold.messageHandlers[i].pApplicationHandlerData = NULL;
+		pClient->clientCold.messageHandlers[i].qos = QOS0;
+		pClient->clientCold.messageHandlers[i].isConflated = false;
 	}
+	pClient->clientCold.conflatedMessage.pendingHandlerMask = 0;
 
 	pClient->clientData.packetTimeoutMs = pInitParams->mqttPacketTimeout_ms;
 	pClient->clientData.commandTimeoutMs = pInitParams->mqttCommandTimeout_ms;
-	pClient->clientData.writeBufSize = MQTT_TX_BUF_LEN;
-	pClient->clientData.readBufSize = MQTT_RX_BUF_LEN;
-	pClient->clientData.counterNetworkDisconnected = 0;
-	pClient->clientData.disconnectHandler = pInitParams->disconnectHandler;
-	pClient->clientData.disconnectHandlerData = pInitParams->disconnectHandlerData;
+	pClient->clientData.writeBuf = NULL;
+	pClient->clientData.readBuf = NULL;
+	pClient->clientCold.isWriteBufOwned = false;
+	pClient->clientCold.isReadBufOwned = false;
+	pClient->clientCold.counterNetworkDisconnected = 0;
+	pClient->clientCold.disconnectHandler = pInitParams->disconnectHandler;
+	pClient->clientCold.disconnectHandlerData = pInitParams->disconnectHandlerData;
+	memset(&(pClient->clientCold.connectTiming), 0, sizeof(IoT_Connect_Timing));
+	pClient->clientCold.connackStartMs = 0;
+	pClient->clientCold.connectTimingHandler = NULL;
+	pClient->clientCold.connectTimingHandlerData = NULL;
 	pClient->clientData.nextPacketId = 1;
+	memset(&(pClient->stats), 0, sizeof(IoT_Client_Stats));
 
 	/* Initialize default connection options */
 	rc = mqtt_set_connect_params(pClient, &default_options);
@@ -188,23 +396,76 @@ IoT_Error_t mqtt_init(MQTT_Client *pClient, IoT_Client_Init_Params *pInitParams)
 	}
 
 #ifdef _ENABLE_THREAD_SUPPORT_
-	pClient->clientData.isBlockOnThreadLockEnabled = pInitParams->isBlockOnThreadLockEnabled;
-	rc = aws_iot_thread_mutex_init(&(pClient->clientData.state_change_mutex));
+	pClient->clientCold.isBlockOnThreadLockEnabled = pInitParams->isBlockOnThreadLockEnabled;
+	rc = aws_iot_thread_mutex_init(&(pClient->clientCold.tls_read_mutex));
 	if(MQTT_SUCCESS != rc) {
 		FUNC_EXIT_RC(rc);
 	}
-	rc = aws_iot_thread_mutex_init(&(pClient->clientData.tls_read_mutex));
+	rc = aws_iot_thread_mutex_init(&(pClient->clientCold.tls_write_mutex));
 	if(MQTT_SUCCESS != rc) {
 		FUNC_EXIT_RC(rc);
 	}
-	rc = aws_iot_thread_mutex_init(&(pClient->clientData.tls_write_mutex));
+	rc = aws_iot_thread_mutex_init(&(pClient->clientCold.tls_send_mutex));
 	if(MQTT_SUCCESS != rc) {
 		FUNC_EXIT_RC(rc);
 	}
+	rc = aws_iot_thread_mutex_init(&(pClient->clientCold.pending_mutex));
+	if(MQTT_SUCCESS != rc) {
+		FUNC_EXIT_RC(rc);
+	}
+	for(i = 0; i < MQTT_MAX_PENDING_REQUESTS; ++i) {
+		pClient->clientCold.pendingRequests[i].packetType = 0;
+		rc = aws_iot_thread_sem_init(&(pClient->clientCold.pendingRequests[i].doneSem));
+		if(MQTT_SUCCESS != rc) {
+			FUNC_EXIT_RC(rc);
+		}
+	}
+	pClient->clientCold.reservedHandlerMask = 0;
+	rc = aws_iot_thread_sem_init(&(pClient->clientCold.background_exit_sem));
+	if(MQTT_SUCCESS != rc) {
+		FUNC_EXIT_RC(rc);
+	}
+	rc = aws_iot_thread_sem_init(&(pClient->clientCold.txWakeSem));
+	if(MQTT_SUCCESS != rc) {
+		FUNC_EXIT_RC(rc);
+	}
+	pClient->clientData.isBackgroundRunning = false;
+	pClient->clientCold.isBackgroundStopRequested = false;
+	tx_queue_init(&(pClient->clientCold.txQueue));
+	tx_pool_init(&(pClient->clientCold.txPool));
 #endif
 
 	pClient->clientStatus.isPingOutstanding = 0;
+	pClient->clientStatus.pingMisses = 0;
+	pClient->clientData.pingIntervalMs = 0;
+#ifdef _ENABLE_NONBLOCKING_CONNECT_
+	pClient->clientData.connectStep = 0;
+#endif
+	pClient->clientData.rttEstimate = 0;
+	pClient->clientData.isLivenessProbeDue = 0;
+#ifdef _ENABLE_KEEPALIVE_PROBE_
+	pClient->clientData.probeIdleMs = 0;
+	pClient->clientData.probeGoodMs = 0;
+	pClient->clientData.isProbeSettled = false;
+#endif
 	pClient->clientStatus.isAutoReconnectEnabled = pInitParams->enableAutoReconnect;
+	pClient->clientCold.reconnectBackoff = pInitParams->reconnectBackoff;
+	/* A zeroed backoff would retry every millisecond, fall back to the configured waits */
+	if(0 == pClient->clientCold.reconnectBackoff.baseWaitMs) {
+		pClient->clientCold.reconnectBackoff.baseWaitMs = MQTT_MIN_RECONNECT_WAIT_INTERVAL;
+	}
+	if(0 == pClient->clientCold.reconnectBackoff.maxWaitMs) {
+		pClient->clientCold.reconnectBackoff.maxWaitMs = MQTT_MAX_RECONNECT_WAIT_INTERVAL;
+	}
+	if(pClient->clientCold.reconnectBackoff.maxWaitMs < pClient->clientCold.reconnectBackoff.baseWaitMs) {
+		pClient->clientCold.reconnectBackoff.maxWaitMs = pClient->clientCold.reconnectBackoff.baseWaitMs;
+	}
+	pClient->clientCold.currentReconnectWaitInterval = 0;
+	pClient->clientCold.reconnectAttempts = 0;
+	pClient->clientCold.subscriptionGeneration = 0;
+	pClient->clientCold.brokerSubscriptionGeneration = 0;
+	pClient->clientStatus.isSessionPresent = false;
+	pClient->clientCold.backoffRandomState = 0;
 
 	rc = iot_tls_init(&(pClient->networkStack), pInitParams->pRootCALocation, pInitParams->pDeviceCertLocation,
 					  pInitParams->pDevicePrivateKeyLocation, pInitParams->pHostURL, pInitParams->port,
@@ -212,21 +473,51 @@ IoT_Error_t mqtt_init(MQTT_Client *pClient, IoT_Client_Init_Params *pInitParams)
 					  pInitParams->isUseSSL);
 
 	if(MQTT_SUCCESS != rc) {
-		pClient->clientStatus.clientState = CLIENT_STATE_INVALID;
+#ifdef _ENABLE_THREAD_SUPPORT_
+		_mqtt_destroy_sync(pClient);
+#endif
+		mqtt_internal_force_client_state(pClient, CLIENT_STATE_INVALID);
 		FUNC_EXIT_RC(rc);
 	}
 
-	init_timer(&(pClient->pingTimer));
-	init_timer(&(pClient->reconnectDelayTimer));
+	timer_wheel_init(&(pClient->timerWheel), timer_now_ms());
+	timer_wheel_entry_init(&(pClient->pingDeadline), NULL, NULL);
+	timer_wheel_entry_init(&(pClient->reconnectDeadline), NULL, NULL);
+#ifdef _ENABLE_NONBLOCKING_CONNECT_
+	timer_wheel_entry_init(&(pClient->connectDeadline), NULL, NULL);
+#endif
+#ifdef _ENABLE_HEALTH_REPORT_
+	mqtt_internal_health_report_init(pClient);
+#endif
+
+	/* Buffers are set up last so no earlier failure can leak them */
+	rc = _mqtt_init_buffers(pClient, pInitParams);
+	if(MQTT_SUCCESS != rc) {
+#ifdef _ENABLE_THREAD_SUPPORT_
+		_mqtt_destroy_sync(pClient);
+#endif
+		mqtt_internal_force_client_state(pClient, CLIENT_STATE_INVALID);
+		FUNC_EXIT_RC(rc);
+	}
 
-	pClient->clientStatus.clientState = CLIENT_STATE_INITIALIZED;
+	mqtt_internal_force_client_state(pClient, CLIENT_STATE_INITIALIZED);
 
 	FUNC_EXIT_RC(MQTT_SUCCESS);
 }
 
+void mqtt_internal_schedule_deadline(MQTT_Client *pClient, TimerWheelEntry *pEntry, uint32_t delay_ms) {
+	timer_wheel_schedule(&(pClient->timerWheel), pEntry, timer_now_ms(), delay_ms);
+}
+
 uint16_t mqtt_get_next_packet_id(MQTT_Client *pClient) {
-	return pClient->clientData.nextPacketId = (uint16_t) ((MAX_PACKET_ID == pClient->clientData.nextPacketId) ? 1 : (
-			pClient->clientData.nextPacketId + 1));
+	uint32_t current, next;
+
+	do {
+		current = mqtt_atomic_load_u32(&(pClient->clientData.nextPacketId));
+		next = (MAX_PACKET_ID == current) ? 1 : (current + 1);
+	} while(!mqtt_atomic_cas_u32(&(pClient->clientData.nextPacketId), current, next));
+
+	return (uint16_t) next;
 }
 
 bool mqtt_is_client_connected(MQTT_Client *pClient) {
@@ -239,7 +530,7 @@ bool mqtt_is_client_connected(MQTT_Client *pClient) {
 		FUNC_EXIT_RC(false);
 	}
 
-	switch(pClient->clientStatus.clientState) {
+	switch(mqtt_get_client_state(pClient)) {
 		case CLIENT_STATE_INVALID:
 		case CLIENT_STATE_INITIALIZED:
 		case CLIENT_STATE_CONNECTING:
@@ -276,6 +567,104 @@ bool mqtt_is_autoreconnect_enabled(MQTT_Client *pClient) {
 	FUNC_EXIT_RC(pClient->clientStatus.isAutoReconnectEnabled);
 }
 
+bool mqtt_is_session_present(MQTT_Client *pClient) {
+	FUNC_ENTRY;
+	if(NULL == pClient) {
+		IOT_WARN(" Client is null! ");
+		FUNC_EXIT_RC(false);
+	}
+
+	FUNC_EXIT_RC(pClient->clientStatus.isSessionPresent);
+}
+
+uint32_t mqtt_get_smoothed_rtt_ms(MQTT_Client *pClient) {
+	FUNC_ENTRY;
+	if(NULL == pClient) {
+		IOT_WARN(" Client is null! ");
+		FUNC_EXIT_RC(0);
+	}
+
+	FUNC_EXIT_RC(mqtt_atomic_load_u32(&(pClient->clientData.rttEstimate)) >> 16);
+}
+
+/**
+ * @brief Feed a round trip sample into the RTT estimator
+ *
+ * RFC 6298 smoothing: SRTT moves 1/8 and RTTVAR 1/4 of the way towards the sample.
+ * Both live in one word so tasks sampling at the same time never see a torn pair.
+ *
+ * @param pClient Reference to the IoT Client
+ * @param sampleMs Time from sending a request to reading its response
+ */
+void mqtt_internal_note_rtt(MQTT_Client *pClient, uint32_t sampleMs) {
+	uint32_t estimate, srtt, rttvar, delta;
+
+	if(0 == sampleMs) {
+		sampleMs = 1;
+	} else if(0xFFFF < sampleMs) {
+		sampleMs = 0xFFFF;
+	}
+
+	estimate = mqtt_atomic_load_u32(&(pClient->clientData.rttEstimate));
+	do {
+		if(0 == estimate) {
+			srtt = sampleMs;
+			rttvar = sampleMs / 2;
+		} else {
+			srtt = estimate >> 16;
+			rttvar = estimate & 0xFFFF;
+			delta = (srtt > sampleMs) ? (srtt - sampleMs) : (sampleMs - srtt);
+			rttvar = (3 * rttvar + delta) / 4;
+			srtt = (7 * srtt + sampleMs) / 8;
+			if(0 == srtt) {
+				srtt = 1;
+			}
+		}
+	} while(!mqtt_atomic_compare_exchange_u32(&(pClient->clientData.rttEstimate), &estimate,
+											  (srtt << 16) | rttvar));
+}
+
+/**
+ * @brief Account for a subscribe or unsubscribe
+ *
+ * The broker stays in sync only if it was before and acked the request. A request
+ * that failed may or may not have reached the broker, so it leaves the broker's
+ * subscriptions unknown until the next full resubscribe.
+ *
+ * @param pClient Reference to the IoT Client
+ * @param isAcked true if the broker acked the request
+ */
+void mqtt_internal_note_subscription_change(MQTT_Client *pClient, bool isAcked) {
+	uint32_t generation;
+
+	generation = mqtt_atomic_fetch_add_u32(&(pClient->clientCold.subscriptionGeneration), 1);
+	if(isAcked) {
+		(void) mqtt_atomic_cas_u32(&(pClient->clientCold.brokerSubscriptionGeneration), generation, generation + 1);
+	}
+}
+
+/**
+ * @brief The broker holds exactly the local subscriptions, e.g. after a resubscribe
+ *
+ * @param pClient Reference to the IoT Client
+ */
+void mqtt_internal_note_subscriptions_synced(MQTT_Client *pClient) {
+	mqtt_atomic_store_u32(&(pClient->clientCold.brokerSubscriptionGeneration),
+						  mqtt_atomic_load_u32(&(pClient->clientCold.subscriptionGeneration)));
+}
+
+/**
+ * @brief May the broker's subscriptions differ from the local ones?
+ *
+ * @param pClient Reference to the IoT Client
+ *
+ * @return true if a resubscribe is needed even when the broker kept the session
+ */
+bool mqtt_internal_is_subscription_drift(MQTT_Client *pClient) {
+	return mqtt_atomic_load_u32(&(pClient->clientCold.brokerSubscriptionGeneration))
+		   != mqtt_atomic_load_u32(&(pClient->clientCold.subscriptionGeneration));
+}
+
 IoT_Error_t mqtt_autoreconnect_set_status(MQTT_Client *pClient, bool newStatus) {
 	FUNC_ENTRY;
 	if(NULL == pClient) {
@@ -292,17 +681,109 @@ IoT_Error_t mqtt_set_disconnect_handler(MQTT_Client *pClient, iot_disconnect_han
 		FUNC_EXIT_RC(NULL_VALUE_ERROR);
 	}
 
-	pClient->clientData.disconnectHandler = pDisconnectHandler;
-	pClient->clientData.disconnectHandlerData = pDisconnectHandlerData;
+	pClient->clientCold.disconnectHandler = pDisconnectHandler;
+	pClient->clientCold.disconnectHandlerData = pDisconnectHandlerData;
+	FUNC_EXIT_RC(MQTT_SUCCESS);
+}
+
+/**
+ * @brief Count a latency sample in its power of two bucket
+ *
+ * Safe from any task, publishers record their PUBACK latency concurrently.
+ *
+ * @param pHistogram Histogram to update
+ * @param sampleMs Sample in ms
+ */
+void mqtt_internal_stats_add_sample(IoT_Latency_Histogram *pHistogram, uint32_t sampleMs) {
+	uint32_t bucket = (0 == sampleMs) ? 0 : (uint32_t) (32 - __builtin_clz(sampleMs));
+
+	if(MQTT_STATS_HISTOGRAM_BUCKETS <= bucket) {
+		bucket = MQTT_STATS_HISTOGRAM_BUCKETS - 1;
+	}
+	(void) mqtt_atomic_fetch_add_u32(&(pHistogram->buckets[bucket]), 1);
+}
+
+IoT_Error_t mqtt_get_stats(MQTT_Client *pClient, IoT_Client_Stats *pStats) {
+	FUNC_ENTRY;
+	if(NULL == pClient || NULL == pStats) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	*pStats = pClient->stats;
+	pStats->selectCalls = pClient->networkStack.callCounters.selectCalls;
+	pStats->recvCalls = pClient->networkStack.callCounters.recvCalls;
+	pStats->sendCalls = pClient->networkStack.callCounters.sendCalls;
+	FUNC_EXIT_RC(MQTT_SUCCESS);
+}
+
+IoT_Error_t mqtt_free(MQTT_Client *pClient) {
+	ClientState clientState;
+
+	FUNC_ENTRY;
+	if(NULL == pClient) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	clientState = mqtt_get_client_state(pClient);
+	if(CLIENT_STATE_INVALID == clientState) {
+		/* Already released, or mqtt_init failed and cleaned up after itself */
+		FUNC_EXIT_RC(MQTT_SUCCESS);
+	}
+	if(CLIENT_STATE_CONNECTING == clientState || mqtt_is_client_connected(pClient)) {
+		FUNC_EXIT_RC(MQTT_CLIENT_NOT_IDLE_ERROR);
+	}
+#ifdef _ENABLE_THREAD_SUPPORT_
+	if(pClient->clientData.isBackgroundRunning) {
+		FUNC_EXIT_RC(MQTT_CLIENT_NOT_IDLE_ERROR);
+	}
+	_mqtt_destroy_sync(pClient);
+#endif
+
+	if(pClient->clientCold.isWriteBufOwned) {
+		MQTT_FREE(pClient->clientData.writeBuf);
+		pClient->clientCold.isWriteBufOwned = false;
+	}
+	if(pClient->clientCold.isReadBufOwned) {
+		MQTT_FREE(pClient->clientData.readBuf);
+		pClient->clientCold.isReadBufOwned = false;
+	}
+	pClient->clientData.writeBuf = NULL;
+	pClient->clientData.readBuf = NULL;
+	pClient->clientData.writeBufSize = 0;
+	pClient->clientData.readBufSize = 0;
+
+	mqtt_internal_force_client_state(pClient, CLIENT_STATE_INVALID);
+	FUNC_EXIT_RC(MQTT_SUCCESS);
+}
+
+IoT_Error_t mqtt_set_connect_timing_handler(MQTT_Client *pClient, iot_connect_timing_handler pHandler,
+											void *pHandlerData) {
+	FUNC_ENTRY;
+	if(NULL == pClient) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	pClient->clientCold.connectTimingHandler = pHandler;
+	pClient->clientCold.connectTimingHandlerData = pHandlerData;
+	FUNC_EXIT_RC(MQTT_SUCCESS);
+}
+
+IoT_Error_t mqtt_get_connect_timing(MQTT_Client *pClient, IoT_Connect_Timing *pTiming) {
+	FUNC_ENTRY;
+	if(NULL == pClient || NULL == pTiming) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	*pTiming = pClient->clientCold.connectTiming;
 	FUNC_EXIT_RC(MQTT_SUCCESS);
 }
 
 uint32_t mqtt_get_network_disconnected_count(MQTT_Client *pClient) {
-	return pClient->clientData.counterNetworkDisconnected;
+	return pClient->clientCold.counterNetworkDisconnected;
 }
 
 void mqtt_reset_network_disconnected_count(MQTT_Client *pClient) {
-	pClient->clientData.counterNetworkDisconnected = 0;
+	pClient->clientCold.counterNetworkDisconnected = 0;
 }
 
 #ifdef __cplusplus
@@ -27,6 +27,7 @@ extern "C" {
 #include <mqtt_client.h>
 #include <unistd.h>
 #include "mqtt_client_common_internal.h"
+#include "mqtt_atomic.h"
 
 /* Max length of packet header */
 #define MAX_NO_OF_REMAINING_LENGTH_BYTES 4
@@ -248,55 +249,114 @@ IoT_Error_t mqtt_internal_init_header(MQTTHeader *pHeader, MessageTypes message_
 	FUNC_EXIT_RC(MQTT_SUCCESS);
 }
 
-IoT_Error_t mqtt_internal_send_packet(MQTT_Client *pClient, size_t length, Timer *pTimer) {
+/**
+ * @brief Count the packets of a successful write
+ *
+ * Walks the fixed headers, a batched write holds several packets back to back.
+ */
+static void _mqtt_internal_stats_sent(MQTT_Client *pClient, const unsigned char *pBuf, size_t length) {
+	size_t pos = 0, lenPos;
+	uint32_t remLen, multiplier;
+
+	pClient->stats.bytesSent += (uint32_t) length;
+	while(pos < length) {
+		pClient->stats.packetsSent[pBuf[pos] >> 4]++;
+		remLen = 0;
+		multiplier = 1;
+		lenPos = pos + 1;
+		while(lenPos < length && lenPos - pos <= 4) {
+			remLen += (pBuf[lenPos] & 127) * multiplier;
+			multiplier *= 128;
+			if(0 == (pBuf[lenPos++] & 128)) {
+				break;
+			}
+		}
+		pos = lenPos + remLen;
+	}
+}
 
+static IoT_Error_t _mqtt_internal_write(MQTT_Client *pClient, const unsigned char *pBuf, size_t length,
+										Timer *pTimer) {
 	size_t sentLen, sent;
 	IoT_Error_t rc;
 
-	FUNC_ENTRY;
-
-	if(NULL == pClient || NULL == pTimer) {
-		FUNC_EXIT_RC(NULL_VALUE_ERROR);
-	}
-
-	if(length >= pClient->clientData.writeBufSize) {
-		FUNC_EXIT_RC(MQTT_TX_BUFFER_TOO_SHORT_ERROR);
-	}
-
-#ifdef _ENABLE_THREAD_SUPPORT_
-	rc = mqtt_client_lock_mutex(pClient, &(pClient->clientData.tls_write_mutex));
+	rc = mqtt_internal_lock_send(pClient);
 	if(MQTT_SUCCESS != rc) {
-		FUNC_EXIT_RC(rc);
+		return rc;
 	}
-#endif
 
 	sentLen = 0;
 	sent = 0;
 
 	while(sent < length && !has_timer_expired(pTimer)) {
-		rc = pClient->networkStack.write(&(pClient->networkStack), &pClient->clientData.writeBuf[sent], length, pTimer,
-										 &sentLen);
+		rc = pClient->networkStack.write(&(pClient->networkStack), (unsigned char *) &pBuf[sent], length - sent,
+										 pTimer, &sentLen);
 		if(MQTT_SUCCESS != rc) {
 			/* there was an error writing the data */
 			break;
 		}
 		sent += sentLen;
 	}
-
-#ifdef _ENABLE_THREAD_SUPPORT_
-	rc = mqtt_client_unlock_mutex(pClient, &(pClient->clientData.tls_write_mutex));
-	if(MQTT_SUCCESS != rc) {
-		FUNC_EXIT_RC(rc);
+	if(sent == length) {
+		_mqtt_internal_stats_sent(pClient, pBuf, length);
 	}
-#endif
+	mqtt_internal_unlock_send(pClient);
 
 	if(sent == length) {
-		/* record the fact that we have successfully sent the packet */
-		//countdown_sec(&c->pingTimer, c->clientData.keepAliveInterval);
-		FUNC_EXIT_RC(MQTT_SUCCESS);
+		/* record the fact that we have successfully sent the packet, the keepalive task
+		 * skips the PINGREQ while other traffic keeps the connection busy */
+		mqtt_atomic_store_u32(&(pClient->clientData.lastSendMs), timer_now_ms());
+		return MQTT_SUCCESS;
+	}
+
+	/* A failed write may be the first sign of a dead connection, find out now rather than at the next ping */
+	mqtt_internal_request_liveness_probe(pClient);
+	return MQTT_FAILURE;
+}
+
+IoT_Error_t mqtt_internal_send_packet(MQTT_Client *pClient, size_t length, Timer *pTimer) {
+	IoT_Error_t rc;
+
+	FUNC_ENTRY;
+
+	if(NULL == pClient || NULL == pTimer) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	if(length >= pClient->clientData.writeBufSize) {
+		FUNC_EXIT_RC(MQTT_TX_BUFFER_TOO_SHORT_ERROR);
+	}
+
+	/* The caller holds the TX lock, see mqtt_internal_lock_tx */
+	rc = _mqtt_internal_write(pClient, pClient->clientData.writeBuf, length, pTimer);
+	FUNC_EXIT_RC(rc);
+}
+
+/**
+ * @brief Send a control packet
+ *
+ * Writes a small packet (PINGREQ, PUBACK, DISCONNECT) from the caller's buffer without
+ * taking the TX lock, so it neither waits for nor overwrites a publish staged in writeBuf.
+ *
+ * @param pClient Reference to the IoT Client
+ * @param pPacket Serialized packet
+ * @param length Length of the packet
+ * @param pTimer Deadline for the write
+ *
+ * @return An IoT Error Type defining successful/failed send
+ */
+IoT_Error_t mqtt_internal_send_control(MQTT_Client *pClient, const unsigned char *pPacket, size_t length,
+									   Timer *pTimer) {
+	IoT_Error_t rc;
+
+	FUNC_ENTRY;
+
+	if(NULL == pClient || NULL == pPacket || NULL == pTimer) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
 	}
 
-	FUNC_EXIT_RC(MQTT_FAILURE);
+	rc = _mqtt_internal_write(pClient, pPacket, length, pTimer);
+	FUNC_EXIT_RC(rc);
 }
 
 static IoT_Error_t _aws_iot_mqtt_internal_decode_packet_remaining_len(MQTT_Client *pClient,
@@ -380,6 +440,8 @@ static IoT_Error_t _aws_iot_mqtt_internal_read_packet(MQTT_Client *pClient, Time
 				}
 			}
 		} while(total_bytes_read < rem_len && MQTT_SUCCESS == rc);
+		pClient->stats.rxTooLargeDrops++;
+		pClient->stats.bytesReceived += (uint32_t) (len + total_bytes_read);
 		return MQTT_RX_BUFFER_TOO_SHORT_ERROR;
 	}
 
@@ -397,6 +459,8 @@ static IoT_Error_t _aws_iot_mqtt_internal_read_packet(MQTT_Client *pClient, Time
 
 	header.byte = pClient->clientData.readBuf[0];
 	*pPacketType = header.bits.type;
+	pClient->stats.packetsReceived[header.bits.type]++;
+	pClient->stats.bytesReceived += (uint32_t) (len + rem_len);
 
 	FUNC_EXIT_RC(rc);
 }
@@ -440,12 +504,86 @@ static char _aws_iot_mqtt_internal_is_topic_matched(char *pTopicFilter, char *pT
 	return (curn == curn_end) && (*curf == '\0');
 }
 
+static bool _aws_iot_mqtt_internal_is_handler_matched(MessageHandlers *pHandler, char *pTopicName,
+														uint16_t topicNameLen) {
+	if(NULL == pHandler->topicName) {
+		return false;
+	}
+
+	return ((topicNameLen == pHandler->topicNameLen)
+			&& (strncmp(pTopicName, (char *) pHandler->topicName, topicNameLen) == 0))
+		   || _aws_iot_mqtt_internal_is_topic_matched((char *) pHandler->topicName, pTopicName, topicNameLen);
+}
+
+/**
+ * Delivers the staged conflated message to every handler that has a pending bit set.
+ * Caller is responsible for the CB_RETURN client state.
+ */
+static void _aws_iot_mqtt_internal_deliver_conflated(MQTT_Client *pClient) {
+	uint32_t itr, pendingMask, handlerStartMs;
+	ConflatedMessage *pConflated = &(pClient->clientCold.conflatedMessage);
+
+	/* Clear first so a handler publishing/yielding from the callback sees a consistent slot */
+	pendingMask = pConflated->pendingHandlerMask;
+	pConflated->pendingHandlerMask = 0;
+
+	for(itr = 0; itr < MQTT_NUM_SUBSCRIBE_HANDLERS; ++itr) {
+		if(0 == (pendingMask & (1u << itr))) {
+			continue;
+		}
+		if(NULL != pClient->clientCold.messageHandlers[itr].topicName
+		   && NULL != pClient->clientCold.messageHandlers[itr].pApplicationHandler) {
+			handlerStartMs = timer_now_raw_ms();
+			MQTT_TRACE_BEGIN("message handler");
+			pClient->clientCold.messageHandlers[itr].pApplicationHandler(pClient, (char *) pConflated->buf,
+																		 pConflated->topicNameLen,
+																		 &(pConflated->params),
+																		 pClient->clientCold.messageHandlers[itr].pApplicationHandlerData);
+			MQTT_TRACE_END("message handler", itr);
+			pClient->stats.handlerCalls++;
+			pClient->stats.handlerTimeMs += timer_now_raw_ms() - handlerStartMs;
+		}
+	}
+}
+
+/**
+ * Copies a message into the conflation slot, replacing any older message for the same topic.
+ * A pending message for a different topic is delivered first so it is never lost.
+ *
+ * @return true if the message was staged, false if it does not fit and must be delivered now
+ */
+static bool _aws_iot_mqtt_internal_stage_conflated(MQTT_Client *pClient, uint32_t handlerIndex, char *pTopicName,
+												   uint16_t topicNameLen,
+												   IoT_Publish_Message_Params *pMessageParams) {
+	ConflatedMessage *pConflated = &(pClient->clientCold.conflatedMessage);
+
+	if(((size_t) topicNameLen + pMessageParams->payloadLen) > MQTT_CONFLATE_BUF_LEN) {
+		return false;
+	}
+
+	if(0 != pConflated->pendingHandlerMask
+	   && (pConflated->topicNameLen != topicNameLen || 0 != memcmp(pConflated->buf, pTopicName, topicNameLen))) {
+		_aws_iot_mqtt_internal_deliver_conflated(pClient);
+	}
+
+	memcpy(pConflated->buf, pTopicName, topicNameLen);
+	memcpy(pConflated->buf + topicNameLen, pMessageParams->payload, pMessageParams->payloadLen);
+	pConflated->topicNameLen = topicNameLen;
+	pConflated->params = *pMessageParams;
+	pConflated->params.payload = pConflated->buf + topicNameLen;
+	pConflated->pendingHandlerMask |= (1u << handlerIndex);
+
+	return true;
+}
+
 static IoT_Error_t _aws_iot_mqtt_internal_deliver_message(MQTT_Client *pClient, char *pTopicName,
 														  uint16_t topicNameLen,
 														  IoT_Publish_Message_Params *pMessageParams) {
-	uint32_t itr;
+	uint32_t itr, handlerStartMs;
 	IoT_Error_t rc;
 	ClientState clientState;
+	MessageHandlers *pHandler;
+	bool isStaged = false;
 
 	FUNC_ENTRY;
 
@@ -461,31 +599,71 @@ static IoT_Error_t _aws_iot_mqtt_internal_deliver_message(MQTT_Client *pClient,
 
 	/* Find the right message handler - indexed by topic */
 	for(itr = 0; itr < MQTT_NUM_SUBSCRIBE_HANDLERS; ++itr) {
-		if(NULL != pClient->clientData.messageHandlers[itr].topicName) {
-			if(((topicNameLen == pClient->clientData.messageHandlers[itr].topicNameLen)
-				&&
-				(strncmp(pTopicName, (char *) pClient->clientData.messageHandlers[itr].topicName, topicNameLen) == 0))
-			   || _aws_iot_mqtt_internal_is_topic_matched((char *) pClient->clientData.messageHandlers[itr].topicName,
-														  pTopicName, topicNameLen)) {
-				if(NULL != pClient->clientData.messageHandlers[itr].pApplicationHandler) {
-					pClient->clientData.messageHandlers[itr].pApplicationHandler(pClient, pTopicName, topicNameLen,
-																				 pMessageParams,
-																				 pClient->clientData.messageHandlers[itr].pApplicationHandlerData);
-				}
+		pHandler = &(pClient->clientCold.messageHandlers[itr]);
+		if(!_aws_iot_mqtt_internal_is_handler_matched(pHandler, pTopicName, topicNameLen)) {
+			continue;
+		}
+		if(pHandler->isConflated) {
+			if(isStaged) {
+				pClient->clientCold.conflatedMessage.pendingHandlerMask |= (1u << itr);
+				continue;
+			}
+			isStaged = _aws_iot_mqtt_internal_stage_conflated(pClient, itr, pTopicName, topicNameLen,
+															  pMessageParams);
+			if(isStaged) {
+				continue;
 			}
 		}
+		if(NULL != pHandler->pApplicationHandler) {
+			handlerStartMs = timer_now_raw_ms();
+			MQTT_TRACE_BEGIN("message handler");
+			pHandler->pApplicationHandler(pClient, pTopicName, topicNameLen, pMessageParams,
+										  pHandler->pApplicationHandlerData);
+			MQTT_TRACE_END("message handler", itr);
+			pClient->stats.handlerCalls++;
+			pClient->stats.handlerTimeMs += timer_now_raw_ms() - handlerStartMs;
+		}
+	}
+	rc = mqtt_set_client_state(pClient, CLIENT_STATE_CONNECTED_WAIT_FOR_CB_RETURN, clientState);
+
+	FUNC_EXIT_RC(rc);
+}
+
+/**
+ * Delivers the newest staged message of conflated subscriptions, if any.
+ * Called once the current burst of incoming packets has been drained.
+ */
+IoT_Error_t mqtt_internal_flush_conflated(MQTT_Client *pClient) {
+	IoT_Error_t rc;
+	ClientState clientState;
+
+	FUNC_ENTRY;
+
+	if(0 == pClient->clientCold.conflatedMessage.pendingHandlerMask) {
+		FUNC_EXIT_RC(MQTT_SUCCESS);
 	}
+
+	clientState = mqtt_get_client_state(pClient);
+	rc = mqtt_set_client_state(pClient, clientState, CLIENT_STATE_CONNECTED_WAIT_FOR_CB_RETURN);
+	if(MQTT_SUCCESS != rc) {
+		FUNC_EXIT_RC(rc);
+	}
+
+	_aws_iot_mqtt_internal_deliver_conflated(pClient);
+
 	rc = mqtt_set_client_state(pClient, CLIENT_STATE_CONNECTED_WAIT_FOR_CB_RETURN, clientState);
 
 	FUNC_EXIT_RC(rc);
 }
 
-static IoT_Error_t _aws_iot_mqtt_internal_handle_publish(MQTT_Client *pClient, Timer *pTimer) {
+static IoT_Error_t _aws_iot_mqtt_internal_handle_publish(MQTT_Client *pClient) {
 	char *topicName;
 	uint16_t topicNameLen;
 	uint32_t len;
 	IoT_Error_t rc;
 	IoT_Publish_Message_Params msg;
+	Timer ackTimer;
+	unsigned char ackBuf[MQTT_ACK_PACKET_MAX_LEN];
 
 	FUNC_ENTRY;
 
@@ -513,20 +691,189 @@ static IoT_Error_t _aws_iot_mqtt_internal_handle_publish(MQTT_Client *pClient, T
 		FUNC_EXIT_RC(MQTT_SUCCESS);
 	}
 
-	/* Message assumed to be QoS1 since we do not support QoS2 at this time */
-	rc = mqtt_internal_serialize_ack(pClient->clientData.writeBuf, pClient->clientData.writeBufSize,
-											 PUBACK, 0, msg.id, &len);
+	/* The caller's read timer may be nearly spent, give the ack its own timeout */
+	init_timer(&ackTimer);
+	countdown_ms(&ackTimer, pClient->clientData.packetTimeoutMs);
 
+	/* Message assumed to be QoS1 since we do not support QoS2 at this time */
+	rc = mqtt_internal_serialize_ack(ackBuf, sizeof(ackBuf), PUBACK, 0, msg.id, &len);
+	if(MQTT_SUCCESS == rc) {
+		rc = mqtt_internal_send_control(pClient, ackBuf, len, &ackTimer);
+	}
 	if(MQTT_SUCCESS != rc) {
 		FUNC_EXIT_RC(rc);
 	}
 
-	rc = mqtt_internal_send_packet(pClient, len, pTimer);
+	FUNC_EXIT_RC(MQTT_SUCCESS);
+}
+
+#ifdef _ENABLE_THREAD_SUPPORT_
+/**
+ * @brief Hand an ack that was just read to the application task waiting for it
+ *
+ * The pending request with the same type and packet id gets a copy of the packet and
+ * is signaled, *pPacketType is cleared so the reading task does not take it for its own.
+ *
+ * @param pClient Reference to the IoT Client
+ * @param pPacketType Type of the packet in readBuf
+ */
+static void _aws_iot_mqtt_internal_route_ack(MQTT_Client *pClient, uint8_t *pPacketType) {
+	PendingRequest *pRequest;
+	unsigned char *curData;
+	uint32_t decodedLen, readBytesLen, itr;
+	uint16_t packetId;
+
+	curData = pClient->clientData.readBuf + 1;
+	if(MQTT_SUCCESS != mqtt_internal_decode_remaining_length_from_buffer(curData, &decodedLen, &readBytesLen)
+	   || 2 > decodedLen) {
+		return;
+	}
+	curData += readBytesLen;
+	packetId = mqtt_internal_read_uint16_t(&curData);
+
+	if(MQTT_SUCCESS != aws_iot_thread_mutex_lock(&(pClient->clientCold.pending_mutex))) {
+		return;
+	}
+
+	for(itr = 0; itr < MQTT_MAX_PENDING_REQUESTS; itr++) {
+		pRequest = &(pClient->clientCold.pendingRequests[itr]);
+		if(*pPacketType == pRequest->packetType && packetId == pRequest->packetId) {
+			memcpy(pRequest->pBuf, pClient->clientData.readBuf, pRequest->bufLen);
+			pRequest->result = MQTT_SUCCESS;
+			pRequest->packetType = 0;
+			*pPacketType = 0;
+			(void) aws_iot_thread_sem_post(&(pRequest->doneSem));
+			break;
+		}
+	}
+
+	(void) aws_iot_thread_mutex_unlock(&(pClient->clientCold.pending_mutex));
+}
+
+/**
+ * @brief Complete every pending request with an error
+ *
+ * Called when the connection is lost, the acks will never come.
+ *
+ * @param pClient Reference to the IoT Client
+ * @param rc Error handed to the waiting tasks
+ */
+void mqtt_internal_fail_pending_requests(MQTT_Client *pClient, IoT_Error_t rc) {
+	PendingRequest *pRequest;
+	uint32_t itr;
+
+	if(MQTT_SUCCESS != aws_iot_thread_mutex_lock(&(pClient->clientCold.pending_mutex))) {
+		return;
+	}
+
+	for(itr = 0; itr < MQTT_MAX_PENDING_REQUESTS; itr++) {
+		pRequest = &(pClient->clientCold.pendingRequests[itr]);
+		if(0 != pRequest->packetType) {
+			pRequest->result = rc;
+			pRequest->packetType = 0;
+			(void) aws_iot_thread_sem_post(&(pRequest->doneSem));
+		}
+	}
+
+	(void) aws_iot_thread_mutex_unlock(&(pClient->clientCold.pending_mutex));
+}
+#endif
+
+/**
+ * @brief Register the calling task as waiting for an ack
+ *
+ * Only used by application tasks while the network I/O task owns the socket, *ppRequest
+ * is set to NULL otherwise. Must be called before the request is sent so a fast ack is
+ * not missed.
+ *
+ * @param pClient Reference to the IoT Client
+ * @param packetType Expected ack type
+ * @param packetId Packet id of the request
+ * @param pAckBuf Buffer the ack is copied to, at least MQTT_ACK_PACKET_MAX_LEN bytes
+ * @param ackBufLen Length of pAckBuf
+ * @param ppRequest Set to the pending request to pass to wait_for_read
+ *
+ * @return MQTT_SUCCESS, or MQTT_CLIENT_NOT_IDLE_ERROR if MQTT_MAX_PENDING_REQUESTS are in flight
+ */
+IoT_Error_t mqtt_internal_expect_ack(MQTT_Client *pClient, uint8_t packetType, uint16_t packetId,
+									 unsigned char *pAckBuf, size_t ackBufLen, PendingRequest **ppRequest) {
+#ifdef _ENABLE_THREAD_SUPPORT_
+	PendingRequest *pRequest;
+	uint32_t itr;
+	IoT_Error_t rc;
+#endif
+
+	*ppRequest = NULL;
+
+#ifdef _ENABLE_THREAD_SUPPORT_
+	if(!mqtt_internal_is_background_caller(pClient)) {
+		return MQTT_SUCCESS;
+	}
+
+	rc = aws_iot_thread_mutex_lock(&(pClient->clientCold.pending_mutex));
 	if(MQTT_SUCCESS != rc) {
-		FUNC_EXIT_RC(rc);
+		return rc;
 	}
 
-	FUNC_EXIT_RC(MQTT_SUCCESS);
+	rc = MQTT_CLIENT_NOT_IDLE_ERROR;
+	for(itr = 0; itr < MQTT_MAX_PENDING_REQUESTS; itr++) {
+		pRequest = &(pClient->clientCold.pendingRequests[itr]);
+		if(0 == pRequest->packetType) {
+			/* Drop a post left over from an ack that arrived after its waiter timed out */
+			(void) aws_iot_thread_sem_wait(&(pRequest->doneSem), 0);
+			pRequest->packetType = packetType;
+			pRequest->packetId = packetId;
+			pRequest->pBuf = pAckBuf;
+			pRequest->bufLen = ackBufLen;
+			pRequest->result = MQTT_REQUEST_TIMEOUT_ERROR;
+			*ppRequest = pRequest;
+			rc = MQTT_SUCCESS;
+			break;
+		}
+	}
+
+	(void) aws_iot_thread_mutex_unlock(&(pClient->clientCold.pending_mutex));
+	return rc;
+#else
+	IOT_UNUSED(pClient);
+	IOT_UNUSED(packetType);
+	IOT_UNUSED(packetId);
+	IOT_UNUSED(pAckBuf);
+	IOT_UNUSED(ackBufLen);
+	return MQTT_SUCCESS;
+#endif
+}
+
+/**
+ * @brief Withdraw a registration made by mqtt_internal_expect_ack
+ *
+ * The result is read before the slot is released, another task may take the slot
+ * and reset it right after.
+ *
+ * @param pClient Reference to the IoT Client
+ * @param pRequest Pending request, may be NULL
+ *
+ * @return result of the request, MQTT_REQUEST_TIMEOUT_ERROR unless the ack was routed
+ */
+IoT_Error_t mqtt_internal_cancel_ack(MQTT_Client *pClient, PendingRequest *pRequest) {
+#ifdef _ENABLE_THREAD_SUPPORT_
+	IoT_Error_t rc;
+
+	if(NULL == pRequest) {
+		return MQTT_SUCCESS;
+	}
+
+	(void) aws_iot_thread_mutex_lock(&(pClient->clientCold.pending_mutex));
+	rc = pRequest->result;
+	pRequest->packetType = 0;
+	(void) aws_iot_thread_mutex_unlock(&(pClient->clientCold.pending_mutex));
+
+	return rc;
+#else
+	IOT_UNUSED(pClient);
+	IOT_UNUSED(pRequest);
+	return MQTT_SUCCESS;
+#endif
 }
 
 IoT_Error_t mqtt_internal_cycle_read(MQTT_Client *pClient, Timer *pTimer, uint8_t *pPacketType) {
@@ -541,7 +888,7 @@ IoT_Error_t mqtt_internal_cycle_read(MQTT_Client *pClient, Timer *pTimer, uint8_
 	}
 
 #ifdef _ENABLE_THREAD_SUPPORT_
-	threadRc = mqtt_client_lock_mutex(pClient, &(pClient->clientData.tls_read_mutex));
+	threadRc = mqtt_client_lock_mutex(pClient, &(pClient->clientCold.tls_read_mutex));
 	if(MQTT_SUCCESS != threadRc) {
 		FUNC_EXIT_RC(threadRc);
 	}
@@ -551,28 +898,33 @@ IoT_Error_t mqtt_internal_cycle_read(MQTT_Client *pClient, Timer *pTimer, uint8_
 	rc = _aws_iot_mqtt_internal_read_packet(pClient, pTimer, pPacketType);
 
 #ifdef _ENABLE_THREAD_SUPPORT_
-	threadRc = mqtt_client_unlock_mutex(pClient, &(pClient->clientData.tls_read_mutex));
+	threadRc = mqtt_client_unlock_mutex(pClient, &(pClient->clientCold.tls_read_mutex));
 	if(MQTT_SUCCESS != threadRc && (MQTT_NOTHING_TO_READ == rc || MQTT_SUCCESS == rc)) {
 		return threadRc;
 	}
 #endif
 
 	if(MQTT_NOTHING_TO_READ == rc) {
-		/* Nothing to read, not a cycle failure */
-		return MQTT_SUCCESS;
+		/* Nothing to read, not a cycle failure. The burst is drained, hand out latest values */
+		return mqtt_internal_flush_conflated(pClient);
 	} else if(MQTT_SUCCESS != rc) {
 		return rc;
 	}
 
+	pClient->clientData.lastReceiveMs = timer_now_ms();
+
 	switch(*pPacketType) {
 		case CONNACK:
 		case PUBACK:
 		case SUBACK:
 		case UNSUBACK:
 			/* SDK is blocking, these responses will be forwarded to calling function to process */
+#ifdef _ENABLE_THREAD_SUPPORT_
+			_aws_iot_mqtt_internal_route_ack(pClient, pPacketType);
+#endif
 			break;
 		case PUBLISH: {
-			rc = _aws_iot_mqtt_internal_handle_publish(pClient, pTimer);
+			rc = _aws_iot_mqtt_internal_handle_publish(pClient);
 			break;
 		}
 		case PUBREC:
@@ -580,8 +932,7 @@ IoT_Error_t mqtt_internal_cycle_read(MQTT_Client *pClient, Timer *pTimer, uint8_
 			/* QoS2 not supported at this time */
 			break;
 		case PINGRESP: {
-			pClient->clientStatus.isPingOutstanding = 0;
-			countdown_sec(&pClient->pingTimer, pClient->clientData.keepAliveInterval);
+			mqtt_internal_handle_pingresp(pClient);
 			break;
 		}
 		default: {
@@ -595,16 +946,29 @@ IoT_Error_t mqtt_internal_cycle_read(MQTT_Client *pClient, Timer *pTimer, uint8_
 	return rc;
 }
 
-/* only used in single-threaded mode where one command at a time is in process */
-IoT_Error_t mqtt_internal_wait_for_read(MQTT_Client *pClient, uint8_t packetType, Timer *pTimer) {
+/* Reads in place when pRequest is NULL, only one command at a time is in process then */
+IoT_Error_t mqtt_internal_wait_for_read(MQTT_Client *pClient, uint8_t packetType, PendingRequest *pRequest,
+										Timer *pTimer, unsigned char *pAckBuf, size_t ackBufLen) {
 	IoT_Error_t rc;
 	uint8_t read_packet_type;
 
 	FUNC_ENTRY;
-	if(NULL == pClient || NULL == pTimer) {
+	if(NULL == pClient || NULL == pTimer || NULL == pAckBuf) {
 		FUNC_EXIT_RC(NULL_VALUE_ERROR);
 	}
 
+#ifdef _ENABLE_THREAD_SUPPORT_
+	if(NULL != pRequest) {
+		/* The I/O task reads the ack and copies it into pAckBuf, see mqtt_internal_expect_ack */
+		(void) aws_iot_thread_sem_wait(&(pRequest->doneSem), left_ms(pTimer));
+		/* Still MQTT_REQUEST_TIMEOUT_ERROR unless the ack was routed, even just after the wait gave up */
+		rc = mqtt_internal_cancel_ack(pClient, pRequest);
+		FUNC_EXIT_RC(rc);
+	}
+#else
+	IOT_UNUSED(pRequest);
+#endif
+
 	read_packet_type = 0;
 	do {
 		if(has_timer_expired(pTimer)) {
@@ -619,6 +983,11 @@ IoT_Error_t mqtt_internal_wait_for_read(MQTT_Client *pClient, uint8_t packetType
 		FUNC_EXIT_RC(MQTT_FAILURE);
 	}
 
+	if(read_packet_type == packetType) {
+		memcpy(pAckBuf, pClient->clientData.readBuf,
+			   (ackBufLen < pClient->clientData.readBufSize) ? ackBufLen : pClient->clientData.readBufSize);
+	}
+
 	/* Something failed or we didn't receive the expected packet, return error code */
 	FUNC_EXIT_RC(rc);
 }
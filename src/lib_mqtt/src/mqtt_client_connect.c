@@ -346,6 +346,144 @@ static bool _mqtt_is_client_state_valid_for_connect(ClientState clientState) {
 	return isValid;
 }
 
+/**
+ * @brief Start recording the phases of a connect, see mqtt_get_connect_timing
+ *
+ * @param pClient Reference to the IoT Client
+ * @param isReconnect true for auto-reconnect and mqtt_attempt_reconnect
+ */
+static void _mqtt_connect_timing_begin(MQTT_Client *pClient, bool isReconnect) {
+	memset(&(pClient->clientCold.connectTiming), 0, sizeof(IoT_Connect_Timing));
+	pClient->clientCold.connectTiming.startMs = timer_now_raw_ms();
+	pClient->clientCold.connectTiming.isReconnect = isReconnect;
+}
+
+/**
+ * @brief Take over the phases the network layer recorded
+ *
+ * @param pClient Reference to the IoT Client
+ */
+static void _mqtt_connect_timing_network(MQTT_Client *pClient) {
+	IoT_Connect_Timing *pTiming = &(pClient->clientCold.connectTiming);
+
+	pTiming->linkCheckMs = pClient->networkStack.connectTiming.linkCheckMs;
+	pTiming->dnsMs = pClient->networkStack.connectTiming.dnsMs;
+	pTiming->tcpMs = pClient->networkStack.connectTiming.tcpMs;
+	pTiming->tlsMs = pClient->networkStack.connectTiming.tlsMs;
+	/* CONNECT goes out right after the network connect */
+	pClient->clientCold.connackStartMs = timer_now_raw_ms();
+}
+
+/**
+ * @brief Record the time from CONNECT to now as the CONNACK phase
+ *
+ * @param pClient Reference to the IoT Client
+ */
+static void _mqtt_connect_timing_connack(MQTT_Client *pClient) {
+	pClient->clientCold.connectTiming.connackMs = timer_now_raw_ms() - pClient->clientCold.connackStartMs;
+}
+
+/**
+ * @brief Finish recording a connect and hand the timings to the handler
+ *
+ * @param pClient Reference to the IoT Client
+ * @param rc Outcome of the connect
+ */
+static void _mqtt_connect_timing_end(MQTT_Client *pClient, IoT_Error_t rc) {
+	IoT_Connect_Timing *pTiming = &(pClient->clientCold.connectTiming);
+
+	pTiming->totalMs = timer_now_raw_ms() - pTiming->startMs;
+	pTiming->result = rc;
+	IOT_DEBUG("connect %d: link %u dns %u tcp %u ms", rc,
+			  (unsigned) pTiming->linkCheckMs, (unsigned) pTiming->dnsMs, (unsigned) pTiming->tcpMs);
+	IOT_DEBUG("connect %d: tls %u connack %u resubscribe %u ms", rc,
+			  (unsigned) pTiming->tlsMs, (unsigned) pTiming->connackMs, (unsigned) pTiming->resubscribeMs);
+	IOT_DEBUG("connect %d: total %u ms", rc, (unsigned) pTiming->totalMs);
+
+	if(NULL != pClient->clientCold.connectTimingHandler) {
+		pClient->clientCold.connectTimingHandler(pClient, pTiming, pClient->clientCold.connectTimingHandlerData);
+	}
+}
+
+/**
+ * @brief Send CONNECT on a freshly opened network connection
+ *
+ * @param pClient Reference to the IoT Client
+ * @param pResubscribe If not NULL, SUBSCRIBEs for the active subscriptions are written in
+ *        the same go as CONNECT and recorded here. Left empty if they do not fit the TX buffer
+ * @param pTimer Timer the CONNECT has to be written in
+ *
+ * @return An IoT Error Type defining successful/failed send
+ */
+static IoT_Error_t _mqtt_send_connect(MQTT_Client *pClient, ResubscribeBatch *pResubscribe, Timer *pTimer) {
+	size_t len = 0;
+	size_t resubscribeLen = 0;
+	IoT_Error_t rc;
+
+	FUNC_ENTRY;
+
+	pClient->clientData.keepAliveInterval = pClient->clientCold.options.keepAliveIntervalInSec;
+	pClient->clientStatus.isSessionPresent = false;
+
+	rc = mqtt_internal_lock_tx(pClient);
+	if(MQTT_SUCCESS != rc) {
+		FUNC_EXIT_RC(rc);
+	}
+
+	rc = _mqtt_serialize_connect(pClient->clientData.writeBuf, pClient->clientData.writeBufSize,
+										 &(pClient->clientCold.options), &len);
+	if(MQTT_SUCCESS == rc && 0 < len && NULL != pResubscribe) {
+		/* MQTT allows packets before CONNACK, a rejected CONNECT makes the broker drop them */
+		if(MQTT_SUCCESS != mqtt_internal_serialize_resubscribe(pClient, pClient->clientData.writeBuf + len,
+															   pClient->clientData.writeBufSize - len,
+															   pResubscribe, &resubscribeLen)) {
+			resubscribeLen = 0;
+		}
+	}
+	if(MQTT_SUCCESS == rc && 0 < len) {
+		/* send the connect packet */
+		rc = mqtt_internal_send_packet(pClient, len + resubscribeLen, pTimer);
+	}
+	mqtt_internal_unlock_tx(pClient);
+	if(MQTT_SUCCESS == rc && 0 >= len) {
+		rc = MQTT_FAILURE;
+	}
+
+	FUNC_EXIT_RC(rc);
+}
+
+/**
+ * @brief Check the CONNACK and start keepalive if the connection was accepted
+ *
+ * @param pClient Reference to the IoT Client
+ * @param pAckBuf Buffer holding the CONNACK packet
+ * @param ackBufLen Length of pAckBuf
+ *
+ * @return MQTT_SUCCESS if accepted, else the CONNACK return code
+ */
+static IoT_Error_t _mqtt_handle_connack(MQTT_Client *pClient, unsigned char *pAckBuf, size_t ackBufLen) {
+	IoT_Error_t connack_rc = MQTT_FAILURE;
+	char sessionPresent = 0;
+	IoT_Error_t rc;
+
+	FUNC_ENTRY;
+
+	/* Received CONNACK, check the return code */
+	rc = _mqtt_deserialize_connack((unsigned char *) &sessionPresent, &connack_rc, pAckBuf, ackBufLen);
+	if(MQTT_SUCCESS != rc) {
+		FUNC_EXIT_RC(rc);
+	}
+	pClient->clientStatus.isSessionPresent = (MQTT_CONNACK_CONNECTION_ACCEPTED == connack_rc && 0 != sessionPresent);
+
+	if(MQTT_CONNACK_CONNECTION_ACCEPTED != connack_rc) {
+		FUNC_EXIT_RC(connack_rc);
+	}
+
+	mqtt_internal_start_keepalive(pClient);
+
+	FUNC_EXIT_RC(MQTT_SUCCESS);
+}
+
 /**
  * @brief MQTT Connection Function
  *
@@ -355,14 +493,15 @@ static bool _mqtt_is_client_state_valid_for_connect(ClientState clientState) {
  *
  * @param pClient Reference to the IoT Client
  * @param pConnectParams Pointer to MQTT connection parameters
+ * @param pResubscribe If not NULL, SUBSCRIBEs for the active subscriptions are written in
+ *        the same go as CONNECT and recorded here. Left empty if they do not fit the TX buffer
  *
  * @return An IoT Error Type defining successful/failed connection
  */
-static IoT_Error_t _mqtt_internal_connect(MQTT_Client *pClient, IoT_Client_Connect_Params *pConnectParams) {
+static IoT_Error_t _mqtt_internal_connect(MQTT_Client *pClient, IoT_Client_Connect_Params *pConnectParams,
+										  ResubscribeBatch *pResubscribe) {
 	Timer connect_timer;
-	IoT_Error_t connack_rc = MQTT_FAILURE;
-	char sessionPresent = 0;
-	size_t len = 0;
+	unsigned char ackBuf[MQTT_ACK_PACKET_MAX_LEN];
 	IoT_Error_t rc = MQTT_FAILURE;
 
 	FUNC_ENTRY;
@@ -376,6 +515,7 @@ static IoT_Error_t _mqtt_internal_connect(MQTT_Client *pClient, IoT_Client_Conne
 	}
 
 	rc = pClient->networkStack.connect(&(pClient->networkStack), NULL);
+	_mqtt_connect_timing_network(pClient);
 	if(MQTT_SUCCESS != rc) {
 		/* TLS Connect failed, return error */
 		FUNC_EXIT_RC(rc);
@@ -384,40 +524,59 @@ static IoT_Error_t _mqtt_internal_connect(MQTT_Client *pClient, IoT_Client_Conne
 	init_timer(&connect_timer);
 	countdown_ms(&connect_timer, pClient->clientData.commandTimeoutMs);
 
-	pClient->clientData.keepAliveInterval = pClient->clientData.options.keepAliveIntervalInSec;
-	rc = _mqtt_serialize_connect(pClient->clientData.writeBuf, pClient->clientData.writeBufSize,
-										 &(pClient->clientData.options), &len);
-	if(MQTT_SUCCESS != rc || 0 >= len) {
-		FUNC_EXIT_RC(rc);
-	}
-
-	/* send the connect packet */
-	rc = mqtt_internal_send_packet(pClient, len, &connect_timer);
+	rc = _mqtt_send_connect(pClient, pResubscribe, &connect_timer);
 	if(MQTT_SUCCESS != rc) {
 		FUNC_EXIT_RC(rc);
 	}
 
 	/* this will be a blocking call, wait for the CONNACK */
-	rc = mqtt_internal_wait_for_read(pClient, CONNACK, &connect_timer);
+	rc = mqtt_internal_wait_for_read(pClient, CONNACK, NULL, &connect_timer, ackBuf, sizeof(ackBuf));
+	_mqtt_connect_timing_connack(pClient);
 	if(MQTT_SUCCESS != rc) {
 		FUNC_EXIT_RC(rc);
 	}
 
-	/* Received CONNACK, check the return code */
-	rc = _mqtt_deserialize_connack((unsigned char *) &sessionPresent, &connack_rc, pClient->clientData.readBuf,
-										   pClient->clientData.readBufSize);
-	if(MQTT_SUCCESS != rc) {
-		FUNC_EXIT_RC(rc);
-	}
+	rc = _mqtt_handle_connack(pClient, ackBuf, sizeof(ackBuf));
+	FUNC_EXIT_RC(rc);
+}
 
-	if(MQTT_CONNACK_CONNECTION_ACCEPTED != connack_rc) {
-		FUNC_EXIT_RC(connack_rc);
+/**
+ * @brief Connect with client state changes, see mqtt_connect
+ *
+ * @param pClient Reference to the IoT Client
+ * @param pConnectParams Pointer to MQTT connection parameters
+ * @param pResubscribe Resubscribe batch to pipeline behind CONNECT, NULL for none
+ *
+ * @return An IoT Error Type defining successful/failed connection
+ */
+static IoT_Error_t _mqtt_connect(MQTT_Client *pClient, IoT_Client_Connect_Params *pConnectParams,
+								  ResubscribeBatch *pResubscribe) {
+	IoT_Error_t rc;
+	ClientState clientState;
+
+	FUNC_ENTRY;
+
+	clientState = mqtt_get_client_state(pClient);
+
+	if(false == _mqtt_is_client_state_valid_for_connect(clientState)) {
+		/* Don't send connect packet again if we are already connected
+		 * or in the process of connecting/disconnecting */
+		FUNC_EXIT_RC(NETWORK_ALREADY_CONNECTED_ERROR);
 	}
 
-	pClient->clientStatus.isPingOutstanding = false;
-	countdown_sec(&pClient->pingTimer, pClient->clientData.keepAliveInterval);
+	mqtt_set_client_state(pClient, clientState, CLIENT_STATE_CONNECTING);
 
-	FUNC_EXIT_RC(MQTT_SUCCESS);
+	rc = _mqtt_internal_connect(pClient, pConnectParams, pResubscribe);
+
+	if(MQTT_SUCCESS != rc) {
+		pClient->networkStack.disconnect(&(pClient->networkStack));
+		pClient->networkStack.destroy(&(pClient->networkStack));
+		mqtt_set_client_state(pClient, CLIENT_STATE_CONNECTING, CLIENT_STATE_DISCONNECTED_ERROR);
+	} else {
+		mqtt_set_client_state(pClient, CLIENT_STATE_CONNECTING, CLIENT_STATE_CONNECTED_IDLE);
+	}
+
+	FUNC_EXIT_RC(rc);
 }
 
 /**
@@ -434,7 +593,6 @@ static IoT_Error_t _mqtt_internal_connect(MQTT_Client *pClient, IoT_Client_Conne
  */
 IoT_Error_t mqtt_connect(MQTT_Client *pClient, IoT_Client_Connect_Params *pConnectParams) {
 	IoT_Error_t rc;
-	ClientState clientState;
 
 	FUNC_ENTRY;
 
@@ -442,18 +600,113 @@ IoT_Error_t mqtt_connect(MQTT_Client *pClient, IoT_Client_Connect_Params *pConne
 		FUNC_EXIT_RC(NULL_VALUE_ERROR);
 	}
 
-	clientState = mqtt_get_client_state(pClient);
+	_mqtt_connect_timing_begin(pClient, false);
+	rc = _mqtt_connect(pClient, pConnectParams, NULL);
+	_mqtt_connect_timing_end(pClient, rc);
 
-	if(false == _mqtt_is_client_state_valid_for_connect(clientState)) {
-		/* Don't send connect packet again if we are already connected
-		 * or in the process of connecting/disconnecting */
-		FUNC_EXIT_RC(NETWORK_ALREADY_CONNECTED_ERROR);
-	}
+	FUNC_EXIT_RC(rc);
+}
 
-	mqtt_set_client_state(pClient, clientState, CLIENT_STATE_CONNECTING);
+static IoT_Error_t _mqtt_finish_reconnect(MQTT_Client *pClient, IoT_Error_t rc, bool isSessionExpected,
+										  ResubscribeBatch *pResubscribe);
+
+#ifdef _ENABLE_NONBLOCKING_CONNECT_
+/**
+ * @brief Steps of a non-blocking connect, see ClientData.connectStep
+ */
+typedef enum {
+	CONNECT_STEP_NONE = 0,
+	CONNECT_STEP_NETWORK = 1,
+	CONNECT_STEP_CONNACK = 2
+} ConnectStep;
+
+/**
+ * @brief Advance a non-blocking connect
+ *
+ * Called from mqtt_yield while the client is connecting. Polls the network layer until
+ * DNS, TCP and TLS are done, sleeping MQTT_CONNECT_POLL_MS between polls, then sends
+ * CONNECT and reads the CONNACK. Returns after at most timeout_ms, 0 polls once.
+ *
+ * @param pClient Reference to the IoT Client
+ * @param timeout_ms Longest to spend in this call
+ *
+ * @return MQTT_CONNECT_IN_PROGRESS, or the result of the connect once it is done. For an
+ *         auto-reconnect the result of mqtt_attempt_reconnect instead
+ */
+IoT_Error_t mqtt_internal_connect_step(MQTT_Client *pClient, uint32_t timeout_ms) {
+	Timer stepTimer;
+	Timer ioTimer;
+	uint32_t waitMs;
+	uint8_t packetType = 0;
+	IoT_Error_t rc;
+
+	FUNC_ENTRY;
+
+	init_timer(&stepTimer);
+	countdown_ms(&stepTimer, timeout_ms);
+
+	switch(pClient->clientData.connectStep) {
+		case CONNECT_STEP_NETWORK:
+			rc = pClient->networkStack.connectStep(&(pClient->networkStack), NULL);
+			while(MQTT_CONNECT_IN_PROGRESS == rc && !has_timer_expired(&stepTimer)) {
+				timer_sleep_ms(MQTT_CONNECT_POLL_MS < left_ms(&stepTimer) ? MQTT_CONNECT_POLL_MS
+																		  : left_ms(&stepTimer));
+				rc = pClient->networkStack.connectStep(&(pClient->networkStack), NULL);
+			}
+			if(MQTT_CONNECT_IN_PROGRESS == rc) {
+				break;
+			}
+			_mqtt_connect_timing_network(pClient);
+			if(MQTT_SUCCESS != rc) {
+				break;
+			}
+
+			init_timer(&ioTimer);
+			countdown_ms(&ioTimer, pClient->clientData.commandTimeoutMs);
+			rc = _mqtt_send_connect(pClient, NULL, &ioTimer);
+			if(MQTT_SUCCESS == rc) {
+				mqtt_internal_schedule_deadline(pClient, &(pClient->connectDeadline),
+												pClient->clientData.commandTimeoutMs);
+				pClient->clientData.connectStep = CONNECT_STEP_CONNACK;
+				rc = MQTT_CONNECT_IN_PROGRESS;
+			}
+			break;
+		case CONNECT_STEP_CONNACK:
+			do {
+				timer_wheel_advance(&(pClient->timerWheel), timer_now_ms());
+				if(!timer_wheel_is_scheduled(&(pClient->connectDeadline))) {
+					rc = MQTT_REQUEST_TIMEOUT_ERROR;
+					break;
+				}
+				/* The next wheel deadline is no later than the CONNACK deadline */
+				waitMs = timer_wheel_next_deadline_ms(&(pClient->timerWheel), timer_now_ms());
+				if(waitMs > left_ms(&stepTimer)) {
+					waitMs = left_ms(&stepTimer);
+				}
+				init_timer(&ioTimer);
+				countdown_ms(&ioTimer, waitMs);
+
+				rc = mqtt_internal_cycle_read(pClient, &ioTimer, &packetType);
+				_mqtt_connect_timing_connack(pClient);
+				if(MQTT_SUCCESS == rc && CONNACK == packetType) {
+					rc = _mqtt_handle_connack(pClient, pClient->clientData.readBuf,
+											  pClient->clientData.readBufSize);
+				} else if(MQTT_SUCCESS == rc || MQTT_NOTHING_TO_READ == rc) {
+					rc = MQTT_CONNECT_IN_PROGRESS;
+				}
+			} while(MQTT_CONNECT_IN_PROGRESS == rc && !has_timer_expired(&stepTimer));
+			break;
+		default:
+			rc = MQTT_FAILURE;
+			break;
+	}
 
-	rc = _mqtt_internal_connect(pClient, pConnectParams);
+	if(MQTT_CONNECT_IN_PROGRESS == rc) {
+		FUNC_EXIT_RC(rc);
+	}
 
+	pClient->clientData.connectStep = CONNECT_STEP_NONE;
+	timer_wheel_cancel(&(pClient->timerWheel), &(pClient->connectDeadline));
 	if(MQTT_SUCCESS != rc) {
 		pClient->networkStack.disconnect(&(pClient->networkStack));
 		pClient->networkStack.destroy(&(pClient->networkStack));
@@ -461,10 +714,97 @@ IoT_Error_t mqtt_connect(MQTT_Client *pClient, IoT_Client_Connect_Params *pConne
 	} else {
 		mqtt_set_client_state(pClient, CLIENT_STATE_CONNECTING, CLIENT_STATE_CONNECTED_IDLE);
 	}
+	if(pClient->clientCold.isReconnectStep) {
+		pClient->clientCold.isReconnectStep = false;
+		rc = _mqtt_finish_reconnect(pClient, rc, pClient->clientCold.isReconnectSessionExpected, NULL);
+	} else {
+		_mqtt_connect_timing_end(pClient, rc);
+	}
 
 	FUNC_EXIT_RC(rc);
 }
 
+/**
+ * @brief Start a non-blocking auto-reconnect
+ *
+ * The non-blocking counterpart of mqtt_attempt_reconnect, called by mqtt_yield when the
+ * reconnect back-off is over. Following yields advance it with mqtt_internal_connect_step.
+ * The resubscribe is not pipelined behind CONNECT, it is sent once the CONNACK is in.
+ *
+ * @param pClient Reference to the IoT Client
+ *
+ * @return MQTT_CONNECT_IN_PROGRESS, or the result of mqtt_attempt_reconnect if it is done at once
+ */
+IoT_Error_t mqtt_internal_reconnect_start(MQTT_Client *pClient) {
+	ClientState clientState;
+
+	FUNC_ENTRY;
+
+	clientState = mqtt_get_client_state(pClient);
+	if(false == _mqtt_is_client_state_valid_for_connect(clientState)) {
+		FUNC_EXIT_RC(NETWORK_ALREADY_CONNECTED_ERROR);
+	}
+
+	pClient->clientCold.isReconnectSessionExpected = !pClient->clientCold.options.isCleanSession
+													 && !mqtt_internal_is_subscription_drift(pClient);
+	_mqtt_connect_timing_begin(pClient, true);
+
+	if(MQTT_SUCCESS != mqtt_set_client_state(pClient, clientState, CLIENT_STATE_CONNECTING)) {
+		FUNC_EXIT_RC(_mqtt_finish_reconnect(pClient, MQTT_CONNECTION_ERROR, false, NULL));
+	}
+	pClient->clientCold.isReconnectStep = true;
+	pClient->clientData.connectStep = CONNECT_STEP_NETWORK;
+	FUNC_EXIT_RC(mqtt_internal_connect_step(pClient, 0));
+}
+
+/**
+ * @brief Start a non-blocking MQTT connection
+ *
+ * Called to connect without blocking the calling task. Only starts the connect, every
+ * following mqtt_yield() advances it by one step and returns MQTT_CONNECT_IN_PROGRESS
+ * until it is done, then the result of the connect.
+ *
+ * @param pClient Reference to the IoT Client
+ * @param pConnectParams Pointer to MQTT connection parameters
+ *
+ * @return MQTT_CONNECT_IN_PROGRESS, or an IoT Error Type if the connect could not be started or failed at once
+ */
+IoT_Error_t mqtt_connect_start(MQTT_Client *pClient, IoT_Client_Connect_Params *pConnectParams) {
+	IoT_Error_t rc;
+	ClientState clientState;
+
+	FUNC_ENTRY;
+
+	if(NULL == pClient) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	clientState = mqtt_get_client_state(pClient);
+	if(false == _mqtt_is_client_state_valid_for_connect(clientState)) {
+		FUNC_EXIT_RC(NETWORK_ALREADY_CONNECTED_ERROR);
+	}
+
+	rc = mqtt_set_client_state(pClient, clientState, CLIENT_STATE_CONNECTING);
+	if(MQTT_SUCCESS != rc) {
+		FUNC_EXIT_RC(rc);
+	}
+
+	if(NULL != pConnectParams) {
+		/* override default options if new options were supplied */
+		rc = mqtt_set_connect_params(pClient, pConnectParams);
+		if(MQTT_SUCCESS != rc) {
+			mqtt_set_client_state(pClient, CLIENT_STATE_CONNECTING, CLIENT_STATE_DISCONNECTED_ERROR);
+			FUNC_EXIT_RC(MQTT_CONNECTION_ERROR);
+		}
+	}
+
+	_mqtt_connect_timing_begin(pClient, false);
+	pClient->clientCold.isReconnectStep = false;
+	pClient->clientData.connectStep = CONNECT_STEP_NETWORK;
+	FUNC_EXIT_RC(mqtt_internal_connect_step(pClient, 0));
+}
+#endif
+
 /**
  * @brief Disconnect an MQTT Connection
  *
@@ -478,28 +818,19 @@ IoT_Error_t mqtt_connect(MQTT_Client *pClient, IoT_Client_Connect_Params *pConne
  */
 IoT_Error_t _mqtt_internal_disconnect(MQTT_Client *pClient) {
 	/* We might wait for incomplete incoming publishes to complete */
+	static const unsigned char disconnectPacket[] = { (unsigned char) (DISCONNECT << 4), 0x00 };
 	Timer timer;
-	size_t serialized_len = 0;
 	IoT_Error_t rc;
 
 	FUNC_ENTRY;
 
-	rc = mqtt_internal_serialize_zero(pClient->clientData.writeBuf, pClient->clientData.writeBufSize,
-											  DISCONNECT,
-											  &serialized_len);
-	if(MQTT_SUCCESS != rc) {
-		FUNC_EXIT_RC(rc);
-	}
-
 	init_timer(&timer);
 	countdown_ms(&timer, pClient->clientData.commandTimeoutMs);
 
 	/* send the disconnect packet */
-	if(serialized_len > 0) {
-		rc = mqtt_internal_send_packet(pClient, serialized_len, &timer);
-		if(MQTT_SUCCESS != rc) {
-			FUNC_EXIT_RC(rc);
-		}
+	rc = mqtt_internal_send_control(pClient, disconnectPacket, sizeof(disconnectPacket), &timer);
+	if(MQTT_SUCCESS != rc) {
+		FUNC_EXIT_RC(rc);
 	}
 
 	/* Clean network stack */
@@ -548,10 +879,10 @@ IoT_Error_t mqtt_disconnect(MQTT_Client *pClient) {
 	rc = _mqtt_internal_disconnect(pClient);
 
 	if(MQTT_SUCCESS != rc) {
-		pClient->clientStatus.clientState = clientState;
+		mqtt_internal_force_client_state(pClient, clientState);
 	} else {
 		/* If called from Keepalive, this gets set to CLIENT_STATE_DISCONNECTED_ERROR */
-		pClient->clientStatus.clientState = CLIENT_STATE_DISCONNECTED_MANUALLY;
+		mqtt_internal_force_client_state(pClient, CLIENT_STATE_DISCONNECTED_MANUALLY);
 	}
 
 	FUNC_EXIT_RC(rc);
@@ -572,6 +903,10 @@ IoT_Error_t mqtt_disconnect(MQTT_Client *pClient) {
  */
 IoT_Error_t mqtt_attempt_reconnect(MQTT_Client *pClient) {
 	IoT_Error_t rc;
+	bool isSessionExpected;
+#ifdef _ENABLE_PIPELINED_RECONNECT_
+	ResubscribeBatch resubscribe;
+#endif
 
 	FUNC_ENTRY;
 
@@ -583,16 +918,63 @@ IoT_Error_t mqtt_attempt_reconnect(MQTT_Client *pClient) {
 		FUNC_EXIT_RC(NETWORK_ALREADY_CONNECTED_ERROR);
 	}
 
+	/* A persistent session that matches our subscriptions needs no resubscribe if the broker kept it */
+	isSessionExpected = !pClient->clientCold.options.isCleanSession && !mqtt_internal_is_subscription_drift(pClient);
+
+	_mqtt_connect_timing_begin(pClient, true);
+
 	/* Ignoring return code. failures expected if network is disconnected */
-	rc = mqtt_connect(pClient, NULL);
+#ifdef _ENABLE_PIPELINED_RECONNECT_
+	resubscribe.count = 0;
+	rc = _mqtt_connect(pClient, NULL, isSessionExpected ? NULL : &resubscribe);
+#else
+	rc = _mqtt_connect(pClient, NULL, NULL);
+#endif
+
+#ifdef _ENABLE_PIPELINED_RECONNECT_
+	FUNC_EXIT_RC(_mqtt_finish_reconnect(pClient, rc, isSessionExpected, isSessionExpected ? NULL : &resubscribe));
+#else
+	FUNC_EXIT_RC(_mqtt_finish_reconnect(pClient, rc, isSessionExpected, NULL));
+#endif
+}
+
+/**
+ * @brief Resubscribe after a reconnect, or queue the next attempt if it failed
+ *
+ * @param pClient Reference to the IoT Client
+ * @param rc Result of the connect
+ * @param isSessionExpected The broker may have kept our subscriptions
+ * @param pResubscribe Resubscribe batch pipelined behind CONNECT, NULL for none
+ *
+ * @return NETWORK_RECONNECTED, NETWORK_ATTEMPTING_RECONNECT or the resubscribe error
+ */
+static IoT_Error_t _mqtt_finish_reconnect(MQTT_Client *pClient, IoT_Error_t rc, bool isSessionExpected,
+										  ResubscribeBatch *pResubscribe) {
+	uint32_t resubscribeStartMs;
+
+	FUNC_ENTRY;
 
 	/* If still disconnected handle disconnect */
 	if(CLIENT_STATE_CONNECTED_IDLE != mqtt_get_client_state(pClient)) {
+		_mqtt_connect_timing_end(pClient, (MQTT_SUCCESS != rc) ? rc : MQTT_CONNECTION_ERROR);
 		mqtt_set_client_state(pClient, CLIENT_STATE_DISCONNECTED_ERROR, CLIENT_STATE_PENDING_RECONNECT);
 		FUNC_EXIT_RC(NETWORK_ATTEMPTING_RECONNECT);
 	}
 
-	rc = mqtt_resubscribe(pClient);
+	resubscribeStartMs = timer_now_raw_ms();
+
+	if(isSessionExpected && pClient->clientStatus.isSessionPresent) {
+		rc = MQTT_SUCCESS;
+#ifdef _ENABLE_PIPELINED_RECONNECT_
+	} else if(NULL != pResubscribe && 0 < pResubscribe->count) {
+		/* The SUBSCRIBEs went out with CONNECT, only the SUBACKs are left */
+		rc = mqtt_internal_complete_resubscribe(pClient, pResubscribe);
+#endif
+	} else {
+		rc = mqtt_resubscribe(pClient);
+	}
+	pClient->clientCold.connectTiming.resubscribeMs = timer_now_raw_ms() - resubscribeStartMs;
+	_mqtt_connect_timing_end(pClient, rc);
 	if(MQTT_SUCCESS != rc) {
 		FUNC_EXIT_RC(rc);
 	}
@@ -0,0 +1,268 @@
+/**
+ * @file mqtt_client_health.c
+ * @brief Periodic device health record published from the yield loop.
+ *
+ * The record is JSON with short keys so fleet tooling can ingest it without a schema,
+ * written field by field into a fixed stack buffer. A field that does not fit is left
+ * out together with everything after it, the record stays valid JSON.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "mqtt_client_common_internal.h"
+
+#ifdef _ENABLE_HEALTH_REPORT_
+
+#include "mqtt_atomic.h"
+#include "mico_rtos.h"
+
+#define HEALTH_RECORD_VERSION	(1)
+
+typedef struct {
+	char *pBuf;
+	size_t size;
+	size_t len;
+	bool isFull;
+} HealthRecordWriter;
+
+static void _health_put(HealthRecordWriter *pWriter, const char *pText, size_t textLen) {
+	/* One byte stays free for the closing brace */
+	if(pWriter->isFull || textLen >= pWriter->size - pWriter->len) {
+		pWriter->isFull = true;
+		return;
+	}
+	memcpy(&(pWriter->pBuf[pWriter->len]), pText, textLen);
+	pWriter->len += textLen;
+}
+
+/**
+ * @brief Append ,"key":value or, as the first field, {"key":value
+ */
+static void _health_put_u32(HealthRecordWriter *pWriter, const char *pKey, uint32_t value) {
+	char field[32];
+	char digits[10];
+	size_t keyLen = strlen(pKey);
+	size_t len = 0, count = 0;
+
+	if(keyLen > sizeof(field) - sizeof(digits) - 4) {
+		return;
+	}
+
+	do {
+		digits[count++] = (char) ('0' + value % 10);
+		value /= 10;
+	} while(0 != value);
+
+	field[len++] = (0 == pWriter->len) ? '{' : ',';
+	field[len++] = '"';
+	memcpy(&field[len], pKey, keyLen);
+	len += keyLen;
+	field[len++] = '"';
+	field[len++] = ':';
+	while(0 != count) {
+		field[len++] = digits[--count];
+	}
+
+	_health_put(pWriter, field, len);
+}
+
+/**
+ * @brief Upper bound in ms of the bucket the given percentile of the samples falls in
+ */
+static uint32_t _health_percentile(const uint32_t *pCounts, uint32_t total, uint32_t percent) {
+	uint32_t rank = (uint32_t) (((uint64_t) total * percent + 99) / 100);
+	uint32_t seen = 0, bucket;
+
+	for(bucket = 0; bucket < MQTT_STATS_HISTOGRAM_BUCKETS - 1; bucket++) {
+		seen += pCounts[bucket];
+		if(seen >= rank) {
+			break;
+		}
+	}
+
+	return (0 == bucket) ? 0 : ((1u << bucket) - 1);
+}
+
+static void _health_put_rtt(HealthRecordWriter *pWriter, MQTT_Client *pClient) {
+	IoT_Latency_Histogram *pLast = &(pClient->clientCold.healthReportLastRtt);
+	uint32_t counts[MQTT_STATS_HISTOGRAM_BUCKETS];
+	uint32_t current, total = 0, bucket;
+
+	/* Percentiles of the PUBACKs since the previous record */
+	for(bucket = 0; bucket < MQTT_STATS_HISTOGRAM_BUCKETS; bucket++) {
+		current = mqtt_atomic_load_u32(&(pClient->stats.pubackLatency.buckets[bucket]));
+		counts[bucket] = current - pLast->buckets[bucket];
+		pLast->buckets[bucket] = current;
+		total += counts[bucket];
+	}
+
+	_health_put_u32(pWriter, "acks", total);
+	if(0 != total) {
+		_health_put_u32(pWriter, "p50", _health_percentile(counts, total, 50));
+		_health_put_u32(pWriter, "p90", _health_percentile(counts, total, 90));
+		_health_put_u32(pWriter, "p99", _health_percentile(counts, total, 99));
+	}
+	_health_put_u32(pWriter, "srtt", mqtt_atomic_load_u32(&(pClient->clientData.rttEstimate)) >> 16);
+}
+
+#ifdef _ENABLE_THREAD_SUPPORT_
+static void _health_put_queue(HealthRecordWriter *pWriter, MQTT_Client *pClient) {
+	uint32_t freeMask = mqtt_atomic_load_u32(&(pClient->clientCold.txPool.freeMask));
+	uint32_t pending = 0, itr;
+
+	/* Read without the pending lock, a slot changing meanwhile only skews one record */
+	for(itr = 0; itr < MQTT_MAX_PENDING_REQUESTS; itr++) {
+		if(0 != pClient->clientCold.pendingRequests[itr].packetType) {
+			pending++;
+		}
+	}
+
+	_health_put_u32(pWriter, "txq", MQTT_TX_POOL_COUNT - (uint32_t) __builtin_popcount(freeMask));
+	_health_put_u32(pWriter, "pend", pending);
+#ifdef _ENABLE_STACK_WATERMARK_
+	if(pClient->clientData.isBackgroundRunning) {
+		_health_put_u32(pWriter, "stk", aws_iot_thread_stack_unused(&(pClient->clientCold.backgroundThread)));
+	}
+#endif
+}
+#endif
+
+static void _health_put_heap(HealthRecordWriter *pWriter, MQTT_Client *pClient) {
+	micoMemInfo_t *pMemInfo = MicoGetMemoryInfo();
+	uint32_t heapFree;
+
+	if(NULL == pMemInfo) {
+		return;
+	}
+
+	/* Sampled once per record, a dip between records is not seen */
+	heapFree = (uint32_t) pMemInfo->free_memory;
+	if(0 == pClient->clientCold.healthReportHeapMin || heapFree < pClient->clientCold.healthReportHeapMin) {
+		pClient->clientCold.healthReportHeapMin = heapFree;
+	}
+	_health_put_u32(pWriter, "heap", heapFree);
+	_health_put_u32(pWriter, "heapMin", pClient->clientCold.healthReportHeapMin);
+}
+
+/**
+ * @brief Encode the health record, most important fields first
+ *
+ * @return length of the record
+ */
+static size_t _health_encode(MQTT_Client *pClient, char *pBuf, size_t bufLen) {
+	HealthRecordWriter writer = { pBuf, bufLen, 0, false };
+
+	_health_put_u32(&writer, "v", HEALTH_RECORD_VERSION);
+	_health_put_u32(&writer, "seq", pClient->clientCold.healthReportSeq++);
+	_health_put_u32(&writer, "up", timer_now_ms() / 1000);
+	_health_put_u32(&writer, "disc", pClient->clientCold.counterNetworkDisconnected);
+	_health_put_u32(&writer, "tls", pClient->clientCold.connectTiming.tlsMs);
+	_health_put_u32(&writer, "conn", pClient->clientCold.connectTiming.totalMs);
+	_health_put_rtt(&writer, pClient);
+	_health_put_u32(&writer, "tmo", mqtt_atomic_load_u32(&(pClient->stats.ackTimeouts)));
+	_health_put_u32(&writer, "drop", pClient->stats.rxTooLargeDrops);
+#ifdef _ENABLE_THREAD_SUPPORT_
+	_health_put_queue(&writer, pClient);
+#endif
+	_health_put_heap(&writer, pClient);
+	_health_put_u32(&writer, "tx", pClient->stats.bytesSent);
+	_health_put_u32(&writer, "rx", pClient->stats.bytesReceived);
+
+	writer.pBuf[writer.len++] = '}';
+	return writer.len;
+}
+
+void mqtt_internal_health_report_init(MQTT_Client *pClient) {
+	timer_wheel_entry_init(&(pClient->healthReportDeadline), NULL, NULL);
+	pClient->clientCold.pHealthReportTopic = NULL;
+	pClient->clientCold.healthReportTopicLen = 0;
+	pClient->clientCold.healthReportIntervalMs = 0;
+	pClient->clientCold.isHealthReportArmed = false;
+	pClient->clientCold.healthReportSeq = 0;
+	pClient->clientCold.healthReportHeapMin = 0;
+	memset(&(pClient->clientCold.healthReportLastRtt), 0, sizeof(IoT_Latency_Histogram));
+}
+
+/**
+ * @brief Publish a health record if one is due
+ *
+ * Called by the yield loop while connected. Only the yield task touches the deadline,
+ * start and stop just change the interval, which is picked up here.
+ *
+ * @param pClient Reference to the IoT Client
+ */
+void mqtt_internal_health_report(MQTT_Client *pClient) {
+	char record[MQTT_HEALTH_REPORT_BUF_LEN];
+	IoT_Publish_Message_Params params;
+	uint32_t intervalMs;
+	IoT_Error_t rc;
+
+	intervalMs = mqtt_atomic_load_u32(&(pClient->clientCold.healthReportIntervalMs));
+	if(0 == intervalMs) {
+		if(pClient->clientCold.isHealthReportArmed) {
+			timer_wheel_cancel(&(pClient->timerWheel), &(pClient->healthReportDeadline));
+			pClient->clientCold.isHealthReportArmed = false;
+		}
+		return;
+	}
+
+	if(timer_wheel_is_scheduled(&(pClient->healthReportDeadline))) {
+		return;
+	}
+
+	if(pClient->clientCold.isHealthReportArmed) {
+		params.qos = QOS0;
+		params.isRetained = 0;
+		params.isDup = 0;
+		params.id = 0;
+		params.payload = record;
+		params.payloadLen = _health_encode(pClient, record, sizeof(record));
+		rc = mqtt_internal_publish(pClient, pClient->clientCold.pHealthReportTopic,
+								   pClient->clientCold.healthReportTopicLen, &params);
+		if(MQTT_SUCCESS != rc) {
+			/* A broken connection is caught by the liveness probe the failed write requested */
+			IOT_WARN("Health report not sent, rc %d", rc);
+		}
+	}
+
+	pClient->clientCold.isHealthReportArmed = true;
+	mqtt_internal_schedule_deadline(pClient, &(pClient->healthReportDeadline), intervalMs);
+}
+
+IoT_Error_t mqtt_health_report_start(MQTT_Client *pClient, const char *pTopicName, uint16_t topicNameLen,
+									 uint32_t intervalMs) {
+	FUNC_ENTRY;
+	if(NULL == pClient || NULL == pTopicName || 0 == topicNameLen || 0 == intervalMs) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	if(0 != mqtt_atomic_load_u32(&(pClient->clientCold.healthReportIntervalMs))) {
+		/* The yield task may be reading the topic, stop first to change it */
+		FUNC_EXIT_RC(MQTT_CLIENT_NOT_IDLE_ERROR);
+	}
+
+	pClient->clientCold.pHealthReportTopic = pTopicName;
+	pClient->clientCold.healthReportTopicLen = topicNameLen;
+	mqtt_atomic_store_u32(&(pClient->clientCold.healthReportIntervalMs), intervalMs);
+
+	FUNC_EXIT_RC(MQTT_SUCCESS);
+}
+
+IoT_Error_t mqtt_health_report_stop(MQTT_Client *pClient) {
+	FUNC_ENTRY;
+	if(NULL == pClient) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	mqtt_atomic_store_u32(&(pClient->clientCold.healthReportIntervalMs), 0);
+
+	FUNC_EXIT_RC(MQTT_SUCCESS);
+}
+
+#endif /* _ENABLE_HEALTH_REPORT_ */
+
+#ifdef __cplusplus
+}
+#endif
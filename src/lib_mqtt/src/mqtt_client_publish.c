@@ -24,6 +24,7 @@
 extern "C" {
 #endif
 
+#include "mqtt_atomic.h"
 #include "mqtt_client_common_internal.h"
 
 /**
@@ -169,7 +170,8 @@ IoT_Error_t mqtt_internal_serialize_ack(unsigned char *pTxBuf, size_t txBufLen,
  * after the message was successfully passed to the TLS layer.  In the case of QoS 1
  * the function returns after the receipt of the PUBACK control packet.
  * This is the internal function which is called by the publish API to perform the operation.
- * Not meant to be called directly as it doesn't do validations or client state changes
+ * Not meant to be called directly as it doesn't do validations or client state changes,
+ * the health reporter uses it from the yield loop, which already owns the client state
  *
  * @param pClient Reference to the IoT Client
  * @param pTopicName Topic Name to publish to
@@ -178,12 +180,15 @@ IoT_Error_t mqtt_internal_serialize_ack(unsigned char *pTxBuf, size_t txBufLen,
  *
  * @return An IoT Error Type defining successful/failed publish
  */
-static IoT_Error_t _mqtt_internal_publish(MQTT_Client *pClient, const char *pTopicName,
-												  uint16_t topicNameLen, IoT_Publish_Message_Params *pParams) {
+IoT_Error_t mqtt_internal_publish(MQTT_Client *pClient, const char *pTopicName,
+								  uint16_t topicNameLen, IoT_Publish_Message_Params *pParams) {
 	Timer timer;
 	uint32_t len = 0;
 	uint16_t packet_id;
 	unsigned char dup, type;
+	unsigned char ackBuf[MQTT_ACK_PACKET_MAX_LEN];
+	PendingRequest *pRequest = NULL;
+	uint32_t sentMs = 0, ackMs;
 	IoT_Error_t rc;
 
 	FUNC_ENTRY;
@@ -191,6 +196,11 @@ static IoT_Error_t _mqtt_internal_publish(MQTT_Client *pClient, const char *pTop
 	init_timer(&timer);
 	countdown_ms(&timer, pClient->clientData.commandTimeoutMs);
 
+	rc = mqtt_internal_lock_tx(pClient);
+	if(MQTT_SUCCESS != rc) {
+		FUNC_EXIT_RC(rc);
+	}
+
 	if(QOS1 == pParams->qos) {
 		pParams->id = mqtt_get_next_packet_id(pClient);
 	}
@@ -199,25 +209,137 @@ static IoT_Error_t _mqtt_internal_publish(MQTT_Client *pClient, const char *pTop
 												  pParams->qos, pParams->isRetained, pParams->id, pTopicName,
 												  topicNameLen, (unsigned char *) pParams->payload,
 												  pParams->payloadLen, &len);
+	if(MQTT_SUCCESS == rc && QOS1 == pParams->qos) {
+		rc = mqtt_internal_expect_ack(pClient, PUBACK, pParams->id, ackBuf, sizeof(ackBuf), &pRequest);
+	}
+	if(MQTT_SUCCESS == rc) {
+		/* send the publish packet */
+		sentMs = timer_now_raw_ms();
+		rc = mqtt_internal_send_packet(pClient, len, &timer);
+	}
+	mqtt_internal_unlock_tx(pClient);
 	if(MQTT_SUCCESS != rc) {
+		(void) mqtt_internal_cancel_ack(pClient, pRequest);
 		FUNC_EXIT_RC(rc);
 	}
 
-	/* send the publish packet */
-	rc = mqtt_internal_send_packet(pClient, len, &timer);
+	/* Wait for ack if QoS1 */
+	if(QOS1 == pParams->qos) {
+		rc = mqtt_internal_wait_for_read(pClient, PUBACK, pRequest, &timer, ackBuf, sizeof(ackBuf));
+		if(MQTT_REQUEST_TIMEOUT_ERROR == rc) {
+			(void) mqtt_atomic_fetch_add_u32(&(pClient->stats.ackTimeouts), 1);
+			mqtt_internal_request_liveness_probe(pClient);
+		}
+		if(MQTT_SUCCESS != rc) {
+			FUNC_EXIT_RC(rc);
+		}
+		ackMs = timer_now_raw_ms() - sentMs;
+		if(!pParams->isDup) {
+			/* Karn's rule, the PUBACK of a retransmission may answer an earlier copy */
+			mqtt_internal_note_rtt(pClient, ackMs);
+		}
+		mqtt_internal_stats_add_sample(&(pClient->stats.pubackLatency), ackMs);
+
+		rc = mqtt_internal_deserialize_ack(&type, &dup, &packet_id, ackBuf, sizeof(ackBuf));
+		if(MQTT_SUCCESS != rc) {
+			FUNC_EXIT_RC(rc);
+		}
+	}
+
+	FUNC_EXIT_RC(MQTT_SUCCESS);
+}
+
+#ifdef _ENABLE_THREAD_SUPPORT_
+/**
+ * @brief Publish an MQTT message through the outbound queue
+ *
+ * Used by application tasks while the network I/O task owns the socket. The message is
+ * serialized into a pooled buffer and queued for the I/O task, the caller never touches
+ * the socket. QoS 0 returns once queued, QoS 1 once the PUBACK has been handed back.
+ *
+ * @param pClient Reference to the IoT Client
+ * @param pTopicName Topic Name to publish to
+ * @param topicNameLen Length of the topic name
+ * @param pParams Pointer to Publish Message parameters
+ *
+ * @return An IoT Error Type defining successful/failed publish. MQTT_TX_BUFFER_TOO_SHORT_ERROR
+ *         if the message does not fit a pooled buffer, MQTT_TX_QUEUE_FULL_ERROR if none came
+ *         free within MQTT_TX_POOL_WAIT_MS. Nothing is sent then
+ */
+static IoT_Error_t _mqtt_internal_publish_queued(MQTT_Client *pClient, const char *pTopicName,
+												 uint16_t topicNameLen, IoT_Publish_Message_Params *pParams) {
+	Timer timer;
+	Timer poolTimer;
+	TxBuffer *pTxBuf;
+	uint32_t len = 0;
+	uint16_t packet_id;
+	unsigned char dup, type;
+	unsigned char ackBuf[MQTT_ACK_PACKET_MAX_LEN];
+	PendingRequest *pRequest = NULL;
+	uint32_t queuedMs, ackMs;
+	IoT_Error_t rc;
+
+	FUNC_ENTRY;
+
+	init_timer(&timer);
+	countdown_ms(&timer, pClient->clientData.commandTimeoutMs);
+
+	/* Only queue what fits a pooled buffer and what the I/O task can batch into the TX buffer */
+	len = mqtt_internal_get_final_packet_length_from_remaining_length(
+			(uint32_t) (topicNameLen + pParams->payloadLen + 2) + ((QOS0 != pParams->qos) ? 2 : 0));
+	if(len > MQTT_TX_POOL_BUF_LEN || len >= pClient->clientData.writeBufSize) {
+		FUNC_EXIT_RC(MQTT_TX_BUFFER_TOO_SHORT_ERROR);
+	}
+
+	/* The I/O task returns buffers as it writes, wait a little rather than touch the socket */
+	init_timer(&poolTimer);
+	countdown_ms(&poolTimer, MQTT_TX_POOL_WAIT_MS);
+	while(NULL == (pTxBuf = tx_pool_alloc(&(pClient->clientCold.txPool)))) {
+		if(has_timer_expired(&poolTimer)) {
+			FUNC_EXIT_RC(MQTT_TX_QUEUE_FULL_ERROR);
+		}
+		aws_iot_thread_sleep(MQTT_TX_QUEUE_POLL_MS);
+	}
+
+	if(QOS1 == pParams->qos) {
+		pParams->id = mqtt_get_next_packet_id(pClient);
+	}
+
+	rc = _mqtt_internal_serialize_publish(pTxBuf->buf, sizeof(pTxBuf->buf), 0,
+										  pParams->qos, pParams->isRetained, pParams->id, pTopicName,
+										  topicNameLen, (unsigned char *) pParams->payload,
+										  pParams->payloadLen, &len);
 	if(MQTT_SUCCESS != rc) {
+		tx_pool_free(&(pClient->clientCold.txPool), pTxBuf);
 		FUNC_EXIT_RC(rc);
 	}
+	pTxBuf->len = len;
+
+	if(QOS1 == pParams->qos) {
+		rc = mqtt_internal_expect_ack(pClient, PUBACK, pParams->id, ackBuf, sizeof(ackBuf), &pRequest);
+		if(MQTT_SUCCESS != rc) {
+			tx_pool_free(&(pClient->clientCold.txPool), pTxBuf);
+			FUNC_EXIT_RC(rc);
+		}
+	}
+	queuedMs = timer_now_raw_ms();
+	tx_queue_push(&(pClient->clientCold.txQueue), &(pTxBuf->node));
+	(void) aws_iot_thread_sem_post(&(pClient->clientCold.txWakeSem));
 
-	/* Wait for ack if QoS1 */
 	if(QOS1 == pParams->qos) {
-		rc = mqtt_internal_wait_for_read(pClient, PUBACK, &timer);
+		rc = mqtt_internal_wait_for_read(pClient, PUBACK, pRequest, &timer, ackBuf, sizeof(ackBuf));
+		if(MQTT_REQUEST_TIMEOUT_ERROR == rc) {
+			(void) mqtt_atomic_fetch_add_u32(&(pClient->stats.ackTimeouts), 1);
+			mqtt_internal_request_liveness_probe(pClient);
+		}
 		if(MQTT_SUCCESS != rc) {
 			FUNC_EXIT_RC(rc);
 		}
+		/* Includes the wait in the queue, so it is kept out of the RTT estimate */
+		ackMs = timer_now_raw_ms() - queuedMs;
+		mqtt_internal_stats_add_sample(&(pClient->stats.pubackLatency), ackMs);
 
-		rc = mqtt_internal_deserialize_ack(&type, &dup, &packet_id, pClient->clientData.readBuf,
-												   pClient->clientData.readBufSize);
+		rc = mqtt_internal_deserialize_ack(&type, &dup, &packet_id, ackBuf, sizeof(ackBuf));
 		if(MQTT_SUCCESS != rc) {
 			FUNC_EXIT_RC(rc);
 		}
@@ -225,6 +347,7 @@ static IoT_Error_t _mqtt_internal_publish(MQTT_Client *pClient, const char *pTop
 
 	FUNC_EXIT_RC(MQTT_SUCCESS);
 }
+#endif
 
 /**
  * @brief Publish an MQTT message on a topic
@@ -258,6 +381,19 @@ IoT_Error_t mqtt_publish(MQTT_Client *pClient, const char *pTopicName, uint16_t
 		FUNC_EXIT_RC(NETWORK_DISCONNECTED_ERROR);
 	}
 
+#ifdef _ENABLE_THREAD_SUPPORT_
+	if(mqtt_internal_is_background_caller(pClient)) {
+		/* The I/O task owns the client state, publishers go straight to the outbound queue
+		 * and QoS1 publishers wait on their own pending request */
+		pubRc = _mqtt_internal_publish_queued(pClient, pTopicName, topicNameLen, pParams);
+		if(MQTT_TX_BUFFER_TOO_SHORT_ERROR == pubRc) {
+			/* Too large for the pool, serialize into the shared TX buffer */
+			pubRc = mqtt_internal_publish(pClient, pTopicName, topicNameLen, pParams);
+		}
+		FUNC_EXIT_RC(pubRc);
+	}
+#endif
+
 	clientState = mqtt_get_client_state(pClient);
 	if(CLIENT_STATE_CONNECTED_IDLE != clientState && CLIENT_STATE_CONNECTED_WAIT_FOR_CB_RETURN != clientState) {
 		FUNC_EXIT_RC(MQTT_CLIENT_NOT_IDLE_ERROR);
@@ -268,7 +404,7 @@ IoT_Error_t mqtt_publish(MQTT_Client *pClient, const char *pTopicName, uint16_t
 		FUNC_EXIT_RC(rc);
 	}
 
-	pubRc = _mqtt_internal_publish(pClient, pTopicName, topicNameLen, pParams);
+	pubRc = mqtt_internal_publish(pClient, pTopicName, topicNameLen, pParams);
 
 	rc = mqtt_set_client_state(pClient, CLIENT_STATE_CONNECTED_PUBLISH_IN_PROGRESS, clientState);
 	if(MQTT_SUCCESS == pubRc && MQTT_SUCCESS != rc) {
@@ -23,6 +23,7 @@
 extern "C" {
 #endif
 
+#include "mqtt_atomic.h"
 #include "mqtt_client_common_internal.h"
 
 /**
@@ -160,7 +161,7 @@ static uint32_t _mqtt_get_free_message_handler_index(MQTT_Client *pClient) {
 	FUNC_ENTRY;
 
 	for(itr = 0; itr < MQTT_NUM_SUBSCRIBE_HANDLERS; itr++) {
-		if(pClient->clientData.messageHandlers[itr].topicName == NULL) {
+		if(pClient->clientCold.messageHandlers[itr].topicName == NULL) {
 			break;
 		}
 	}
@@ -169,30 +170,72 @@ static uint32_t _mqtt_get_free_message_handler_index(MQTT_Client *pClient) {
 }
 
 /**
- * @brief Subscribe to an MQTT topic.
+ * @brief Claim a free message handler for a subscribe in flight
  *
- * Called to send a subscribe message to the broker requesting a subscription
- * to an MQTT topic. This is the internal function which is called by the
- * subscribe API to perform the operation. Not meant to be called directly as
- * it doesn't do validations or client state changes
- * @note Call is blocking.  The call returns after the receipt of the SUBACK control packet.
+ * Subscribes from several application tasks wait for their SUBACKs concurrently, the claim
+ * keeps them from picking the same handler. Dropped with _mqtt_release_message_handler.
  *
  * @param pClient Reference to the IoT Client
+ *
+ * @return Index of the handler, MQTT_NUM_SUBSCRIBE_HANDLERS if none is free
+ */
+static uint32_t _mqtt_claim_message_handler(MQTT_Client *pClient) {
+#ifdef _ENABLE_THREAD_SUPPORT_
+	uint32_t itr;
+
+	if(MQTT_SUCCESS != aws_iot_thread_mutex_lock(&(pClient->clientCold.pending_mutex))) {
+		return MQTT_NUM_SUBSCRIBE_HANDLERS;
+	}
+
+	for(itr = 0; itr < MQTT_NUM_SUBSCRIBE_HANDLERS; itr++) {
+		if(pClient->clientCold.messageHandlers[itr].topicName == NULL
+		   && 0 == (pClient->clientCold.reservedHandlerMask & (1u << itr))) {
+			pClient->clientCold.reservedHandlerMask |= (1u << itr);
+			break;
+		}
+	}
+
+	(void) aws_iot_thread_mutex_unlock(&(pClient->clientCold.pending_mutex));
+	return itr;
+#else
+	return _mqtt_get_free_message_handler_index(pClient);
+#endif
+}
+
+static void _mqtt_release_message_handler(MQTT_Client *pClient, uint32_t index) {
+#ifdef _ENABLE_THREAD_SUPPORT_
+	(void) aws_iot_thread_mutex_lock(&(pClient->clientCold.pending_mutex));
+	pClient->clientCold.reservedHandlerMask &= ~(1u << index);
+	(void) aws_iot_thread_mutex_unlock(&(pClient->clientCold.pending_mutex));
+#else
+	IOT_UNUSED(pClient);
+	IOT_UNUSED(index);
+#endif
+}
+
+/**
+ * @brief Send a subscribe and fill in the claimed message handler on SUBACK
+ *
+ * @param pClient Reference to the IoT Client
+ * @param indexOfFreeMessageHandler Handler claimed for this subscription
  * @param pTopicName Topic Name to publish to
  * @param topicNameLen Length of the topic name
  * @param pApplicationHandler_t Reference to the handler function for this subscription
  *
  * @return An IoT Error Type defining successful/failed subscription
  */
-static IoT_Error_t _mqtt_internal_subscribe(MQTT_Client *pClient, const char *pTopicName,
-													uint16_t topicNameLen, QoS qos,
-													pApplicationHandler_t pApplicationHandler,
-													void *pApplicationHandlerData) {
+static IoT_Error_t _mqtt_internal_send_subscribe(MQTT_Client *pClient, uint32_t indexOfFreeMessageHandler,
+												 const char *pTopicName, uint16_t topicNameLen, QoS qos,
+												 pApplicationHandler_t pApplicationHandler,
+												 void *pApplicationHandlerData) {
 	uint16_t txPacketId, rxPacketId;
-	uint32_t serializedLen, indexOfFreeMessageHandler, count;
+	uint32_t serializedLen, count;
 	IoT_Error_t rc;
 	Timer timer;
 	QoS grantedQoS[3] = {QOS0, QOS0, QOS0};
+	unsigned char ackBuf[MQTT_ACK_PACKET_MAX_LEN];
+	PendingRequest *pRequest = NULL;
+	uint32_t sentMs;
 
 	FUNC_ENTRY;
 	init_timer(&timer);
@@ -200,35 +243,42 @@ static IoT_Error_t _mqtt_internal_subscribe(MQTT_Client *pClient, const char *pT
 
 	serializedLen = 0;
 	count = 0;
-	txPacketId = mqtt_get_next_packet_id(pClient);
 	rxPacketId = 0;
 
-	rc = _mqtt_serialize_subscribe(pClient->clientData.writeBuf, pClient->clientData.writeBufSize, 0,
-										   txPacketId, 1, &pTopicName, &topicNameLen, &qos, &serializedLen);
+	rc = mqtt_internal_lock_tx(pClient);
 	if(MQTT_SUCCESS != rc) {
 		FUNC_EXIT_RC(rc);
 	}
 
-	indexOfFreeMessageHandler = _mqtt_get_free_message_handler_index(pClient);
-	if(MQTT_NUM_SUBSCRIBE_HANDLERS <= indexOfFreeMessageHandler) {
-		FUNC_EXIT_RC(MQTT_MAX_SUBSCRIPTIONS_REACHED_ERROR);
+	txPacketId = mqtt_get_next_packet_id(pClient);
+	rc = _mqtt_serialize_subscribe(pClient->clientData.writeBuf, pClient->clientData.writeBufSize, 0,
+										   txPacketId, 1, &pTopicName, &topicNameLen, &qos, &serializedLen);
+	if(MQTT_SUCCESS == rc) {
+		rc = mqtt_internal_expect_ack(pClient, SUBACK, txPacketId, ackBuf, sizeof(ackBuf), &pRequest);
 	}
-
-	/* send the subscribe packet */
-	rc = mqtt_internal_send_packet(pClient, serializedLen, &timer);
+	if(MQTT_SUCCESS == rc) {
+		/* send the subscribe packet */
+		rc = mqtt_internal_send_packet(pClient, serializedLen, &timer);
+	}
+	mqtt_internal_unlock_tx(pClient);
 	if(MQTT_SUCCESS != rc) {
+		(void) mqtt_internal_cancel_ack(pClient, pRequest);
 		FUNC_EXIT_RC(rc);
 	}
 
 	/* wait for suback */
-	rc = mqtt_internal_wait_for_read(pClient, SUBACK, &timer);
+	sentMs = timer_now_ms();
+	rc = mqtt_internal_wait_for_read(pClient, SUBACK, pRequest, &timer, ackBuf, sizeof(ackBuf));
+	if(MQTT_REQUEST_TIMEOUT_ERROR == rc) {
+		(void) mqtt_atomic_fetch_add_u32(&(pClient->stats.ackTimeouts), 1);
+	}
 	if(MQTT_SUCCESS != rc) {
 		FUNC_EXIT_RC(rc);
 	}
+	mqtt_internal_stats_add_sample(&(pClient->stats.subackLatency), timer_now_ms() - sentMs);
 
 	/* Granted QoS can be 0, 1 or 2 */
-	rc = _mqtt_deserialize_suback(&rxPacketId, 1, &count, grantedQoS, pClient->clientData.readBuf,
-										  pClient->clientData.readBufSize);
+	rc = _mqtt_deserialize_suback(&rxPacketId, 1, &count, grantedQoS, ackBuf, sizeof(ackBuf));
 	if(MQTT_SUCCESS != rc) {
 		FUNC_EXIT_RC(rc);
 	}
@@ -240,19 +290,59 @@ static IoT_Error_t _mqtt_internal_subscribe(MQTT_Client *pClient, const char *pT
 	//	return RX_MESSAGE_INVALID_ERROR;
 	//}
 
-	pClient->clientData.messageHandlers[indexOfFreeMessageHandler].topicName =
-			pTopicName;
-	pClient->clientData.messageHandlers[indexOfFreeMessageHandler].topicNameLen =
+	pClient->clientCold.messageHandlers[indexOfFreeMessageHandler].topicNameLen =
 			topicNameLen;
-	pClient->clientData.messageHandlers[indexOfFreeMessageHandler].pApplicationHandler =
+	pClient->clientCold.messageHandlers[indexOfFreeMessageHandler].pApplicationHandler =
 			pApplicationHandler;
-	pClient->clientData.messageHandlers[indexOfFreeMessageHandler].pApplicationHandlerData =
+	pClient->clientCold.messageHandlers[indexOfFreeMessageHandler].pApplicationHandlerData =
 			pApplicationHandlerData;
-	pClient->clientData.messageHandlers[indexOfFreeMessageHandler].qos = qos;
+	pClient->clientCold.messageHandlers[indexOfFreeMessageHandler].qos = qos;
+	pClient->clientCold.messageHandlers[indexOfFreeMessageHandler].isConflated = false;
+	/* Set last, the I/O task may be dispatching and matches on topicName */
+	pClient->clientCold.messageHandlers[indexOfFreeMessageHandler].topicName =
+			pTopicName;
 
 	FUNC_EXIT_RC(MQTT_SUCCESS);
 }
 
+/**
+ * @brief Subscribe to an MQTT topic.
+ *
+ * Called to send a subscribe message to the broker requesting a subscription
+ * to an MQTT topic. This is the internal function which is called by the
+ * subscribe API to perform the operation. Not meant to be called directly as
+ * it doesn't do validations or client state changes
+ * @note Call is blocking.  The call returns after the receipt of the SUBACK control packet.
+ *
+ * @param pClient Reference to the IoT Client
+ * @param pTopicName Topic Name to publish to
+ * @param topicNameLen Length of the topic name
+ * @param pApplicationHandler_t Reference to the handler function for this subscription
+ *
+ * @return An IoT Error Type defining successful/failed subscription
+ */
+static IoT_Error_t _mqtt_internal_subscribe(MQTT_Client *pClient, const char *pTopicName,
+													uint16_t topicNameLen, QoS qos,
+													pApplicationHandler_t pApplicationHandler,
+													void *pApplicationHandlerData) {
+	uint32_t indexOfFreeMessageHandler;
+	IoT_Error_t rc;
+
+	FUNC_ENTRY;
+
+	indexOfFreeMessageHandler = _mqtt_claim_message_handler(pClient);
+	if(MQTT_NUM_SUBSCRIBE_HANDLERS <= indexOfFreeMessageHandler) {
+		FUNC_EXIT_RC(MQTT_MAX_SUBSCRIPTIONS_REACHED_ERROR);
+	}
+
+	rc = _mqtt_internal_send_subscribe(pClient, indexOfFreeMessageHandler, pTopicName, topicNameLen, qos,
+									   pApplicationHandler, pApplicationHandlerData);
+	mqtt_internal_note_subscription_change(pClient, MQTT_SUCCESS == rc);
+	_mqtt_release_message_handler(pClient, indexOfFreeMessageHandler);
+
+	FUNC_EXIT_RC(rc);
+}
+
 /**
  * @brief Subscribe to an MQTT topic.
  *
@@ -284,6 +374,14 @@ IoT_Error_t mqtt_subscribe(MQTT_Client *pClient, const char *pTopicName, uint16_
 		FUNC_EXIT_RC(NETWORK_DISCONNECTED_ERROR);
 	}
 
+#ifdef _ENABLE_THREAD_SUPPORT_
+	if(mqtt_internal_is_background_caller(pClient)) {
+		subRc = _mqtt_internal_subscribe(pClient, pTopicName, topicNameLen, qos,
+										 pApplicationHandler, pApplicationHandlerData);
+		FUNC_EXIT_RC(subRc);
+	}
+#endif
+
 	clientState = mqtt_get_client_state(pClient);
 	if(CLIENT_STATE_CONNECTED_IDLE != clientState && CLIENT_STATE_CONNECTED_WAIT_FOR_CB_RETURN != clientState) {
 		FUNC_EXIT_RC(MQTT_CLIENT_NOT_IDLE_ERROR);
@@ -305,6 +403,42 @@ IoT_Error_t mqtt_subscribe(MQTT_Client *pClient, const char *pTopicName, uint16_
 	FUNC_EXIT_RC(subRc);
 }
 
+/**
+ * @brief Enable or Disable latest-value delivery for a subscription
+ *
+ * Called to mark an existing subscription as conflated. Only the local handler
+ * table is updated, nothing is sent to the broker.
+ *
+ * @param pClient Reference to the IoT Client
+ * @param pTopicName Topic filter the subscription was made with
+ * @param topicNameLen Length of the topic filter
+ * @param isConflated set to true to enable and false to disable conflation
+ *
+ * @return An IoT Error Type defining successful/failed call
+ */
+IoT_Error_t mqtt_set_subscription_conflate(MQTT_Client *pClient, const char *pTopicName, uint16_t topicNameLen,
+										   bool isConflated) {
+	uint32_t itr;
+	IoT_Error_t rc = MQTT_FAILURE;
+
+	FUNC_ENTRY;
+
+	if(NULL == pClient || NULL == pTopicName) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	for(itr = 0; itr < MQTT_NUM_SUBSCRIBE_HANDLERS; itr++) {
+		if(NULL != pClient->clientCold.messageHandlers[itr].topicName
+		   && topicNameLen == pClient->clientCold.messageHandlers[itr].topicNameLen
+		   && 0 == strncmp(pClient->clientCold.messageHandlers[itr].topicName, pTopicName, topicNameLen)) {
+			pClient->clientCold.messageHandlers[itr].isConflated = isConflated;
+			rc = MQTT_SUCCESS;
+		}
+	}
+
+	FUNC_EXIT_RC(rc);
+}
+
 /**
  * @brief Subscribe to an MQTT topic.
  *
@@ -324,6 +458,7 @@ static IoT_Error_t _mqtt_internal_resubscribe(MQTT_Client *pClient) {
 	IoT_Error_t rc;
 	Timer timer;
 	QoS grantedQoS[3] = {QOS0, QOS0, QOS0};
+	unsigned char ackBuf[MQTT_ACK_PACKET_MAX_LEN];
 
 	FUNC_ENTRY;
 
@@ -336,38 +471,144 @@ static IoT_Error_t _mqtt_internal_resubscribe(MQTT_Client *pClient) {
 		init_timer(&timer);
 		countdown_ms(&timer, pClient->clientData.commandTimeoutMs);
 
-		rc = _mqtt_serialize_subscribe(pClient->clientData.writeBuf, pClient->clientData.writeBufSize, 0,
-											   mqtt_get_next_packet_id(pClient), 1,
-											   &(pClient->clientData.messageHandlers[itr].topicName),
-											   &(pClient->clientData.messageHandlers[itr].topicNameLen),
-											   &(pClient->clientData.messageHandlers[itr].qos), &len);
+		rc = mqtt_internal_lock_tx(pClient);
 		if(MQTT_SUCCESS != rc) {
 			FUNC_EXIT_RC(rc);
 		}
 
-		/* send the subscribe packet */
-		rc = mqtt_internal_send_packet(pClient, len, &timer);
+		rc = _mqtt_serialize_subscribe(pClient->clientData.writeBuf, pClient->clientData.writeBufSize, 0,
+											   mqtt_get_next_packet_id(pClient), 1,
+											   &(pClient->clientCold.messageHandlers[itr].topicName),
+											   &(pClient->clientCold.messageHandlers[itr].topicNameLen),
+											   &(pClient->clientCold.messageHandlers[itr].qos), &len);
+		if(MQTT_SUCCESS == rc) {
+			/* send the subscribe packet */
+			rc = mqtt_internal_send_packet(pClient, len, &timer);
+		}
+		mqtt_internal_unlock_tx(pClient);
 		if(MQTT_SUCCESS != rc) {
 			FUNC_EXIT_RC(rc);
 		}
 
 		/* wait for suback */
-		rc = mqtt_internal_wait_for_read(pClient, SUBACK, &timer);
+		rc = mqtt_internal_wait_for_read(pClient, SUBACK, NULL, &timer, ackBuf, sizeof(ackBuf));
 		if(MQTT_SUCCESS != rc) {
 			FUNC_EXIT_RC(rc);
 		}
 
 		/* Granted QoS can be 0, 1 or 2 */
-		rc = _mqtt_deserialize_suback(&packetId, 1, &count, grantedQoS, pClient->clientData.readBuf,
-											  pClient->clientData.readBufSize);
+		rc = _mqtt_deserialize_suback(&packetId, 1, &count, grantedQoS, ackBuf, sizeof(ackBuf));
+		if(MQTT_SUCCESS != rc) {
+			FUNC_EXIT_RC(rc);
+		}
+	}
+
+	mqtt_internal_note_subscriptions_synced(pClient);
+	FUNC_EXIT_RC(MQTT_SUCCESS);
+}
+
+/**
+ * @brief Serialize a SUBSCRIBE for every active subscription, back to back
+ *
+ * Used on reconnect to send the resubscribes in the same write as CONNECT. The packet
+ * ids are recorded in pBatch for mqtt_internal_complete_resubscribe.
+ *
+ * @param pClient Reference to the IoT Client
+ * @param pTxBuf Where the packets are serialized to
+ * @param txBufLen Length of pTxBuf
+ * @param pBatch Filled with the packet ids sent
+ * @param pSerializedLen Total length of the packets
+ *
+ * @return MQTT_SUCCESS, MQTT_TX_BUFFER_TOO_SHORT_ERROR if they do not all fit. pBatch
+ *         is empty on failure
+ */
+IoT_Error_t mqtt_internal_serialize_resubscribe(MQTT_Client *pClient, unsigned char *pTxBuf, size_t txBufLen,
+												ResubscribeBatch *pBatch, size_t *pSerializedLen) {
+	uint32_t len, existingSubCount, itr;
+	size_t total = 0;
+	IoT_Error_t rc = MQTT_SUCCESS;
+
+	FUNC_ENTRY;
+
+	pBatch->count = 0;
+	existingSubCount = _mqtt_get_free_message_handler_index(pClient);
+
+	for(itr = 0; itr < existingSubCount; itr++) {
+		len = 0;
+		pBatch->packetIds[itr] = mqtt_get_next_packet_id(pClient);
+		rc = _mqtt_serialize_subscribe(pTxBuf + total, txBufLen - total, 0, pBatch->packetIds[itr], 1,
+									   &(pClient->clientCold.messageHandlers[itr].topicName),
+									   &(pClient->clientCold.messageHandlers[itr].topicNameLen),
+									   &(pClient->clientCold.messageHandlers[itr].qos), &len);
 		if(MQTT_SUCCESS != rc) {
 			FUNC_EXIT_RC(rc);
 		}
+		total += len;
 	}
 
+	pBatch->count = existingSubCount;
+	*pSerializedLen = total;
 	FUNC_EXIT_RC(MQTT_SUCCESS);
 }
 
+/**
+ * @brief Wait for the SUBACKs of a resubscribe batch
+ *
+ * The SUBACKs are matched by packet id in whatever order they arrive. Client state
+ * changes are the same as for mqtt_resubscribe.
+ *
+ * @param pClient Reference to the IoT Client
+ * @param pBatch Packet ids sent by mqtt_internal_serialize_resubscribe
+ *
+ * @return An IoT Error Type defining successful/failed subscription
+ */
+IoT_Error_t mqtt_internal_complete_resubscribe(MQTT_Client *pClient, ResubscribeBatch *pBatch) {
+	uint16_t packetId;
+	uint32_t count, itr;
+	IoT_Error_t rc, resubRc = MQTT_SUCCESS;
+	Timer timer;
+	QoS grantedQoS[3] = {QOS0, QOS0, QOS0};
+	unsigned char ackBuf[MQTT_ACK_PACKET_MAX_LEN];
+
+	FUNC_ENTRY;
+
+	rc = mqtt_set_client_state(pClient, CLIENT_STATE_CONNECTED_IDLE,
+							   CLIENT_STATE_CONNECTED_RESUBSCRIBE_IN_PROGRESS);
+	if(MQTT_SUCCESS != rc) {
+		FUNC_EXIT_RC(rc);
+	}
+
+	init_timer(&timer);
+	countdown_ms(&timer, pClient->clientData.commandTimeoutMs);
+
+	while(0 < pBatch->count && MQTT_SUCCESS == resubRc) {
+		resubRc = mqtt_internal_wait_for_read(pClient, SUBACK, NULL, &timer, ackBuf, sizeof(ackBuf));
+		if(MQTT_SUCCESS != resubRc) {
+			break;
+		}
+
+		resubRc = _mqtt_deserialize_suback(&packetId, 1, &count, grantedQoS, ackBuf, sizeof(ackBuf));
+		for(itr = 0; MQTT_SUCCESS == resubRc && itr < pBatch->count; itr++) {
+			if(packetId == pBatch->packetIds[itr]) {
+				pBatch->packetIds[itr] = pBatch->packetIds[--pBatch->count];
+				break;
+			}
+		}
+	}
+
+	if(MQTT_SUCCESS == resubRc) {
+		mqtt_internal_note_subscriptions_synced(pClient);
+	}
+
+	rc = mqtt_set_client_state(pClient, CLIENT_STATE_CONNECTED_RESUBSCRIBE_IN_PROGRESS,
+							   CLIENT_STATE_CONNECTED_IDLE);
+	if(MQTT_SUCCESS == resubRc && MQTT_SUCCESS != rc) {
+		resubRc = rc;
+	}
+
+	FUNC_EXIT_RC(resubRc);
+}
+
 /**
  * @brief Subscribe to an MQTT topic.
  *
@@ -394,6 +635,11 @@ IoT_Error_t mqtt_resubscribe(MQTT_Client *pClient) {
 		FUNC_EXIT_RC(NETWORK_DISCONNECTED_ERROR);
 	}
 
+	/* The network I/O task resubscribes by itself after a reconnect */
+	if(mqtt_internal_is_background_caller(pClient)) {
+		FUNC_EXIT_RC(MQTT_CLIENT_NOT_IDLE_ERROR);
+	}
+
 	if(CLIENT_STATE_CONNECTED_IDLE != mqtt_get_client_state(pClient)) {
 		FUNC_EXIT_RC(MQTT_CLIENT_NOT_IDLE_ERROR);
 	}
@@ -23,6 +23,7 @@
 extern "C" {
 #endif
 
+#include "mqtt_atomic.h"
 #include "mqtt_client_common_internal.h"
 
 /**
@@ -121,6 +122,9 @@ static IoT_Error_t _mqtt_internal_unsubscribe(MQTT_Client *pClient, const char *
 	Timer timer;
 
 	uint16_t packet_id;
+	uint16_t txPacketId;
+	unsigned char ackBuf[MQTT_ACK_PACKET_MAX_LEN];
+	PendingRequest *pRequest = NULL;
 	uint32_t serializedLen = 0;
 	uint32_t i = 0;
 	IoT_Error_t rc;
@@ -130,8 +134,8 @@ static IoT_Error_t _mqtt_internal_unsubscribe(MQTT_Client *pClient, const char *
 
 	/* Remove from message handler array */
 	for(i = 0; i < MQTT_NUM_SUBSCRIBE_HANDLERS; ++i) {
-		if(pClient->clientData.messageHandlers[i].topicName != NULL &&
-		   (strcmp(pClient->clientData.messageHandlers[i].topicName, pTopicFilter) == 0)) {
+		if(pClient->clientCold.messageHandlers[i].topicName != NULL &&
+		   (strcmp(pClient->clientCold.messageHandlers[i].topicName, pTopicFilter) == 0)) {
 			subscriptionExists = true;
 		}
 	}
@@ -143,34 +147,48 @@ static IoT_Error_t _mqtt_internal_unsubscribe(MQTT_Client *pClient, const char *
 	init_timer(&timer);
 	countdown_ms(&timer, pClient->clientData.commandTimeoutMs);
 
-	rc = _mqtt_serialize_unsubscribe(pClient->clientData.writeBuf, pClient->clientData.writeBufSize, 0,
-											 mqtt_get_next_packet_id(pClient), 1, &pTopicFilter,
-											 &topicFilterLen, &serializedLen);
+	rc = mqtt_internal_lock_tx(pClient);
 	if(MQTT_SUCCESS != rc) {
 		FUNC_EXIT_RC(rc);
 	}
 
-	/* send the unsubscribe packet */
-	rc = mqtt_internal_send_packet(pClient, serializedLen, &timer);
-	if(MQTT_SUCCESS != rc) {
-		FUNC_EXIT_RC(rc);
+	txPacketId = mqtt_get_next_packet_id(pClient);
+	rc = _mqtt_serialize_unsubscribe(pClient->clientData.writeBuf, pClient->clientData.writeBufSize, 0,
+											 txPacketId, 1, &pTopicFilter,
+											 &topicFilterLen, &serializedLen);
+	if(MQTT_SUCCESS == rc) {
+		rc = mqtt_internal_expect_ack(pClient, UNSUBACK, txPacketId, ackBuf, sizeof(ackBuf), &pRequest);
 	}
-
-	rc = mqtt_internal_wait_for_read(pClient, UNSUBACK, &timer);
+	if(MQTT_SUCCESS == rc) {
+		/* send the unsubscribe packet */
+		rc = mqtt_internal_send_packet(pClient, serializedLen, &timer);
+	}
+	mqtt_internal_unlock_tx(pClient);
 	if(MQTT_SUCCESS != rc) {
+		(void) mqtt_internal_cancel_ack(pClient, pRequest);
+		mqtt_internal_note_subscription_change(pClient, false);
 		FUNC_EXIT_RC(rc);
 	}
 
-	rc = _mqtt_deserialize_unsuback(&packet_id, pClient->clientData.readBuf, pClient->clientData.readBufSize);
+	rc = mqtt_internal_wait_for_read(pClient, UNSUBACK, pRequest, &timer, ackBuf, sizeof(ackBuf));
+	if(MQTT_REQUEST_TIMEOUT_ERROR == rc) {
+		(void) mqtt_atomic_fetch_add_u32(&(pClient->stats.ackTimeouts), 1);
+	}
+	if(MQTT_SUCCESS == rc) {
+		rc = _mqtt_deserialize_unsuback(&packet_id, ackBuf, sizeof(ackBuf));
+	}
+	/* A failed UNSUBSCRIBE may still have reached the broker */
+	mqtt_internal_note_subscription_change(pClient, MQTT_SUCCESS == rc);
 	if(MQTT_SUCCESS != rc) {
 		FUNC_EXIT_RC(rc);
 	}
 
 	/* Remove from message handler array */
 	for(i = 0; i < MQTT_NUM_SUBSCRIBE_HANDLERS; ++i) {
-		if(pClient->clientData.messageHandlers[i].topicName != NULL &&
-		   (strcmp(pClient->clientData.messageHandlers[i].topicName, pTopicFilter) == 0)) {
-			pClient->clientData.messageHandlers[i].topicName = NULL;
+		if(pClient->clientCold.messageHandlers[i].topicName != NULL &&
+		   (strcmp(pClient->clientCold.messageHandlers[i].topicName, pTopicFilter) == 0)) {
+			pClient->clientCold.messageHandlers[i].topicName = NULL;
+			pClient->clientCold.conflatedMessage.pendingHandlerMask &= ~(1u << i);
 			/* We don't want to break here, in case the same topic is registered
              * with 2 callbacks. Unlikely scenario */
 		}
@@ -206,6 +224,12 @@ IoT_Error_t mqtt_unsubscribe(MQTT_Client *pClient, const char *pTopicFilter, uin
 		return NETWORK_DISCONNECTED_ERROR;
 	}
 
+#ifdef _ENABLE_THREAD_SUPPORT_
+	if(mqtt_internal_is_background_caller(pClient)) {
+		return _mqtt_internal_unsubscribe(pClient, pTopicFilter, topicFilterLen);
+	}
+#endif
+
 	clientState = mqtt_get_client_state(pClient);
 	if(CLIENT_STATE_CONNECTED_IDLE != clientState && CLIENT_STATE_CONNECTED_WAIT_FOR_CB_RETURN != clientState) {
 		return MQTT_CLIENT_NOT_IDLE_ERROR;
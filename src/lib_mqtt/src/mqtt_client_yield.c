@@ -24,78 +24,449 @@ extern "C" {
 #endif
 
 #include "mqtt_client_common_internal.h"
+#include "mqtt_atomic.h"
 
 /**
   * This is for the case when the mqtt_internal_send_packet Fails.
   */
 static void _mqtt_force_client_disconnect(MQTT_Client *pClient) {
-	pClient->clientStatus.clientState = CLIENT_STATE_DISCONNECTED_ERROR;
+	mqtt_internal_force_client_state(pClient, CLIENT_STATE_DISCONNECTED_ERROR);
 	pClient->networkStack.disconnect(&(pClient->networkStack));
 	pClient->networkStack.destroy(&(pClient->networkStack));
 }
 
+#ifdef _ENABLE_THREAD_SUPPORT_
+/**
+ * @brief Drop everything publishing tasks have queued
+ *
+ * Consumer side only. QoS1 publishers waiting for a PUBACK are failed separately.
+ */
+static void _mqtt_discard_tx_queue(MQTT_Client *pClient) {
+	TxQueueNode *pNode;
+
+	while(NULL != (pNode = tx_queue_pop(&(pClient->clientCold.txQueue)))) {
+		tx_pool_free(&(pClient->clientCold.txPool), (TxBuffer *) pNode);
+	}
+}
+
+/**
+ * @brief Send everything publishing tasks have queued
+ *
+ * Queued packets are copied back to back into the TX buffer so a burst goes out in as
+ * few TLS writes as possible. Pooled buffers are returned as soon as they are copied.
+ *
+ * @param pClient Reference to the IoT Client
+ *
+ * @return An IoT Error Type defining successful/failed send
+ */
+static IoT_Error_t _mqtt_drain_tx_queue(MQTT_Client *pClient) {
+	TxQueueNode *pNode;
+	TxBuffer *pTxBuf;
+	size_t len;
+	Timer timer;
+	IoT_Error_t rc = MQTT_SUCCESS;
+
+	pNode = tx_queue_pop(&(pClient->clientCold.txQueue));
+	while(NULL != pNode && MQTT_SUCCESS == rc) {
+		rc = mqtt_internal_lock_tx(pClient);
+		if(MQTT_SUCCESS != rc) {
+			break;
+		}
+
+		/* A queued packet always fits an empty TX buffer, see _mqtt_internal_publish_queued */
+		len = 0;
+		do {
+			pTxBuf = (TxBuffer *) pNode;
+			if(len + pTxBuf->len >= pClient->clientData.writeBufSize) {
+				break;
+			}
+			memcpy(&(pClient->clientData.writeBuf[len]), pTxBuf->buf, pTxBuf->len);
+			len += pTxBuf->len;
+			tx_pool_free(&(pClient->clientCold.txPool), pTxBuf);
+			pNode = tx_queue_pop(&(pClient->clientCold.txQueue));
+		} while(NULL != pNode);
+
+		init_timer(&timer);
+		countdown_ms(&timer, pClient->clientData.commandTimeoutMs);
+		rc = mqtt_internal_send_packet(pClient, len, &timer);
+		mqtt_internal_unlock_tx(pClient);
+	}
+
+	if(NULL != pNode) {
+		tx_pool_free(&(pClient->clientCold.txPool), (TxBuffer *) pNode);
+		_mqtt_discard_tx_queue(pClient);
+	}
+
+	return rc;
+}
+#endif
+
 static IoT_Error_t _mqtt_handle_disconnect(MQTT_Client *pClient) {
 	IoT_Error_t rc;
 
 	FUNC_ENTRY;
 
+#ifdef _ENABLE_THREAD_SUPPORT_
+	/* Queued publishes were meant for this connection, their acks will not come */
+	_mqtt_discard_tx_queue(pClient);
+	mqtt_internal_fail_pending_requests(pClient, NETWORK_DISCONNECTED_ERROR);
+#endif
+
 	rc = mqtt_disconnect(pClient);
 	if(rc != MQTT_SUCCESS) {
 		// If the aws_iot_mqtt_internal_send_packet prevents us from sending a disconnect packet then we have to clean the stack
 		_mqtt_force_client_disconnect(pClient);
 	}
 
-	if(NULL != pClient->clientData.disconnectHandler) {
-		pClient->clientData.disconnectHandler(pClient, pClient->clientData.disconnectHandlerData);
+	if(NULL != pClient->clientCold.disconnectHandler) {
+		pClient->clientCold.disconnectHandler(pClient, pClient->clientCold.disconnectHandlerData);
 	}
 
 	/* Reset to 0 since this was not a manual disconnect */
-	pClient->clientStatus.clientState = CLIENT_STATE_DISCONNECTED_ERROR;
+	mqtt_internal_force_client_state(pClient, CLIENT_STATE_DISCONNECTED_ERROR);
 	FUNC_EXIT_RC(NETWORK_DISCONNECTED_ERROR);
 }
 
+/**
+ * @brief Next jitter value, xorshift32
+ *
+ * Seeded on first use from the client id and the tick, so devices that lost the
+ * broker at the same moment still draw different waits.
+ */
+static uint32_t _mqtt_backoff_random(MQTT_Client *pClient) {
+	uint32_t x = pClient->clientCold.backoffRandomState;
+	const char *pId;
+	uint16_t itr;
+
+	if(0 == x) {
+		/* FNV-1a over the client id */
+		x = 2166136261u;
+		pId = pClient->clientCold.options.pClientID;
+		for(itr = 0; NULL != pId && itr < pClient->clientCold.options.clientIDLen; itr++) {
+			x = (x ^ (uint8_t) pId[itr]) * 16777619u;
+		}
+		x ^= timer_now_ms();
+		if(0 == x) {
+			x = 1;
+		}
+	}
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	pClient->clientCold.backoffRandomState = x;
+	return x;
+}
+
+/* Uniform in [low, high] */
+static uint32_t _mqtt_backoff_between(MQTT_Client *pClient, uint32_t low, uint32_t high) {
+	if(high <= low) {
+		return low;
+	}
+	return low + _mqtt_backoff_random(pClient) % (high - low + 1);
+}
+
+/* Exponential step, base first then doubling up to max */
+static uint32_t _mqtt_backoff_double(IoT_Backoff_Params *pBackoff, uint32_t previous) {
+	if(0 == previous) {
+		return pBackoff->baseWaitMs;
+	}
+	if(pBackoff->maxWaitMs / 2 < previous) {
+		return pBackoff->maxWaitMs;
+	}
+	return previous * 2;
+}
+
+/**
+ * @brief Wait before the first reconnect attempt after the connection was lost
+ */
+static uint32_t _mqtt_first_reconnect_wait(MQTT_Client *pClient) {
+	IoT_Backoff_Params *pBackoff = &(pClient->clientCold.reconnectBackoff);
+
+	pClient->clientCold.reconnectAttempts = 0;
+	pClient->clientCold.currentReconnectWaitInterval = 0;
+	if(BACKOFF_JITTER_NONE == pBackoff->jitter) {
+		return pBackoff->firstWaitMs;
+	}
+	return _mqtt_backoff_between(pClient, 0, pBackoff->firstWaitMs);
+}
+
+/**
+ * @brief Wait after a failed reconnect attempt, as set by the backoff policy
+ */
+static uint32_t _mqtt_next_reconnect_wait(MQTT_Client *pClient) {
+	IoT_Backoff_Params *pBackoff = &(pClient->clientCold.reconnectBackoff);
+	uint32_t previous = pClient->clientCold.currentReconnectWaitInterval;
+	uint32_t wait;
+
+	switch(pBackoff->jitter) {
+		case BACKOFF_JITTER_FULL:
+			/* The un-jittered wait is tracked in currentReconnectWaitInterval */
+			pClient->clientCold.currentReconnectWaitInterval = _mqtt_backoff_double(pBackoff, previous);
+			return _mqtt_backoff_between(pClient, pBackoff->baseWaitMs, pClient->clientCold.currentReconnectWaitInterval);
+		case BACKOFF_JITTER_DECORRELATED:
+			if(previous < pBackoff->baseWaitMs) {
+				previous = pBackoff->baseWaitMs;
+			}
+			wait = (pBackoff->maxWaitMs / 3 < previous) ? pBackoff->maxWaitMs : previous * 3;
+			wait = _mqtt_backoff_between(pClient, pBackoff->baseWaitMs, wait);
+			break;
+		case BACKOFF_JITTER_NONE:
+		default:
+			wait = _mqtt_backoff_double(pBackoff, previous);
+			break;
+	}
+
+	pClient->clientCold.currentReconnectWaitInterval = wait;
+	return wait;
+}
+
+/**
+ * @brief Has auto-reconnect used up its attempts?
+ */
+static bool _mqtt_is_reconnect_exhausted(MQTT_Client *pClient) {
+	return 0 != pClient->clientCold.reconnectBackoff.maxAttempts
+		   && pClient->clientCold.reconnectBackoff.maxAttempts <= pClient->clientCold.reconnectAttempts;
+}
 
-static IoT_Error_t _mqtt_handle_reconnect(MQTT_Client *pClient) {
+/**
+ * @brief Is the client between losing its connection and getting it back?
+ *
+ * With _ENABLE_NONBLOCKING_CONNECT_ an auto-reconnect attempt is a non-blocking connect,
+ * the client is CONNECTING while it is in progress.
+ */
+static bool _mqtt_is_reconnecting(MQTT_Client *pClient, ClientState clientState) {
+#ifdef _ENABLE_NONBLOCKING_CONNECT_
+	if(CLIENT_STATE_CONNECTING == clientState && 0 != pClient->clientData.connectStep) {
+		return pClient->clientCold.isReconnectStep;
+	}
+#endif
+	return CLIENT_STATE_PENDING_RECONNECT == clientState;
+}
+
+/**
+ * @brief Reconnect if the physical link is up, see _mqtt_handle_reconnect
+ */
+static IoT_Error_t _mqtt_begin_reconnect(MQTT_Client *pClient) {
+	IoT_Error_t rc = NETWORK_PHYSICAL_LAYER_DISCONNECTED;
+
+	if(NULL != pClient->networkStack.isConnected) {
+		rc = pClient->networkStack.isConnected(&(pClient->networkStack));
+	}
+	if(NETWORK_PHYSICAL_LAYER_CONNECTED != rc) {
+		return rc;
+	}
+#ifdef _ENABLE_NONBLOCKING_CONNECT_
+	return mqtt_internal_reconnect_start(pClient);
+#else
+	return mqtt_attempt_reconnect(pClient);
+#endif
+}
+
+/**
+ * @brief Attempt an auto-reconnect once the back-off is over
+ *
+ * With _ENABLE_NONBLOCKING_CONNECT_ the attempt is started and then advanced for at most
+ * timeout_ms per call, otherwise it blocks through DNS, TCP, TLS and CONNACK.
+ *
+ * @param pClient Reference to the IoT Client
+ * @param timeout_ms Longest to spend on a non-blocking attempt in this call
+ *
+ * @return NETWORK_RECONNECTED, NETWORK_ATTEMPTING_RECONNECT while waiting or connecting, or an error
+ */
+static IoT_Error_t _mqtt_handle_reconnect(MQTT_Client *pClient, uint32_t timeout_ms) {
 	IoT_Error_t rc;
 
 	FUNC_ENTRY;
 
-	if(!has_timer_expired(&(pClient->reconnectDelayTimer))) {
+	if(timer_wheel_is_scheduled(&(pClient->reconnectDeadline))) {
 		/* Timer has not expired. Not time to attempt reconnect yet.
 		 * Return attempting reconnect */
 		FUNC_EXIT_RC(NETWORK_ATTEMPTING_RECONNECT);
 	}
 
-	rc = NETWORK_PHYSICAL_LAYER_DISCONNECTED;
-	if(NULL != pClient->networkStack.isConnected) {
-		rc = pClient->networkStack.isConnected(&(pClient->networkStack));
+#ifdef _ENABLE_NONBLOCKING_CONNECT_
+	if(0 != pClient->clientData.connectStep) {
+		/* An attempt is under way */
+		rc = mqtt_internal_connect_step(pClient, timeout_ms);
+	} else {
+		rc = _mqtt_begin_reconnect(pClient);
+	}
+	if(MQTT_CONNECT_IN_PROGRESS == rc) {
+		FUNC_EXIT_RC(NETWORK_ATTEMPTING_RECONNECT);
 	}
+#else
+	(void) timeout_ms;
+	rc = _mqtt_begin_reconnect(pClient);
+#endif
 
-	if(NETWORK_PHYSICAL_LAYER_CONNECTED == rc) {
-		rc = mqtt_attempt_reconnect(pClient);
-		if(NETWORK_RECONNECTED == rc) {
-			rc = mqtt_set_client_state(pClient, CLIENT_STATE_CONNECTED_IDLE,
-											   CLIENT_STATE_CONNECTED_YIELD_IN_PROGRESS);
-			if(MQTT_SUCCESS != rc) {
-				FUNC_EXIT_RC(rc);
-			}
-			FUNC_EXIT_RC(NETWORK_RECONNECTED);
+	if(NETWORK_RECONNECTED == rc) {
+		rc = mqtt_set_client_state(pClient, CLIENT_STATE_CONNECTED_IDLE,
+										   CLIENT_STATE_CONNECTED_YIELD_IN_PROGRESS);
+		if(MQTT_SUCCESS != rc) {
+			FUNC_EXIT_RC(rc);
 		}
+		FUNC_EXIT_RC(NETWORK_RECONNECTED);
 	}
 
-	pClient->clientData.currentReconnectWaitInterval *= 2;
-
-	if(MQTT_MAX_RECONNECT_WAIT_INTERVAL < pClient->clientData.currentReconnectWaitInterval) {
+	pClient->clientCold.reconnectAttempts++;
+	if(_mqtt_is_reconnect_exhausted(pClient)) {
 		FUNC_EXIT_RC(NETWORK_RECONNECT_TIMED_OUT_ERROR);
 	}
-	countdown_ms(&(pClient->reconnectDelayTimer), pClient->clientData.currentReconnectWaitInterval);
+	mqtt_internal_schedule_deadline(pClient, &(pClient->reconnectDeadline), _mqtt_next_reconnect_wait(pClient));
 	FUNC_EXIT_RC(rc);
 }
 
+/**
+ * @brief Start pinging on a new connection
+ *
+ * Called once CONNACK is received. Without _ENABLE_KEEPALIVE_PROBE_ the client pings after
+ * keepAliveInterval seconds without sending. With it, the idle period starts at
+ * MQTT_KEEPALIVE_PROBE_START_SEC, at most half of keepAliveInterval so the probe has room
+ * to grow, and is carried over from the previous connection, so what was learned about
+ * the path survives reconnects.
+ *
+ * @param pClient Reference to the IoT Client
+ */
+void mqtt_internal_start_keepalive(MQTT_Client *pClient) {
+	uint32_t keepAliveMs = (uint32_t) pClient->clientData.keepAliveInterval * 1000;
+	uint32_t now = timer_now_ms();
+
+	pClient->clientStatus.isPingOutstanding = false;
+	pClient->clientStatus.pingMisses = 0;
+#ifdef _ENABLE_KEEPALIVE_PROBE_
+	if(0 == pClient->clientData.pingIntervalMs) {
+		pClient->clientData.pingIntervalMs = MQTT_KEEPALIVE_PROBE_START_SEC * 1000;
+		if(pClient->clientData.pingIntervalMs > keepAliveMs / 2) {
+			pClient->clientData.pingIntervalMs = keepAliveMs / 2;
+		}
+	}
+	if(pClient->clientData.pingIntervalMs > keepAliveMs) {
+		pClient->clientData.pingIntervalMs = keepAliveMs;
+	}
+#else
+	pClient->clientData.pingIntervalMs = keepAliveMs;
+#endif
+	mqtt_atomic_store_u32(&(pClient->clientData.lastSendMs), now);
+	mqtt_atomic_store_u32(&(pClient->clientData.isLivenessProbeDue), 0);
+	pClient->clientData.lastReceiveMs = now;
+	mqtt_internal_schedule_deadline(pClient, &(pClient->pingDeadline), pClient->clientData.pingIntervalMs);
+}
+
+/**
+ * @brief Handle a PINGRESP
+ *
+ * With _ENABLE_KEEPALIVE_PROBE_ an answered PINGREQ that followed a full idle period proves
+ * the path keeps a connection that long, so the idle period is raised by
+ * MQTT_KEEPALIVE_PROBE_STEP_SEC, up to keepAliveInterval.
+ *
+ * @param pClient Reference to the IoT Client
+ */
+void mqtt_internal_handle_pingresp(MQTT_Client *pClient) {
+#ifdef _ENABLE_KEEPALIVE_PROBE_
+	uint32_t keepAliveMs = (uint32_t) pClient->clientData.keepAliveInterval * 1000;
+#endif
+
+	if(pClient->clientStatus.isPingOutstanding && 0 == pClient->clientStatus.pingMisses) {
+		/* After a retry the PINGRESP may answer either PINGREQ, like Karn's rule no sample is taken */
+		mqtt_internal_note_rtt(pClient, timer_now_raw_ms() - pClient->clientData.pingSentMs);
+	}
+#ifdef _ENABLE_KEEPALIVE_PROBE_
+	if(pClient->clientStatus.isPingOutstanding && !pClient->clientData.isProbeSettled
+	   && pClient->clientData.probeIdleMs + MQTT_TIMER_WHEEL_TICK_MS >= pClient->clientData.pingIntervalMs) {
+		if(pClient->clientData.probeIdleMs > pClient->clientData.probeGoodMs) {
+			pClient->clientData.probeGoodMs = pClient->clientData.probeIdleMs;
+		}
+		pClient->clientData.pingIntervalMs += MQTT_KEEPALIVE_PROBE_STEP_SEC * 1000;
+		if(pClient->clientData.pingIntervalMs > keepAliveMs) {
+			pClient->clientData.pingIntervalMs = keepAliveMs;
+		}
+		IOT_DEBUG("keepalive: path survived %u ms idle, next ping after %u ms",
+				  (unsigned) pClient->clientData.probeIdleMs, (unsigned) pClient->clientData.pingIntervalMs);
+	}
+#endif
+	pClient->clientStatus.isPingOutstanding = false;
+	pClient->clientStatus.pingMisses = 0;
+	mqtt_internal_schedule_deadline(pClient, &(pClient->pingDeadline), pClient->clientData.pingIntervalMs);
+}
+
+/**
+ * @brief Ask the keepalive task to ping now
+ *
+ * Called from any task on write errors and ack timeouts. The next yield sends a PINGREQ
+ * regardless of idle time, so a dead connection is found within a few round trips.
+ *
+ * @param pClient Reference to the IoT Client
+ */
+void mqtt_internal_request_liveness_probe(MQTT_Client *pClient) {
+	mqtt_atomic_store_u32(&(pClient->clientData.isLivenessProbeDue), 1);
+}
+
+/**
+ * @brief How long to wait for a PINGRESP
+ *
+ * SRTT + MQTT_PING_TIMEOUT_RTTVAR_MULT * RTTVAR, no less than MQTT_PING_TIMEOUT_MIN_MS,
+ * doubled for each PINGREQ in a row that went unanswered and no more than the idle period.
+ * Until a round trip was measured the command timeout is used.
+ *
+ * @param pClient Reference to the IoT Client
+ *
+ * @return uint32_t timeout in ms
+ */
+static uint32_t _mqtt_ping_timeout_ms(MQTT_Client *pClient) {
+	uint32_t estimate = mqtt_atomic_load_u32(&(pClient->clientData.rttEstimate));
+	uint32_t timeoutMs;
+
+	if(0 == estimate) {
+		timeoutMs = pClient->clientData.commandTimeoutMs;
+	} else {
+		timeoutMs = (estimate >> 16) + MQTT_PING_TIMEOUT_RTTVAR_MULT * (estimate & 0xFFFF);
+	}
+
+	if(timeoutMs < MQTT_PING_TIMEOUT_MIN_MS) {
+		timeoutMs = MQTT_PING_TIMEOUT_MIN_MS;
+	}
+	timeoutMs <<= pClient->clientStatus.pingMisses;
+	if(timeoutMs > pClient->clientData.pingIntervalMs) {
+		timeoutMs = pClient->clientData.pingIntervalMs;
+	}
+	return timeoutMs;
+}
+
+#ifdef _ENABLE_KEEPALIVE_PROBE_
+/**
+ * @brief Learn from a PINGREQ that went unanswered
+ *
+ * The path dropped the connection somewhere between the longest idle period known to work
+ * and the one just tried. Settle on the known one; if nothing is known yet halve the
+ * idle period and keep probing.
+ *
+ * @param pClient Reference to the IoT Client
+ */
+static void _mqtt_keepalive_probe_failed(MQTT_Client *pClient) {
+	/* A PINGREQ sent sooner than a known good idle period says nothing about the path */
+	if(pClient->clientData.isProbeSettled || pClient->clientData.probeIdleMs <= pClient->clientData.probeGoodMs) {
+		return;
+	}
+
+	if(0 != pClient->clientData.probeGoodMs) {
+		pClient->clientData.pingIntervalMs = pClient->clientData.probeGoodMs;
+		pClient->clientData.isProbeSettled = true;
+	} else if(pClient->clientData.pingIntervalMs > 2000) {
+		pClient->clientData.pingIntervalMs /= 2;
+	}
+	IOT_WARN("keepalive: no PINGRESP after %u ms idle, pinging after %u ms",
+			 (unsigned) pClient->clientData.probeIdleMs, (unsigned) pClient->clientData.pingIntervalMs);
+}
+#endif
+
 static IoT_Error_t _mqtt_keep_alive(MQTT_Client *pClient) {
+	static const unsigned char pingreqPacket[] = { (unsigned char) (PINGREQ << 4), 0x00 };
 	IoT_Error_t rc = MQTT_SUCCESS;
 	Timer timer;
-	size_t serialized_len;
+	uint32_t now;
+	uint32_t idleMs;
+	bool isProbeDue;
 
 	FUNC_ENTRY;
 
@@ -107,28 +478,53 @@ static IoT_Error_t _mqtt_keep_alive(MQTT_Client *pClient) {
 		FUNC_EXIT_RC(MQTT_SUCCESS);
 	}
 
-	if(!has_timer_expired(&pClient->pingTimer)) {
+	isProbeDue = (0 != mqtt_atomic_exchange_u32(&(pClient->clientData.isLivenessProbeDue), 0));
+	if(isProbeDue && !pClient->clientStatus.isPingOutstanding) {
+		timer_wheel_cancel(&(pClient->timerWheel), &(pClient->pingDeadline));
+	}
+
+	if(timer_wheel_is_scheduled(&(pClient->pingDeadline))) {
 		FUNC_EXIT_RC(MQTT_SUCCESS);
 	}
 
 	if(pClient->clientStatus.isPingOutstanding) {
-		rc = _mqtt_handle_disconnect(pClient);
-		FUNC_EXIT_RC(rc);
+		pClient->clientStatus.pingMisses++;
+		if(pClient->clientStatus.pingMisses >= MQTT_PING_MAX_MISSES) {
+#ifdef _ENABLE_KEEPALIVE_PROBE_
+			_mqtt_keepalive_probe_failed(pClient);
+#endif
+			rc = _mqtt_handle_disconnect(pClient);
+			FUNC_EXIT_RC(rc);
+		}
+		/* A lost segment may still be retransmitted by TCP, ask again before giving up.
+		 * The probe keeps the idle period of the first PINGREQ */
+		IOT_DEBUG("keepalive: no PINGRESP, retry %u", (unsigned) pClient->clientStatus.pingMisses);
+	} else {
+		/* Any packet sent resets the broker's keepalive timer, ping only after a full idle period.
+		 * Received packets do not count, the broker expects to hear from the client */
+		now = timer_now_ms();
+		idleMs = now - mqtt_atomic_load_u32(&(pClient->clientData.lastSendMs));
+		if(!isProbeDue && idleMs < pClient->clientData.pingIntervalMs) {
+			mqtt_internal_schedule_deadline(pClient, &(pClient->pingDeadline),
+											pClient->clientData.pingIntervalMs - idleMs);
+			FUNC_EXIT_RC(MQTT_SUCCESS);
+		}
+#ifdef _ENABLE_KEEPALIVE_PROBE_
+		/* NAT and firewall timers are reset by traffic in either direction */
+		if(now - pClient->clientData.lastReceiveMs < idleMs) {
+			idleMs = now - pClient->clientData.lastReceiveMs;
+		}
+		pClient->clientData.probeIdleMs = idleMs;
+#endif
 	}
 
 	/* there is no ping outstanding - send one */
 	init_timer(&timer);
 
 	countdown_ms(&timer, pClient->clientData.commandTimeoutMs);
-	serialized_len = 0;
-	rc = mqtt_internal_serialize_zero(pClient->clientData.writeBuf, pClient->clientData.writeBufSize,
-											  PINGREQ, &serialized_len);
-	if(MQTT_SUCCESS != rc) {
-		FUNC_EXIT_RC(rc);
-	}
 
-	/* send the ping packet */
-	rc = mqtt_internal_send_packet(pClient, serialized_len, &timer);
+	/* send the ping packet, it does not wait for a publish staged in writeBuf */
+	rc = mqtt_internal_send_control(pClient, pingreqPacket, sizeof(pingreqPacket), &timer);
 	if(MQTT_SUCCESS != rc) {
 		//If sending a PING fails we can no longer determine if we are connected.  In this case we decide we are disconnected and begin reconnection attempts
 		rc = _mqtt_handle_disconnect(pClient);
@@ -136,8 +532,9 @@ static IoT_Error_t _mqtt_keep_alive(MQTT_Client *pClient) {
 	}
 
 	pClient->clientStatus.isPingOutstanding = true;
-	/* start a timer to wait for PINGRESP from server */
-	countdown_sec(&pClient->pingTimer, pClient->clientData.keepAliveInterval);
+	pClient->clientData.pingSentMs = timer_now_raw_ms();
+	/* start a timer to wait for PINGRESP from server, a live broker answers within a few round trips */
+	mqtt_internal_schedule_deadline(pClient, &(pClient->pingDeadline), _mqtt_ping_timeout_ms(pClient));
 
 	FUNC_EXIT_RC(MQTT_SUCCESS);
 }
@@ -165,8 +562,19 @@ static IoT_Error_t _mqtt_internal_yield(MQTT_Client *pClient, uint32_t timeout_m
 	IoT_Error_t yieldRc = MQTT_SUCCESS;
 
 	uint8_t packet_type;
+	uint32_t nextDeadlineMs;
+	uint32_t iterationStartMs;
 	ClientState clientState;
 	Timer timer;
+	Timer readTimer;
+	Timer *pReadTimer;
+	bool isReadable;
+#ifdef _ENABLE_THREAD_SUPPORT_
+	int wakeFd;
+#endif
+
+	/* Timer checks within one iteration share a single tick read */
+	timer_begin_cached_now();
 	init_timer(&timer);
 	countdown_ms(&timer, timeout_ms);
 
@@ -174,21 +582,86 @@ static IoT_Error_t _mqtt_internal_yield(MQTT_Client *pClient, uint32_t timeout_m
 
 	// evaluate timeout at the end of the loop to make sure the actual yield runs at least once
 	do {
+		timer_refresh_cached_now();
+		iterationStartMs = timer_now_ms();
 		clientState = mqtt_get_client_state(pClient);
-		if(CLIENT_STATE_PENDING_RECONNECT == clientState) {
-			if(MQTT_MAX_RECONNECT_WAIT_INTERVAL < pClient->clientData.currentReconnectWaitInterval) {
+		if(_mqtt_is_reconnecting(pClient, clientState)) {
+			timer_wheel_advance(&(pClient->timerWheel), iterationStartMs);
+			if(_mqtt_is_reconnect_exhausted(pClient)) {
 				yieldRc = NETWORK_RECONNECT_TIMED_OUT_ERROR;
 				break;
 			}
-			yieldRc = _mqtt_handle_reconnect(pClient);
+			/* DNS, TCP and the TLS handshake take seconds, the CONNACK and
+			 * command timers started after them must see the real tick */
+			timer_end_cached_now();
+			yieldRc = _mqtt_handle_reconnect(pClient, left_ms(&timer));
+			if(NETWORK_RECONNECT_TIMED_OUT_ERROR != yieldRc
+			   && CLIENT_STATE_PENDING_RECONNECT == mqtt_get_client_state(pClient)) {
+				/* Nothing to do before the back-off is over, sleep instead of spinning */
+				nextDeadlineMs = timer_wheel_next_deadline_ms(&(pClient->timerWheel), timer_now_ms());
+				if(nextDeadlineMs > left_ms(&timer)) {
+					nextDeadlineMs = left_ms(&timer);
+				}
+				if(0 < nextDeadlineMs) {
+					timer_sleep_ms(nextDeadlineMs);
+				}
+			}
+			timer_begin_cached_now();
 			/* Network reconnect attempted, check if yield timer expired before
 			 * doing anything else */
 			continue;
 		}
 
-		yieldRc = mqtt_internal_cycle_read(pClient, &timer, &packet_type);
+		/* Don't block on the socket past the next keepalive/retry deadline. The wheel is
+		 * advanced only after the read, a deadline already due gives 0 so it is handled
+		 * without waiting for data */
+		nextDeadlineMs = timer_wheel_next_deadline_ms(&(pClient->timerWheel), timer_now_ms());
+		yieldRc = MQTT_SUCCESS;
+#ifdef _ENABLE_THREAD_SUPPORT_
+		wakeFd = -1;
+		if(pClient->clientData.isBackgroundRunning) {
+			/* Taken before draining, a publish queued from here on posts it again */
+			(void) aws_iot_thread_sem_wait(&(pClient->clientCold.txWakeSem), 0);
+			wakeFd = aws_iot_thread_sem_event_fd(&(pClient->clientCold.txWakeSem));
+			if(0 > wakeFd && MQTT_TX_QUEUE_POLL_MS < nextDeadlineMs) {
+				/* The platform cannot wake the socket wait, poll the queue */
+				nextDeadlineMs = MQTT_TX_QUEUE_POLL_MS;
+			}
+			if(MQTT_SUCCESS != _mqtt_drain_tx_queue(pClient)) {
+				/* Queued publishes could not be written, the connection is unusable */
+				yieldRc = NETWORK_SSL_WRITE_ERROR;
+			}
+		}
+#endif
+		if(MQTT_SUCCESS == yieldRc) {
+			pReadTimer = &timer;
+			if(nextDeadlineMs < left_ms(&timer)) {
+				init_timer(&readTimer);
+				countdown_ms(&readTimer, nextDeadlineMs);
+				pReadTimer = &readTimer;
+			}
+			isReadable = true;
+#ifdef _ENABLE_THREAD_SUPPORT_
+			if(0 <= wakeFd) {
+				/* Sleep until data comes in, a publish is queued or the deadline is due */
+				isReadable = (MQTT_SUCCESS == pClient->networkStack.wait(&(pClient->networkStack), wakeFd,
+																		  pReadTimer));
+			}
+#endif
+			if(isReadable) {
+				yieldRc = mqtt_internal_cycle_read(pClient, pReadTimer, &packet_type);
+			}
+		}
 		if(MQTT_SUCCESS == yieldRc) {
+			/* Expire what came due while waiting on the socket before keepalive looks */
+			timer_refresh_cached_now();
+			timer_wheel_advance(&(pClient->timerWheel), timer_now_ms());
 			yieldRc = _mqtt_keep_alive(pClient);
+#ifdef _ENABLE_HEALTH_REPORT_
+			if(MQTT_SUCCESS == yieldRc) {
+				mqtt_internal_health_report(pClient);
+			}
+#endif
 		} else {
 			// SSL read and write errors are terminal, connection must be closed and retried
 			if(NETWORK_SSL_READ_ERROR == yieldRc || NETWORK_SSL_READ_TIMEOUT_ERROR == yieldRc
@@ -198,16 +671,16 @@ static IoT_Error_t _mqtt_internal_yield(MQTT_Client *pClient, uint32_t timeout_m
 		}
 
 		if(NETWORK_DISCONNECTED_ERROR == yieldRc) {
-			pClient->clientData.counterNetworkDisconnected++;
+			pClient->clientCold.counterNetworkDisconnected++;
 			if(1 == pClient->clientStatus.isAutoReconnectEnabled) {
 				yieldRc = mqtt_set_client_state(pClient, CLIENT_STATE_DISCONNECTED_ERROR,
 														CLIENT_STATE_PENDING_RECONNECT);
 				if(MQTT_SUCCESS != yieldRc) {
-					FUNC_EXIT_RC(yieldRc);
+					break;
 				}
 
-				pClient->clientData.currentReconnectWaitInterval = MQTT_MIN_RECONNECT_WAIT_INTERVAL;
-				countdown_ms(&(pClient->reconnectDelayTimer), pClient->clientData.currentReconnectWaitInterval);
+				mqtt_internal_schedule_deadline(pClient, &(pClient->reconnectDeadline),
+												_mqtt_first_reconnect_wait(pClient));
 				/* Depending on timer values, it is possible that yield timer has expired
 				 * Set to rc to attempting reconnect to inform client that autoreconnect
 				 * attempt has started */
@@ -218,8 +691,17 @@ static IoT_Error_t _mqtt_internal_yield(MQTT_Client *pClient, uint32_t timeout_m
 		} else if(MQTT_SUCCESS != yieldRc) {
 			break;
 		}
+		timer_refresh_cached_now();
+		mqtt_internal_stats_add_sample(&(pClient->stats.yieldIteration), timer_now_ms() - iterationStartMs);
 	} while(!has_timer_expired(&timer));
 
+	/* Don't hold back the latest value of a conflated subscription past this yield */
+	if(MQTT_SUCCESS == yieldRc) {
+		yieldRc = mqtt_internal_flush_conflated(pClient);
+	}
+
+	timer_end_cached_now();
+
 	FUNC_EXIT_RC(yieldRc);
 }
 
@@ -250,7 +732,19 @@ IoT_Error_t mqtt_yield(MQTT_Client *pClient, uint32_t timeout_ms) {
 		FUNC_EXIT_RC(NULL_VALUE_ERROR);
 	}
 
+	/* The socket belongs to the network I/O task once it is started */
+	if(mqtt_internal_is_background_caller(pClient)) {
+		FUNC_EXIT_RC(MQTT_CLIENT_NOT_IDLE_ERROR);
+	}
+
 	clientState = mqtt_get_client_state(pClient);
+#ifdef _ENABLE_NONBLOCKING_CONNECT_
+	/* mqtt_connect_start was called, this yield is spent connecting */
+	if(CLIENT_STATE_CONNECTING == clientState && 0 != pClient->clientData.connectStep
+	   && !pClient->clientCold.isReconnectStep) {
+		FUNC_EXIT_RC(mqtt_internal_connect_step(pClient, timeout_ms));
+	}
+#endif
 	/* Check if network was manually disconnected */
 	if(CLIENT_STATE_DISCONNECTED_MANUALLY == clientState) {
 		FUNC_EXIT_RC(NETWORK_MANUALLY_DISCONNECTED);
@@ -258,7 +752,7 @@ IoT_Error_t mqtt_yield(MQTT_Client *pClient, uint32_t timeout_ms) {
 
 	/* If we are in the pending reconnect state, skip other checks.
 	 * Pending reconnect state is only set when auto-reconnect is enabled */
-	if(CLIENT_STATE_PENDING_RECONNECT != clientState) {
+	if(!_mqtt_is_reconnecting(pClient, clientState)) {
 		/* Check if network is disconnected and auto-reconnect is not enabled */
 		if(!mqtt_is_client_connected(pClient)) {
 			FUNC_EXIT_RC(NETWORK_DISCONNECTED_ERROR);
@@ -289,6 +783,84 @@ IoT_Error_t mqtt_yield(MQTT_Client *pClient, uint32_t timeout_ms) {
 	FUNC_EXIT_RC(yieldRc);
 }
 
+#ifdef _ENABLE_THREAD_SUPPORT_
+/**
+ * @brief Network I/O task
+ *
+ * Owns the socket while background mode is on. Yields continuously, which reads
+ * incoming packets, hands acks to waiting tasks, sends keepalives and reconnects.
+ *
+ * @param pArg Reference to the IoT Client
+ */
+static void _mqtt_background_task(void *pArg) {
+	MQTT_Client *pClient = (MQTT_Client *) pArg;
+	IoT_Error_t rc;
+
+	while(!pClient->clientCold.isBackgroundStopRequested) {
+		rc = mqtt_yield(pClient, MQTT_BACKGROUND_YIELD_MS);
+		if(MQTT_SUCCESS != rc && NETWORK_RECONNECTED != rc) {
+			/* Waiting for a reconnect, disconnected for good or another task is
+			 * connecting. Nothing is blocked on the socket, don't spin */
+			aws_iot_thread_sleep(MQTT_BACKGROUND_YIELD_MS);
+		}
+	}
+
+	/* Out of yield, the socket goes back to the application tasks */
+	pClient->clientData.isBackgroundRunning = false;
+	(void) aws_iot_thread_sem_post(&(pClient->clientCold.background_exit_sem));
+}
+
+IoT_Error_t mqtt_start_background(MQTT_Client *pClient) {
+	IoT_Error_t rc;
+
+	FUNC_ENTRY;
+
+	if(NULL == pClient) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	if(pClient->clientData.isBackgroundRunning) {
+		/* A stop that timed out, the task has not left yield yet */
+		FUNC_EXIT_RC(pClient->clientCold.isBackgroundStopRequested ? MQTT_CLIENT_NOT_IDLE_ERROR : MQTT_SUCCESS);
+	}
+
+	/* Drop the exit post of a task that outlived its mqtt_stop_background */
+	(void) aws_iot_thread_sem_wait(&(pClient->clientCold.background_exit_sem), 0);
+	pClient->clientCold.isBackgroundStopRequested = false;
+	pClient->clientData.isBackgroundRunning = true;
+	rc = aws_iot_thread_create(&(pClient->clientCold.backgroundThread), _mqtt_background_task, pClient,
+							   "mqtt_io", MQTT_BACKGROUND_TASK_STACK_SIZE);
+	if(MQTT_SUCCESS != rc) {
+		pClient->clientData.isBackgroundRunning = false;
+	}
+
+	FUNC_EXIT_RC(rc);
+}
+
+IoT_Error_t mqtt_stop_background(MQTT_Client *pClient) {
+	FUNC_ENTRY;
+
+	if(NULL == pClient) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	if(!pClient->clientData.isBackgroundRunning) {
+		FUNC_EXIT_RC(MQTT_SUCCESS);
+	}
+
+	if(aws_iot_thread_is_current(&(pClient->clientCold.backgroundThread))) {
+		/* Called from a message handler, the task would wait on itself */
+		FUNC_EXIT_RC(MQTT_CLIENT_NOT_IDLE_ERROR);
+	}
+
+	/* isBackgroundRunning stays set until the task is out of yield, so that application
+	 * tasks keep away from the socket until then */
+	pClient->clientCold.isBackgroundStopRequested = true;
+	FUNC_EXIT_RC(aws_iot_thread_sem_wait(&(pClient->clientCold.background_exit_sem),
+										 MQTT_BACKGROUND_STOP_TIMEOUT_MS));
+}
+#endif
+
 #ifdef __cplusplus
 }
 #endif
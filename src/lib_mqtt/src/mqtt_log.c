@@ -0,0 +1,153 @@
+/**
+ * @file mqtt_log.c
+ * @brief Deferred binary log ring.
+ *
+ * Writers claim a slot with an atomic increment and publish it by storing its sequence
+ * number last. The single reader checks the sequence number before and after copying
+ * a record, a record overwritten meanwhile is counted as dropped instead of returned.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "mqtt_log.h"
+
+#ifdef _ENABLE_BINARY_LOG_
+
+#include <string.h>
+
+#include "mqtt_error.h"
+#include "mqtt_atomic.h"
+#include "timer_interface.h"
+
+#if (MQTT_LOG_RING_LEN & (MQTT_LOG_RING_LEN - 1)) != 0
+#error "MQTT_LOG_RING_LEN must be a power of two"
+#endif
+
+typedef struct {
+	volatile uint32_t sequence;	///< Claim index + 1 once the record is complete, 0 while it is written
+	MqttLogRecord record;
+} MqttLogSlot;
+
+static MqttLogSlot mqtt_log_ring[MQTT_LOG_RING_LEN];
+static volatile uint32_t mqtt_log_head;	///< Next claim index
+static uint32_t mqtt_log_tail;	///< Next index to read, reader only
+
+static const char *const mqtt_log_level_names[] = { "FUNC", "DEBUG", "INFO", "WARN", "ERROR" };
+
+void mqtt_log_record(uint8_t level, const char *pFunction, uint16_t line, const char *pFormat, uint8_t argCount,
+					 uint32_t a0, uint32_t a1, uint32_t a2, uint32_t a3) {
+	uint32_t index = mqtt_atomic_fetch_add_u32(&mqtt_log_head, 1);
+	MqttLogSlot *pSlot = &mqtt_log_ring[index & (MQTT_LOG_RING_LEN - 1)];
+
+	mqtt_atomic_store_u32(&(pSlot->sequence), 0);
+	pSlot->record.timeMs = timer_now_ms();
+	pSlot->record.pFunction = pFunction;
+	pSlot->record.pFormat = pFormat;
+	pSlot->record.line = line;
+	pSlot->record.level = level;
+	pSlot->record.argCount = argCount;
+	pSlot->record.args[0] = a0;
+	pSlot->record.args[1] = a1;
+	pSlot->record.args[2] = a2;
+	pSlot->record.args[3] = a3;
+	mqtt_atomic_store_u32(&(pSlot->sequence), index + 1);
+}
+
+bool mqtt_log_read(MqttLogRecord *pRecord, uint32_t *pDropped) {
+	uint32_t head, sequence, dropped = 0;
+	MqttLogSlot *pSlot;
+	bool isRead = false;
+
+	while(!isRead) {
+		head = mqtt_atomic_load_u32(&mqtt_log_head);
+		if(head - mqtt_log_tail > MQTT_LOG_RING_LEN) {
+			/* Writers lapped the reader */
+			dropped += head - mqtt_log_tail - MQTT_LOG_RING_LEN;
+			mqtt_log_tail = head - MQTT_LOG_RING_LEN;
+		}
+		if(head == mqtt_log_tail) {
+			break;
+		}
+
+		pSlot = &mqtt_log_ring[mqtt_log_tail & (MQTT_LOG_RING_LEN - 1)];
+		sequence = mqtt_atomic_load_u32(&(pSlot->sequence));
+		if(sequence != mqtt_log_tail + 1) {
+			if(0 == sequence || sequence - 1 - mqtt_log_tail > MQTT_LOG_RING_LEN) {
+				/* Claimed but not complete yet, or a stale lap: try again later */
+				break;
+			}
+			/* Already overwritten by a later lap */
+			dropped++;
+			mqtt_log_tail++;
+			continue;
+		}
+
+		memcpy(pRecord, &(pSlot->record), sizeof(MqttLogRecord));
+		if(mqtt_atomic_load_u32(&(pSlot->sequence)) == sequence) {
+			isRead = true;
+		} else {
+			dropped++;
+		}
+		mqtt_log_tail++;
+	}
+
+	if(NULL != pDropped) {
+		*pDropped = dropped;
+	}
+	return isRead;
+}
+
+uint32_t mqtt_log_drain(uint32_t maxRecords) {
+	MqttLogRecord record;
+	uint32_t dropped, count = 0;
+	uint8_t level;
+
+	while(count < maxRecords) {
+		if(!mqtt_log_read(&record, &dropped)) {
+			if(0 != dropped) {
+				mico_rtos_lock_mutex(&stdio_tx_mutex);
+				printf("LOG: %u records dropped\r\n", (unsigned int) dropped);
+				mico_rtos_unlock_mutex(&stdio_tx_mutex);
+			}
+			break;
+		}
+
+		level = (record.level <= MQTT_LOG_LEVEL_ERROR) ? record.level : MQTT_LOG_LEVEL_ERROR;
+		mico_rtos_lock_mutex(&stdio_tx_mutex);
+		if(0 != dropped) {
+			printf("LOG: %u records dropped\r\n", (unsigned int) dropped);
+		}
+		printf("%u %s: %s L#%u ", (unsigned int) record.timeMs, mqtt_log_level_names[level], record.pFunction,
+			   (unsigned int) record.line);
+		/* Every argument is passed, the format consumes the ones it names */
+		printf(record.pFormat, record.args[0], record.args[1], record.args[2], record.args[3]);
+		printf("\r\n");
+		mico_rtos_unlock_mutex(&stdio_tx_mutex);
+		count++;
+	}
+
+	return count;
+}
+
+static void _mqtt_log_drain_thread(mico_thread_arg_t arg) {
+	IOT_UNUSED(arg);
+
+	for(;;) {
+		if(0 == mqtt_log_drain(MQTT_LOG_RING_LEN)) {
+			mico_rtos_thread_msleep(MQTT_LOG_DRAIN_INTERVAL_MS);
+		}
+	}
+}
+
+OSStatus mqtt_log_start_drain(void) {
+	return mico_rtos_create_thread(NULL, MQTT_LOG_DRAIN_PRIORITY, "mqtt log", _mqtt_log_drain_thread,
+								   MQTT_LOG_DRAIN_STACK_SIZE, 0);
+}
+
+#endif /* _ENABLE_BINARY_LOG_ */
+
+#ifdef __cplusplus
+}
+#endif
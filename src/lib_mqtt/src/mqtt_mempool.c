@@ -0,0 +1,128 @@
+/**
+ * @file mqtt_mempool.c
+ * @brief Fixed-block memory pool and per-message arena implementation.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+#include "mqtt_atomic.h"
+#include "mqtt_mempool.h"
+
+#define MEM_POOL_INDEX_MASK 0x0000FFFFu
+#define MEM_POOL_TAG_STEP 0x00010000u
+
+static volatile uint32_t *_mem_pool_link(MemBlockPool *pPool, uint32_t index) {
+	return (volatile uint32_t *) (pPool->pBase + (size_t) index * pPool->blockSize);
+}
+
+static void _mem_pool_note_alloc(MemBlockPool *pPool) {
+	uint32_t inUse = mqtt_atomic_fetch_add_u32(&(pPool->inUse), 1) + 1;
+	uint32_t peak = mqtt_atomic_load_u32(&(pPool->peakInUse));
+
+	while(inUse > peak && !mqtt_atomic_compare_exchange_u32(&(pPool->peakInUse), &peak, inUse)) {
+	}
+}
+
+void mem_pool_init(MemBlockPool *pPool, void *pStorage, size_t blockSize, uint32_t blockCount) {
+	pPool->pBase = (unsigned char *) pStorage;
+	pPool->blockSize = MEM_POOL_ALIGN(blockSize);
+	pPool->blockCount = (blockCount > MEM_POOL_INDEX_MASK) ? MEM_POOL_INDEX_MASK : blockCount;
+	pPool->freeHead = 0;
+	pPool->nextFresh = 0;
+	pPool->inUse = 0;
+	pPool->peakInUse = 0;
+}
+
+void *mem_pool_alloc(MemBlockPool *pPool) {
+	uint32_t head, next, fresh;
+
+	head = mqtt_atomic_load_u32(&(pPool->freeHead));
+	while(0 != (head & MEM_POOL_INDEX_MASK)) {
+		/* The link may be overwritten by a task that just took this block,
+		 * the tag in head then has moved on and the swap fails */
+		next = *_mem_pool_link(pPool, (head & MEM_POOL_INDEX_MASK) - 1);
+		if(mqtt_atomic_compare_exchange_u32(&(pPool->freeHead), &head,
+											((head + MEM_POOL_TAG_STEP) & ~MEM_POOL_INDEX_MASK) | next)) {
+			_mem_pool_note_alloc(pPool);
+			return (void *) _mem_pool_link(pPool, (head & MEM_POOL_INDEX_MASK) - 1);
+		}
+	}
+
+	/* Free list empty, hand out a block that was never used */
+	fresh = mqtt_atomic_load_u32(&(pPool->nextFresh));
+	do {
+		if(fresh >= pPool->blockCount) {
+			return NULL;
+		}
+	} while(!mqtt_atomic_compare_exchange_u32(&(pPool->nextFresh), &fresh, fresh + 1));
+
+	_mem_pool_note_alloc(pPool);
+	return (void *) _mem_pool_link(pPool, fresh);
+}
+
+void mem_pool_free(MemBlockPool *pPool, void *pBlock) {
+	uint32_t index, head;
+
+	if(NULL == pBlock) {
+		return;
+	}
+
+	index = (uint32_t) (((unsigned char *) pBlock - pPool->pBase) / pPool->blockSize);
+	head = mqtt_atomic_load_u32(&(pPool->freeHead));
+	do {
+		*_mem_pool_link(pPool, index) = head & MEM_POOL_INDEX_MASK;
+	} while(!mqtt_atomic_compare_exchange_u32(&(pPool->freeHead), &head,
+											  ((head + MEM_POOL_TAG_STEP) & ~MEM_POOL_INDEX_MASK) | (index + 1)));
+
+	(void) mqtt_atomic_fetch_add_u32(&(pPool->inUse), (uint32_t) -1);
+}
+
+void mem_arena_init(MemArena *pArena, void *pStorage, size_t size) {
+	pArena->pBase = (unsigned char *) pStorage;
+	pArena->size = size;
+	pArena->used = 0;
+	pArena->peakUsed = 0;
+}
+
+void *mem_arena_alloc(MemArena *pArena, size_t len) {
+	size_t start = MEM_POOL_ALIGN(pArena->used);
+
+	if(start > pArena->size || len > pArena->size - start) {
+		return NULL;
+	}
+
+	pArena->used = start + len;
+	if(pArena->used > pArena->peakUsed) {
+		pArena->peakUsed = pArena->used;
+	}
+	return pArena->pBase + start;
+}
+
+void mem_arena_reset(MemArena *pArena) {
+	pArena->used = 0;
+}
+
+#ifdef _ENABLE_STATIC_MEMPOOL_
+static void *mqtt_mempool_storage[MEM_POOL_STORAGE_WORDS(MQTT_MEMPOOL_BLOCK_SIZE, MQTT_MEMPOOL_BLOCK_COUNT)];
+static MemBlockPool mqtt_mempool = MEM_POOL_INITIALIZER(mqtt_mempool_storage, MQTT_MEMPOOL_BLOCK_SIZE,
+														MQTT_MEMPOOL_BLOCK_COUNT);
+
+void *mqtt_mempool_alloc(size_t size) {
+	if(size > MQTT_MEMPOOL_BLOCK_SIZE) {
+		return NULL;
+	}
+	return mem_pool_alloc(&mqtt_mempool);
+}
+
+void mqtt_mempool_free(void *pBlock) {
+	mem_pool_free(&mqtt_mempool, pBlock);
+}
+#endif
+
+#ifdef __cplusplus
+}
+#endif
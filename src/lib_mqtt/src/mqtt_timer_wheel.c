@@ -0,0 +1,237 @@
+/**
+ * @file mqtt_timer_wheel.c
+ * @brief Hierarchical timer wheel implementation.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <string.h>
+
+#include "mqtt_timer_wheel.h"
+
+#define TIMER_WHEEL_LEVEL_SHIFT(level) ((level) * TIMER_WHEEL_LEVEL_BITS)
+#define TIMER_WHEEL_LEVEL_SPAN(level) ((uint32_t) 1 << TIMER_WHEEL_LEVEL_SHIFT((level) + 1))
+#define TIMER_WHEEL_MAX_SPAN (TIMER_WHEEL_LEVEL_SPAN(TIMER_WHEEL_LEVELS - 1) - 1)
+
+static void _timer_wheel_link(TimerWheelEntry **ppHead, TimerWheelEntry *pEntry) {
+	pEntry->pNext = *ppHead;
+	if(NULL != pEntry->pNext) {
+		pEntry->pNext->ppPrevNext = &(pEntry->pNext);
+	}
+	pEntry->ppPrevNext = ppHead;
+	*ppHead = pEntry;
+}
+
+static void _timer_wheel_unlink(TimerWheelEntry *pEntry) {
+	*(pEntry->ppPrevNext) = pEntry->pNext;
+	if(NULL != pEntry->pNext) {
+		pEntry->pNext->ppPrevNext = pEntry->ppPrevNext;
+	}
+	pEntry->pNext = NULL;
+	pEntry->ppPrevNext = NULL;
+}
+
+/* Places an entry in the slot matching its expiry, relative to the current tick */
+static void _timer_wheel_insert(TimerWheel *pWheel, TimerWheelEntry *pEntry) {
+	int32_t delta = (int32_t) (pEntry->expiryTick - pWheel->currentTick);
+	uint32_t placementTick = pEntry->expiryTick;
+	uint32_t level;
+
+	if(delta < 0) {
+		/* Already due, fire on the next processed tick */
+		delta = 0;
+		placementTick = pWheel->currentTick;
+	} else if((uint32_t) delta > TIMER_WHEEL_MAX_SPAN) {
+		/* Beyond the wheel, park it in the last level and re-cascade later */
+		delta = TIMER_WHEEL_MAX_SPAN;
+		placementTick = pWheel->currentTick + TIMER_WHEEL_MAX_SPAN;
+	}
+
+	for(level = 0; level < TIMER_WHEEL_LEVELS - 1; level++) {
+		if((uint32_t) delta < TIMER_WHEEL_LEVEL_SPAN(level)) {
+			break;
+		}
+	}
+
+	_timer_wheel_link(&(pWheel->slots[level][(placementTick >> TIMER_WHEEL_LEVEL_SHIFT(level))
+											 & TIMER_WHEEL_LEVEL_MASK]), pEntry);
+	pEntry->level = (uint8_t) level;
+	if(0 == level) {
+		pWheel->level0Count++;
+	}
+}
+
+/* Moves all entries of a higher level slot down to where they now belong */
+static void _timer_wheel_cascade(TimerWheel *pWheel, uint32_t level, uint32_t index) {
+	TimerWheelEntry *pEntry = pWheel->slots[level][index];
+	TimerWheelEntry *pNext;
+
+	pWheel->slots[level][index] = NULL;
+	while(NULL != pEntry) {
+		pNext = pEntry->pNext;
+		pEntry->pNext = NULL;
+		_timer_wheel_insert(pWheel, pEntry);
+		pEntry = pNext;
+	}
+}
+
+void timer_wheel_init(TimerWheel *pWheel, uint32_t now_ms) {
+	memset(pWheel, 0, sizeof(TimerWheel));
+	pWheel->currentTickMs = now_ms;
+}
+
+void timer_wheel_entry_init(TimerWheelEntry *pEntry, TimerWheelCallback callback, void *pData) {
+	pEntry->pNext = NULL;
+	pEntry->ppPrevNext = NULL;
+	pEntry->expiryTick = 0;
+	pEntry->level = 0;
+	pEntry->callback = callback;
+	pEntry->pData = pData;
+}
+
+bool timer_wheel_is_scheduled(TimerWheelEntry *pEntry) {
+	return NULL != pEntry->ppPrevNext;
+}
+
+void timer_wheel_cancel(TimerWheel *pWheel, TimerWheelEntry *pEntry) {
+	if(!timer_wheel_is_scheduled(pEntry)) {
+		return;
+	}
+
+	if(0 == pEntry->level) {
+		pWheel->level0Count--;
+	}
+	_timer_wheel_unlink(pEntry);
+	pWheel->scheduledCount--;
+}
+
+void timer_wheel_schedule(TimerWheel *pWheel, TimerWheelEntry *pEntry, uint32_t now_ms, uint32_t delay_ms) {
+	int32_t dueOffset;
+
+	timer_wheel_cancel(pWheel, pEntry);
+
+	/* Smallest tick that is processed at or after now + delay */
+	dueOffset = (int32_t) (now_ms + delay_ms - pWheel->currentTickMs);
+	if(dueOffset <= 0) {
+		pEntry->expiryTick = pWheel->currentTick;
+	} else {
+		pEntry->expiryTick = pWheel->currentTick
+							 + (((uint32_t) dueOffset + MQTT_TIMER_WHEEL_TICK_MS - 1) / MQTT_TIMER_WHEEL_TICK_MS);
+	}
+
+	_timer_wheel_insert(pWheel, pEntry);
+	pWheel->scheduledCount++;
+}
+
+void timer_wheel_advance(TimerWheel *pWheel, uint32_t now_ms) {
+	uint32_t index, level, skipTicks, boundaryTicks;
+	TimerWheelEntry *pEntry;
+	TimerWheelEntry *pNext;
+
+	while((int32_t) (now_ms - pWheel->currentTickMs) >= 0) {
+		if(0 == pWheel->scheduledCount) {
+			/* Nothing to expire, catch up in one step */
+			skipTicks = ((now_ms - pWheel->currentTickMs) / MQTT_TIMER_WHEEL_TICK_MS) + 1;
+			pWheel->currentTick += skipTicks;
+			pWheel->currentTickMs += skipTicks * MQTT_TIMER_WHEEL_TICK_MS;
+			break;
+		}
+
+		/* Cascade higher levels on their boundaries */
+		for(level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+			if(0 != (pWheel->currentTick & ((1u << TIMER_WHEEL_LEVEL_SHIFT(level)) - 1))) {
+				break;
+			}
+			_timer_wheel_cascade(pWheel, level,
+								 (pWheel->currentTick >> TIMER_WHEEL_LEVEL_SHIFT(level)) & TIMER_WHEEL_LEVEL_MASK);
+		}
+
+		index = pWheel->currentTick & TIMER_WHEEL_LEVEL_MASK;
+		pEntry = pWheel->slots[0][index];
+		pWheel->slots[0][index] = NULL;
+
+		/* Advance before running callbacks so a zero delay reschedule lands on the next tick */
+		pWheel->currentTick++;
+		pWheel->currentTickMs += MQTT_TIMER_WHEEL_TICK_MS;
+
+		while(NULL != pEntry) {
+			pNext = pEntry->pNext;
+			pEntry->pNext = NULL;
+			pEntry->ppPrevNext = NULL;
+			pWheel->level0Count--;
+			pWheel->scheduledCount--;
+			if(NULL != pEntry->callback) {
+				pEntry->callback(pEntry, pEntry->pData);
+			}
+			pEntry = pNext;
+		}
+
+		/* Skip empty level 0 runs that are already due, up to the next cascade boundary */
+		if(0 == pWheel->level0Count && 0 != (pWheel->currentTick & TIMER_WHEEL_LEVEL_MASK)
+		   && (int32_t) (now_ms - pWheel->currentTickMs) >= 0) {
+			skipTicks = ((now_ms - pWheel->currentTickMs) / MQTT_TIMER_WHEEL_TICK_MS) + 1;
+			boundaryTicks = TIMER_WHEEL_LEVEL_SLOTS - (pWheel->currentTick & TIMER_WHEEL_LEVEL_MASK);
+			if(skipTicks > boundaryTicks) {
+				skipTicks = boundaryTicks;
+			}
+			pWheel->currentTick += skipTicks;
+			pWheel->currentTickMs += skipTicks * MQTT_TIMER_WHEEL_TICK_MS;
+		}
+	}
+}
+
+uint32_t timer_wheel_next_deadline_ms(TimerWheel *pWheel, uint32_t now_ms) {
+	uint32_t level, slot, offset, block;
+	uint32_t earliestTick = 0;
+	bool isFound = false;
+	int32_t dueMs;
+	TimerWheelEntry *pEntry;
+
+	if(0 == pWheel->scheduledCount) {
+		return TIMER_WHEEL_NO_DEADLINE;
+	}
+
+	/* Level 0 slots hold exactly one tick, the first non-empty one going forward is the earliest there */
+	for(offset = 0; offset < TIMER_WHEEL_LEVEL_SLOTS && 0 != pWheel->level0Count; offset++) {
+		slot = (pWheel->currentTick + offset) & TIMER_WHEEL_LEVEL_MASK;
+		if(NULL != pWheel->slots[0][slot]) {
+			earliestTick = pWheel->currentTick + offset;
+			isFound = true;
+			break;
+		}
+	}
+
+	for(level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+		for(slot = 0; slot < TIMER_WHEEL_LEVEL_SLOTS; slot++) {
+			/* With a level 0 candidate only the current (not yet cascaded) and next block
+			 * of each level can hold an earlier entry */
+			block = pWheel->currentTick >> TIMER_WHEEL_LEVEL_SHIFT(level);
+			if(isFound && 0 != pWheel->level0Count && slot != (block & TIMER_WHEEL_LEVEL_MASK)
+			   && slot != ((block + 1) & TIMER_WHEEL_LEVEL_MASK)) {
+				continue;
+			}
+			for(pEntry = pWheel->slots[level][slot]; NULL != pEntry; pEntry = pEntry->pNext) {
+				if(!isFound || (int32_t) (pEntry->expiryTick - earliestTick) < 0) {
+					earliestTick = pEntry->expiryTick;
+					isFound = true;
+				}
+			}
+		}
+	}
+
+	if((int32_t) (earliestTick - pWheel->currentTick) < 0) {
+		earliestTick = pWheel->currentTick;
+	}
+
+	dueMs = (int32_t) (pWheel->currentTickMs + ((earliestTick - pWheel->currentTick) * MQTT_TIMER_WHEEL_TICK_MS)
+					   - now_ms);
+
+	return (dueMs > 0) ? (uint32_t) dueMs : 0;
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,179 @@
+/**
+ * @file mqtt_trace.c
+ * @brief Trace ring behind FUNC_ENTRY/FUNC_EXIT_RC.
+ *
+ * Writers claim a slot with an atomic increment and publish it by storing its sequence
+ * number last, as the binary log ring does. The ring is read as a whole with recording
+ * paused. A writer that got past the pause check just before the pause may still be
+ * filling its slot, or refilling the oldest one, while it is read: the reader checks the
+ * sequence number before and after copying an event and skips it unless both match.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "mqtt_log.h"
+
+#ifdef _ENABLE_FUNC_TRACE_
+
+#include "mqtt_atomic.h"
+#include "timer_interface.h"
+
+#if (MQTT_TRACE_RING_LEN & (MQTT_TRACE_RING_LEN - 1)) != 0
+#error "MQTT_TRACE_RING_LEN must be a power of two"
+#endif
+
+#ifndef MQTT_TRACE_TASK_ID
+#if defined(__linux__)
+#include <pthread.h>
+#define MQTT_TRACE_TASK_ID() ((uint32_t) (uintptr_t) pthread_self())
+#else
+#define MQTT_TRACE_TASK_ID() ((uint32_t) (uintptr_t) mico_rtos_get_current_thread())
+#endif
+#endif
+
+/* Step of timer_now_us(), printed with each dump so the converter can warn about it */
+#if defined(__linux__) || defined(MQTT_TIMER_US_SOURCE)
+#define MQTT_TRACE_RESOLUTION_US	(1)
+#else
+#define MQTT_TRACE_RESOLUTION_US	(1000)
+#endif
+
+typedef struct {
+	volatile uint32_t sequence;	///< Claim index + 1 once the event is complete, 0 while it is written
+	MqttTraceEvent event;
+} MqttTraceSlot;
+
+static MqttTraceSlot mqtt_trace_ring[MQTT_TRACE_RING_LEN];
+static volatile uint32_t mqtt_trace_head;	///< Next claim index
+static uint32_t mqtt_trace_first;	///< Claim index of the first event since the ring was last emptied
+static volatile uint32_t mqtt_trace_paused;
+
+void mqtt_trace_event(uint8_t phase, const char *pName, int32_t value) {
+	uint32_t index;
+	MqttTraceSlot *pSlot;
+
+	if(0 != mqtt_atomic_load_u32(&mqtt_trace_paused)) {
+		return;
+	}
+
+	index = mqtt_atomic_fetch_add_u32(&mqtt_trace_head, 1);
+	pSlot = &mqtt_trace_ring[index & (MQTT_TRACE_RING_LEN - 1)];
+	mqtt_atomic_store_u32(&(pSlot->sequence), 0);
+	pSlot->event.timeUs = timer_now_us();
+	pSlot->event.task = MQTT_TRACE_TASK_ID();
+	pSlot->event.pName = pName;
+	pSlot->event.value = value;
+	pSlot->event.phase = phase;
+	mqtt_atomic_store_u32(&(pSlot->sequence), index + 1);
+}
+
+/**
+ * @brief Copy one event out of the ring
+ *
+ * @param index Claim index of the event
+ * @param pEvent Receives the event
+ *
+ * @return true if the event was complete and not touched while it was copied
+ */
+static bool _mqtt_trace_read(uint32_t index, MqttTraceEvent *pEvent) {
+	MqttTraceSlot *pSlot = &mqtt_trace_ring[index & (MQTT_TRACE_RING_LEN - 1)];
+
+	if(mqtt_atomic_load_u32(&(pSlot->sequence)) != index + 1) {
+		return false;
+	}
+	*pEvent = pSlot->event;
+	return mqtt_atomic_load_u32(&(pSlot->sequence)) == index + 1;
+}
+
+/**
+ * @brief Pause recording and find the events in the ring
+ *
+ * @param pFirst Receives the claim index of the oldest event
+ * @param pDropped Receives the events overwritten since the ring was last emptied, may be NULL
+ *
+ * @return number of events in the ring
+ */
+static uint32_t _mqtt_trace_pause(uint32_t *pFirst, uint32_t *pDropped) {
+	uint32_t head, count;
+
+	mqtt_atomic_store_u32(&mqtt_trace_paused, 1);
+	head = mqtt_atomic_load_u32(&mqtt_trace_head);
+	count = head - mqtt_trace_first;
+	if(count > MQTT_TRACE_RING_LEN) {
+		count = MQTT_TRACE_RING_LEN;
+	}
+	*pFirst = head - count;
+	if(NULL != pDropped) {
+		*pDropped = head - mqtt_trace_first - count;
+	}
+
+	return count;
+}
+
+uint32_t mqtt_trace_snapshot(MqttTraceEvent *pEvents, uint32_t maxEvents) {
+	uint32_t first, count, itr, copied = 0;
+
+	if(NULL == pEvents) {
+		return 0;
+	}
+
+	count = _mqtt_trace_pause(&first, NULL);
+	if(count > maxEvents) {
+		/* Keep the newest */
+		first += count - maxEvents;
+		count = maxEvents;
+	}
+	for(itr = 0; itr < count; itr++) {
+		if(_mqtt_trace_read(first + itr, &pEvents[copied])) {
+			copied++;
+		}
+	}
+	mqtt_atomic_store_u32(&mqtt_trace_paused, 0);
+
+	return copied;
+}
+
+void mqtt_trace_dump(void) {
+	MqttTraceEvent event;
+	uint32_t first, count, dropped, itr, incomplete = 0;
+
+	count = _mqtt_trace_pause(&first, &dropped);
+	for(itr = 0; itr < count; itr++) {
+		if(!_mqtt_trace_read(first + itr, &event)) {
+			incomplete++;
+		}
+	}
+	/* Events still being written are reported as lost */
+	count -= incomplete;
+	dropped += incomplete;
+
+	mico_rtos_lock_mutex(&stdio_tx_mutex);
+	printf("TRACE_BEGIN %u %u %u\r\n", (unsigned int) count, (unsigned int) dropped,
+		   (unsigned int) MQTT_TRACE_RESOLUTION_US);
+	mico_rtos_unlock_mutex(&stdio_tx_mutex);
+	for(itr = 0; itr < count + incomplete; itr++) {
+		if(!_mqtt_trace_read(first + itr, &event)) {
+			continue;
+		}
+		/* One line per event so other output may interleave between them */
+		mico_rtos_lock_mutex(&stdio_tx_mutex);
+		printf("T %u %x %c %s %d\r\n", (unsigned int) event.timeUs, (unsigned int) event.task,
+			   (char) event.phase, event.pName, (int) event.value);
+		mico_rtos_unlock_mutex(&stdio_tx_mutex);
+	}
+	mico_rtos_lock_mutex(&stdio_tx_mutex);
+	printf("TRACE_END\r\n");
+	mico_rtos_unlock_mutex(&stdio_tx_mutex);
+
+	/* Empty the ring without resetting the claim index, a sequence number never matches an earlier lap */
+	mqtt_trace_first = first + count + incomplete;
+	mqtt_atomic_store_u32(&mqtt_trace_paused, 0);
+}
+
+#endif /* _ENABLE_FUNC_TRACE_ */
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,90 @@
+/**
+ * @file mqtt_tx_queue.c
+ * @brief Lock-free outbound packet queue and buffer pool implementation.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+#include "mqtt_atomic.h"
+#include "mqtt_tx_queue.h"
+
+void tx_queue_init(TxQueue *pQueue) {
+	pQueue->stub.pNext = NULL;
+	pQueue->pHead = &(pQueue->stub);
+	pQueue->pTail = &(pQueue->stub);
+}
+
+void tx_queue_push(TxQueue *pQueue, TxQueueNode *pNode) {
+	TxQueueNode *pPrev;
+
+	pNode->pNext = NULL;
+	pPrev = (TxQueueNode *) mqtt_atomic_exchange_ptr((void *volatile *) &(pQueue->pHead), pNode);
+	/* Until this store the consumer sees the queue end at pPrev */
+	mqtt_atomic_store_ptr((void *volatile *) &(pPrev->pNext), pNode);
+}
+
+TxQueueNode *tx_queue_pop(TxQueue *pQueue) {
+	TxQueueNode *pTail = pQueue->pTail;
+	TxQueueNode *pNext = (TxQueueNode *) mqtt_atomic_load_ptr((void *volatile *) &(pTail->pNext));
+
+	if(&(pQueue->stub) == pTail) {
+		if(NULL == pNext) {
+			return NULL;
+		}
+		pQueue->pTail = pNext;
+		pTail = pNext;
+		pNext = (TxQueueNode *) mqtt_atomic_load_ptr((void *volatile *) &(pTail->pNext));
+	}
+
+	if(NULL != pNext) {
+		pQueue->pTail = pNext;
+		return pTail;
+	}
+
+	if(pTail != mqtt_atomic_load_ptr((void *volatile *) &(pQueue->pHead))) {
+		/* A producer has swapped the head but not linked it yet */
+		return NULL;
+	}
+
+	/* pTail is the last node, put the stub behind it so it can be handed out */
+	tx_queue_push(pQueue, &(pQueue->stub));
+	pNext = (TxQueueNode *) mqtt_atomic_load_ptr((void *volatile *) &(pTail->pNext));
+	if(NULL != pNext) {
+		pQueue->pTail = pNext;
+		return pTail;
+	}
+
+	return NULL;
+}
+
+void tx_pool_init(TxBufferPool *pPool) {
+	pPool->freeMask = (uint32_t) 0xFFFFFFFF >> (32 - MQTT_TX_POOL_COUNT);
+}
+
+TxBuffer *tx_pool_alloc(TxBufferPool *pPool) {
+	uint32_t mask, index;
+
+	do {
+		mask = mqtt_atomic_load_u32(&(pPool->freeMask));
+		if(0 == mask) {
+			return NULL;
+		}
+		index = (uint32_t) __builtin_ctz(mask);
+	} while(!mqtt_atomic_cas_u32(&(pPool->freeMask), mask, mask & ~((uint32_t) 1 << index)));
+
+	return &(pPool->buffers[index]);
+}
+
+void tx_pool_free(TxBufferPool *pPool, TxBuffer *pBuffer) {
+	uint32_t index = (uint32_t) (pBuffer - pPool->buffers);
+
+	(void) mqtt_atomic_fetch_or_u32(&(pPool->freeMask), (uint32_t) 1 << index);
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,127 @@
+#!/usr/bin/env python3
+"""Convert an mqtt_trace_dump() capture into Chrome/Perfetto trace JSON.
+
+Feed it the console log of a board or of the Linux port, other output around and
+between the trace lines is skipped:
+
+    TRACE_BEGIN <count> <dropped> [<resolution us>]
+    T <time us> <task hex> <B|E> <name> <value>
+    TRACE_END
+
+Open the result in chrome://tracing or https://ui.perfetto.dev. Each task becomes a
+track, FUNC_EXIT_RC return codes and MQTT_TRACE_END values show up as "rc" of the
+slice. Functions left through a plain return have no end event, they are shown as zero
+length slices once their caller ends. Several dumps in one log are laid out one after the other.
+"""
+
+import argparse
+import json
+import re
+import sys
+
+EVENT_RE = re.compile(r'\bT (\d+) ([0-9a-fA-F]+) ([BE]) (.+) (-?\d+)\s*$')
+BEGIN_RE = re.compile(r'\bTRACE_BEGIN (\d+) (\d+)(?: (\d+))?')
+END_RE = re.compile(r'\bTRACE_END\b')
+
+US_WRAP = 1 << 32
+
+
+def parse_dumps(lines):
+    """Yield (dropped, [(time_us, task, phase, name, value), ...]) per dump."""
+    events = None
+    dropped = 0
+    for line in lines:
+        match = BEGIN_RE.search(line)
+        if match:
+            events = []
+            dropped = int(match.group(2))
+            resolution = int(match.group(3) or 1)
+            if resolution > 1:
+                sys.stderr.write('timestamps step %d us, shorter spans show as 0 '
+                                 '(define MQTT_TIMER_US_SOURCE)\n' % resolution)
+            continue
+        if events is None:
+            continue
+        if END_RE.search(line):
+            yield dropped, events
+            events = None
+            continue
+        match = EVENT_RE.search(line)
+        if match:
+            events.append((int(match.group(1)), int(match.group(2), 16), match.group(3),
+                           match.group(4), int(match.group(5))))
+    if events:
+        # Capture cut off before TRACE_END
+        yield dropped, events
+
+
+def convert(dumps, pid):
+    """Turn parsed dumps into a list of balanced Chrome trace events."""
+    trace = []
+    offset = 0
+    for index, (dropped, events) in enumerate(dumps):
+        if dropped:
+            sys.stderr.write('dump %d: %d events lost to ring overwrite\n' % (index, dropped))
+        slices = []
+        # Zero length ends for begins never ended, keyed by the position of the begin
+        closures = {}
+        stacks = {}
+        last = None
+        base = None
+        ts = 0
+        for time_us, task, phase, name, value in events:
+            # Unwrap the 32-bit microsecond clock
+            if last is not None and time_us < last and last - time_us > US_WRAP // 2:
+                base += US_WRAP
+            if base is None:
+                base = -time_us
+            last = time_us
+            ts = offset + base + time_us
+            stack = stacks.setdefault(task, [])
+            if phase == 'B':
+                stack.append((name, len(slices)))
+                slices.append({'name': name, 'ph': 'B', 'ts': ts, 'pid': pid, 'tid': task})
+                continue
+            if name not in [open_name for open_name, _ in stack]:
+                # Its begin was overwritten before the dump
+                continue
+            while stack:
+                open_name, position = stack.pop()
+                if open_name == name:
+                    slices.append({'name': name, 'ph': 'E', 'ts': ts, 'pid': pid, 'tid': task,
+                                   'args': {'rc': value}})
+                    break
+                # Left through a plain return, it ended before whatever began after it
+                begin = slices[position]
+                closures[position] = {'name': open_name, 'ph': 'E', 'ts': begin['ts'], 'pid': pid,
+                                      'tid': task}
+        for position, event in enumerate(slices):
+            trace.append(event)
+            if position in closures:
+                trace.append(closures[position])
+        # Still running when the ring was dumped
+        for task, stack in stacks.items():
+            while stack:
+                trace.append({'name': stack.pop()[0], 'ph': 'E', 'ts': ts, 'pid': pid, 'tid': task})
+        # Leave a gap of 1 ms before the next dump
+        offset = ts + 1000
+    return trace
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('log', nargs='?', type=argparse.FileType('r', errors='replace'),
+                        default=sys.stdin, help='console capture, stdin if omitted')
+    parser.add_argument('-o', '--output', type=argparse.FileType('w'), default=sys.stdout,
+                        help='trace JSON, stdout if omitted')
+    parser.add_argument('--pid', type=int, default=1, help='process id shown for the device')
+    args = parser.parse_args()
+
+    trace = convert(parse_dumps(args.log), args.pid)
+    json.dump({'traceEvents': trace, 'displayTimeUnit': 'ms'}, args.output)
+    args.output.write('\n')
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
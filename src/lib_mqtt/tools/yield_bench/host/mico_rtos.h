@@ -0,0 +1,47 @@
+/**
+ * @file mico_rtos.h
+ * @brief Host stand-in for the MiCO RTOS header, just enough for tools/yield_bench.
+ *
+ * The benchmark builds the library without thread support, nothing here is called.
+ */
+
+#ifndef YIELD_BENCH_MICO_RTOS_H_
+#define YIELD_BENCH_MICO_RTOS_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+typedef int OSStatus;
+#define kNoErr          0
+#define kGeneralErr     -1
+#define kInProgressErr  -6753
+
+typedef void *mico_mutex_t;
+typedef void *mico_semaphore_t;
+typedef void *mico_thread_t;
+typedef uint32_t mico_thread_arg_t;
+typedef void (*mico_thread_function_t)(mico_thread_arg_t);
+
+#define MICO_WAIT_FOREVER           0xFFFFFFFF
+#define MICO_APPLICATION_PRIORITY   7
+
+typedef struct {
+	int free_memory;
+	int allocted_memory;
+	int total_memory;
+	int num_of_chunks;
+} micoMemInfo_t;
+
+OSStatus mico_rtos_lock_mutex(mico_mutex_t *pMutex);
+OSStatus mico_rtos_unlock_mutex(mico_mutex_t *pMutex);
+OSStatus mico_rtos_create_thread(mico_thread_t *pThread, uint8_t priority, const char *pName,
+								 mico_thread_function_t function, uint32_t stackSize, mico_thread_arg_t arg);
+mico_thread_t mico_rtos_get_current_thread(void);
+void mico_rtos_thread_msleep(uint32_t ms);
+uint32_t mico_rtos_get_time(void);
+micoMemInfo_t *MicoGetMemoryInfo(void);
+
+extern mico_mutex_t stdio_tx_mutex;
+
+#endif /* YIELD_BENCH_MICO_RTOS_H_ */
@@ -0,0 +1,13 @@
+/**
+ * @file mico_socket.h
+ * @brief Host stand-in for the MiCO socket header, just enough for tools/yield_bench.
+ */
+
+#ifndef YIELD_BENCH_MICO_SOCKET_H_
+#define YIELD_BENCH_MICO_SOCKET_H_
+
+#include "mico_rtos.h"
+
+typedef void *mico_ssl_t;
+
+#endif /* YIELD_BENCH_MICO_SOCKET_H_ */
@@ -0,0 +1,11 @@
+/**
+ * @file mico_wlan.h
+ * @brief Host stand-in for the MiCO WLAN header, just enough for tools/yield_bench.
+ */
+
+#ifndef YIELD_BENCH_MICO_WLAN_H_
+#define YIELD_BENCH_MICO_WLAN_H_
+
+#include "mico_rtos.h"
+
+#endif /* YIELD_BENCH_MICO_WLAN_H_ */
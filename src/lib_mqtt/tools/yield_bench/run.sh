@@ -0,0 +1,69 @@
+#!/bin/sh
+#
+# Build yield_bench against several revisions of lib_mqtt and compare them.
+#
+# usage: run.sh [-c "clients ..."] [-p packets] [-r rounds] [rev ...]
+#
+# rev is any git revision, or "tree" for the checked out files (the default).
+# Every revision is built with the same yield_bench.c and host headers from this
+# directory, so only the library differs. Results are the best of 7 runs.
+
+set -e
+
+BENCH_DIR=$(cd "$(dirname "$0")" && pwd)
+LIB_DIR=$(cd "$BENCH_DIR/../.." && pwd)
+REPO_DIR=$(git -C "$LIB_DIR" rev-parse --show-toplevel)
+LIB_PATH=${LIB_DIR#$REPO_DIR/}
+CC=${CC:-gcc}
+CFLAGS=${CFLAGS:--O2}
+
+CLIENTS="1 64 1024 4096"
+PACKETS=1
+ROUNDS=0
+while getopts c:p:r: opt; do
+	case $opt in
+		c) CLIENTS=$OPTARG ;;
+		p) PACKETS=$OPTARG ;;
+		r) ROUNDS=$OPTARG ;;
+		*) exit 2 ;;
+	esac
+done
+shift $((OPTIND - 1))
+[ $# -gt 0 ] || set -- tree
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+for rev in "$@"; do
+	src="$WORK/$rev/lib"
+	mkdir -p "$src"
+	if [ "$rev" = tree ]; then
+		cp -r "$LIB_DIR/include" "$LIB_DIR/src" "$LIB_DIR/platform" "$LIB_DIR/user_config" "$src"
+	else
+		git -C "$REPO_DIR" archive "$rev" "$LIB_PATH" | tar -x -C "$WORK/$rev"
+		mv "$WORK/$rev/$LIB_PATH"/* "$src"
+	fi
+	$CC -std=gnu99 $CFLAGS -I"$BENCH_DIR/host" -I"$src/include" -I"$src/platform" \
+		"$BENCH_DIR/yield_bench.c" "$src"/src/*.c -o "$WORK/$rev/yield_bench"
+done
+
+for n in $CLIENTS; do
+	# Same number of messages for every client count, at least 100 rounds
+	rounds=$ROUNDS
+	[ "$rounds" -gt 0 ] || rounds=$((200000 / (n * PACKETS)))
+	[ "$rounds" -ge 100 ] || rounds=100
+	for rev in "$@"; do
+		best=
+		i=0
+		while [ $i -lt 7 ]; do
+			line=$("$WORK/$rev/yield_bench" "$n" "$PACKETS" "$rounds" | grep '^sizeof')
+			ns=${line##*ns/msg=}
+			if [ -z "$best" ] || awk "BEGIN { exit !($ns < $best) }"; then
+				best=$ns
+			fi
+			i=$((i + 1))
+		done
+		size=${line%% *}
+		printf '%-10s clients=%-5s %-26s ns/msg=%s\n' "$rev" "$n" "$size" "$best"
+	done
+done
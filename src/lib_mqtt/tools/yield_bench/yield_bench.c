@@ -0,0 +1,393 @@
+/**
+ * @file yield_bench.c
+ * @brief Host benchmark of the mqtt_yield receive path
+ *
+ * Drives N clients round-robin through mqtt_yield over a fake Network. Each round queues
+ * K QoS0 PUBLISH packets on every client, so one pass touches the hot data of all clients
+ * the way a gateway multiplexing many sessions on one task does. Time is virtual: the
+ * fake read advances the clock to the timer end when it has nothing queued, so yield
+ * returns as soon as the burst is drained and the wall clock only measures the library.
+ *
+ * Built by run.sh against several revisions of the library to compare MQTT_Client layouts.
+ * Timers and the Network come from this file, the platform/ directory is not linked.
+ *
+ * usage: yield_bench <clients> <packets per round> <rounds>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "mqtt_client_interface.h"
+
+#define BENCH_TOPIC          "bench/yield"
+#define BENCH_PAYLOAD_LEN    16
+#define BENCH_RX_BUF_LEN     1024
+#define BENCH_YIELD_MS       1
+#define BENCH_WARMUP_ROUNDS  16
+
+/**
+ * @brief Receive side of one fake connection
+ *
+ * Bytes the library reads next, the CONNACK/SUBACK/PINGRESP answers and the PUBLISH
+ * packets queued by the round. Indexed by TLSDataParams.server_fd.
+ */
+typedef struct {
+	unsigned char buf[BENCH_RX_BUF_LEN];
+	size_t head;
+	size_t tail;
+} FakeConn;
+
+static uint32_t bench_now_ms;
+static FakeConn *bench_conns;
+static uint32_t bench_conn_count;
+static uint32_t bench_delivered;
+
+static unsigned char bench_publish[2 + 2 + sizeof(BENCH_TOPIC) - 1 + BENCH_PAYLOAD_LEN];
+
+/* Log lock of the MiCO stdio, single task here */
+
+mico_mutex_t stdio_tx_mutex;
+
+OSStatus mico_rtos_lock_mutex(mico_mutex_t *pMutex) {
+	(void) pMutex;
+	return kNoErr;
+}
+
+OSStatus mico_rtos_unlock_mutex(mico_mutex_t *pMutex) {
+	(void) pMutex;
+	return kNoErr;
+}
+
+/* Virtual clock, replaces platform/timer_platform.c */
+
+bool has_timer_expired(Timer *timer) {
+	return (int32_t)(timer->end_time - bench_now_ms) <= 0;
+}
+
+void countdown_ms(Timer *timer, uint32_t timeout) {
+	timer->end_time = bench_now_ms + timeout;
+}
+
+void countdown_sec(Timer *timer, uint32_t timeout) {
+	countdown_ms(timer, timeout * 1000);
+}
+
+uint32_t left_ms(Timer *timer) {
+	return has_timer_expired(timer) ? 0 : timer->end_time - bench_now_ms;
+}
+
+void init_timer(Timer *timer) {
+	timer->end_time = 0;
+}
+
+uint32_t timer_now_ms(void) {
+	return bench_now_ms;
+}
+
+uint32_t timer_now_raw_ms(void) {
+	return bench_now_ms;
+}
+
+uint32_t timer_now_us(void) {
+	return bench_now_ms * 1000;
+}
+
+void timer_sleep_ms(uint32_t sleep_ms) {
+	bench_now_ms += sleep_ms;
+}
+
+void timer_begin_cached_now(void) {
+}
+
+void timer_refresh_cached_now(void) {
+}
+
+void timer_end_cached_now(void) {
+}
+
+/* Fake Network, replaces platform/network_platform.c */
+
+static void _fake_queue(FakeConn *pConn, const unsigned char *pData, size_t len) {
+	if(pConn->head == pConn->tail) {
+		pConn->head = pConn->tail = 0;
+	}
+	if(pConn->tail + len > sizeof(pConn->buf)) {
+		memmove(pConn->buf, pConn->buf + pConn->head, pConn->tail - pConn->head);
+		pConn->tail -= pConn->head;
+		pConn->head = 0;
+	}
+	if(pConn->tail + len > sizeof(pConn->buf)) {
+		fprintf(stderr, "fake connection overflow\n");
+		exit(1);
+	}
+	memcpy(pConn->buf + pConn->tail, pData, len);
+	pConn->tail += len;
+}
+
+static IoT_Error_t _fake_connect(Network *pNetwork, TLSConnectParams *params) {
+	(void) params;
+	if(pNetwork->tlsDataParams.server_fd < 0 || (uint32_t) pNetwork->tlsDataParams.server_fd >= bench_conn_count) {
+		return TCP_CONNECTION_ERROR;
+	}
+	return MQTT_SUCCESS;
+}
+
+static IoT_Error_t _fake_read(Network *pNetwork, unsigned char *pMsg, size_t len, Timer *timer, size_t *read_len) {
+	FakeConn *pConn = &bench_conns[pNetwork->tlsDataParams.server_fd];
+	size_t avail = pConn->tail - pConn->head;
+
+	if(0 == avail) {
+		/* Nothing more this round, let the virtual clock run to the deadline */
+		if(!has_timer_expired(timer)) {
+			bench_now_ms = timer->end_time;
+		}
+		*read_len = 0;
+		return NETWORK_SSL_NOTHING_TO_READ;
+	}
+	if(avail > len) {
+		avail = len;
+	}
+	memcpy(pMsg, pConn->buf + pConn->head, avail);
+	pConn->head += avail;
+	*read_len = avail;
+	return avail == len ? MQTT_SUCCESS : NETWORK_SSL_READ_TIMEOUT_ERROR;
+}
+
+/**
+ * The library writes whole packets, answer the ones the session needs:
+ * CONNECT with CONNACK, SUBSCRIBE with SUBACK and PINGREQ with PINGRESP.
+ */
+static IoT_Error_t _fake_write(Network *pNetwork, unsigned char *pMsg, size_t len, Timer *timer, size_t *written_len) {
+	FakeConn *pConn = &bench_conns[pNetwork->tlsDataParams.server_fd];
+	size_t pos = 1;
+	unsigned char ack[5];
+
+	(void) timer;
+	while(pos < len && (pMsg[pos] & 0x80)) {
+		pos++;
+	}
+	pos++;
+
+	switch(pMsg[0] & 0xF0) {
+		case 0x10:
+			ack[0] = 0x20;
+			ack[1] = 0x02;
+			ack[2] = 0x00;
+			ack[3] = 0x00;
+			_fake_queue(pConn, ack, 4);
+			break;
+		case 0x80:
+			ack[0] = 0x90;
+			ack[1] = 0x03;
+			ack[2] = pMsg[pos];
+			ack[3] = pMsg[pos + 1];
+			ack[4] = 0x00;
+			_fake_queue(pConn, ack, 5);
+			break;
+		case 0xC0:
+			ack[0] = 0xD0;
+			ack[1] = 0x00;
+			_fake_queue(pConn, ack, 2);
+			break;
+		default:
+			break;
+	}
+	*written_len = len;
+	return MQTT_SUCCESS;
+}
+
+static IoT_Error_t _fake_disconnect(Network *pNetwork) {
+	FakeConn *pConn = &bench_conns[pNetwork->tlsDataParams.server_fd];
+
+	pConn->head = pConn->tail = 0;
+	return MQTT_SUCCESS;
+}
+
+static IoT_Error_t _fake_is_connected(Network *pNetwork) {
+	(void) pNetwork;
+	return NETWORK_PHYSICAL_LAYER_CONNECTED;
+}
+
+static IoT_Error_t _fake_destroy(Network *pNetwork) {
+	(void) pNetwork;
+	return MQTT_SUCCESS;
+}
+
+IoT_Error_t iot_tls_init(Network *pNetwork, char *pRootCALocation, char *pDeviceCertLocation,
+						 char *pDevicePrivateKeyLocation, char *pDestinationURL,
+						 uint16_t DestinationPort, uint32_t timeout_ms,
+						 bool ServerVerificationFlag,
+						 bool isUseSSLFlag) {
+	(void) pRootCALocation;
+	(void) pDeviceCertLocation;
+	(void) pDevicePrivateKeyLocation;
+	(void) pDestinationURL;
+	(void) timeout_ms;
+	(void) ServerVerificationFlag;
+	(void) isUseSSLFlag;
+
+	/* The port carries the connection index plus one, 0 is not a valid port */
+	pNetwork->connect = _fake_connect;
+	pNetwork->read = _fake_read;
+	pNetwork->write = _fake_write;
+	pNetwork->disconnect = _fake_disconnect;
+	pNetwork->isConnected = _fake_is_connected;
+	pNetwork->destroy = _fake_destroy;
+	pNetwork->tlsDataParams.server_fd = DestinationPort - 1;
+	return MQTT_SUCCESS;
+}
+
+/* Benchmark */
+
+static void _bench_handler(MQTT_Client *pClient, char *pTopicName, uint16_t topicNameLen,
+						   IoT_Publish_Message_Params *pParams, void *pClientData) {
+	(void) pClient;
+	(void) pTopicName;
+	(void) topicNameLen;
+	(void) pParams;
+	(void) pClientData;
+	bench_delivered++;
+}
+
+static void _bench_build_publish(void) {
+	size_t topicLen = sizeof(BENCH_TOPIC) - 1;
+	size_t pos = 0;
+
+	bench_publish[pos++] = 0x30;
+	bench_publish[pos++] = (unsigned char) (sizeof(bench_publish) - 2);
+	bench_publish[pos++] = (unsigned char) (topicLen >> 8);
+	bench_publish[pos++] = (unsigned char) topicLen;
+	memcpy(bench_publish + pos, BENCH_TOPIC, topicLen);
+	pos += topicLen;
+	memset(bench_publish + pos, 'x', BENCH_PAYLOAD_LEN);
+}
+
+static int _bench_client_start(MQTT_Client *pClient, uint32_t index) {
+	IoT_Client_Init_Params initParams = iotClientInitParamsDefault;
+	IoT_Client_Connect_Params connectParams = iotClientConnectParamsDefault;
+	char clientId[24];
+	IoT_Error_t rc;
+
+	initParams.pHostURL = "bench";
+	initParams.port = (uint16_t) (index + 1);
+	initParams.isUseSSL = false;
+	initParams.enableAutoReconnect = false;
+	initParams.mqttCommandTimeout_ms = 1000;
+	initParams.mqttPacketTimeout_ms = 1000;
+	rc = mqtt_init(pClient, &initParams);
+	if(MQTT_SUCCESS != rc) {
+		fprintf(stderr, "mqtt_init %u: %d\n", index, rc);
+		return -1;
+	}
+
+	snprintf(clientId, sizeof(clientId), "bench-%u", index);
+	connectParams.keepAliveIntervalInSec = 600;
+	connectParams.isCleanSession = true;
+	connectParams.MQTTVersion = MQTT_3_1_1;
+	connectParams.pClientID = clientId;
+	connectParams.clientIDLen = (uint16_t) strlen(clientId);
+	rc = mqtt_connect(pClient, &connectParams);
+	if(MQTT_SUCCESS != rc) {
+		fprintf(stderr, "mqtt_connect %u: %d\n", index, rc);
+		return -1;
+	}
+
+	rc = mqtt_subscribe(pClient, BENCH_TOPIC, (uint16_t) (sizeof(BENCH_TOPIC) - 1), QOS0, _bench_handler, NULL);
+	if(MQTT_SUCCESS != rc) {
+		fprintf(stderr, "mqtt_subscribe %u: %d\n", index, rc);
+		return -1;
+	}
+	return 0;
+}
+
+static int _bench_round(MQTT_Client *pClients, uint32_t clients, uint32_t packets) {
+	uint32_t i, k;
+	IoT_Error_t rc;
+
+	for(i = 0; i < clients; i++) {
+		for(k = 0; k < packets; k++) {
+			_fake_queue(&bench_conns[i], bench_publish, sizeof(bench_publish));
+		}
+	}
+	for(i = 0; i < clients; i++) {
+		rc = mqtt_yield(&pClients[i], BENCH_YIELD_MS);
+		if(MQTT_SUCCESS != rc) {
+			fprintf(stderr, "mqtt_yield %u: %d\n", i, rc);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static uint64_t _bench_cpu_ns(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+int main(int argc, char **argv) {
+	uint32_t clients, packets, rounds, r, i;
+	MQTT_Client *pClients;
+	uint64_t start, elapsed;
+
+	if(4 != argc) {
+		fprintf(stderr, "usage: %s <clients> <packets per round> <rounds>\n", argv[0]);
+		return 2;
+	}
+	clients = (uint32_t) strtoul(argv[1], NULL, 0);
+	packets = (uint32_t) strtoul(argv[2], NULL, 0);
+	rounds = (uint32_t) strtoul(argv[3], NULL, 0);
+	if(0 == clients || 0 == packets || 0 == rounds ||
+	   packets * sizeof(bench_publish) > BENCH_RX_BUF_LEN / 2) {
+		fprintf(stderr, "bad arguments\n");
+		return 2;
+	}
+
+	bench_now_ms = 1;
+	bench_conn_count = clients;
+	bench_conns = calloc(clients, sizeof(FakeConn));
+	pClients = calloc(clients, sizeof(MQTT_Client));
+	if(NULL == bench_conns || NULL == pClients) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+	_bench_build_publish();
+
+	for(i = 0; i < clients; i++) {
+		if(0 != _bench_client_start(&pClients[i], i)) {
+			return 1;
+		}
+	}
+	for(r = 0; r < BENCH_WARMUP_ROUNDS; r++) {
+		if(0 != _bench_round(pClients, clients, packets)) {
+			return 1;
+		}
+	}
+
+	bench_delivered = 0;
+	start = _bench_cpu_ns();
+	for(r = 0; r < rounds; r++) {
+		if(0 != _bench_round(pClients, clients, packets)) {
+			return 1;
+		}
+	}
+	elapsed = _bench_cpu_ns() - start;
+
+	if(bench_delivered != clients * packets * rounds) {
+		fprintf(stderr, "delivered %u of %u\n", bench_delivered, clients * packets * rounds);
+		return 1;
+	}
+	printf("sizeof(MQTT_Client)=%u clients=%u packets=%u rounds=%u ns/msg=%.1f\n",
+		   (unsigned) sizeof(MQTT_Client), clients, packets, rounds,
+		   (double) elapsed / (double) bench_delivered);
+
+	for(i = 0; i < clients; i++) {
+		mqtt_free(&pClients[i]);
+	}
+	free(pClients);
+	free(bench_conns);
+	return 0;
+}
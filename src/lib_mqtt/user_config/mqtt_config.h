@@ -7,25 +7,96 @@
 #define MQTT_CONFIG_H_
 
 // MQTT pub and sub buff len
-#define MQTT_TX_BUF_LEN                     (2048+200) ///< Any time a message is sent out through the MQTT layer. The message is copied into this buffer anytime a publish is done. This will also be used in the case of Thing Shadow
-#define MQTT_RX_BUF_LEN                     (2048+200) ///< Any message that comes into the device should be less than this buffer size. If a received message is bigger than this buffer size the message will be dropped.
+#define MQTT_TX_BUF_LEN                     (2048+200) ///< Default TX buffer size when IoT_Client_Init_Params::writeBufSize is 0. Any time a message is sent out through the MQTT layer. The message is copied into this buffer anytime a publish is done. This will also be used in the case of Thing Shadow
+#define MQTT_RX_BUF_LEN                     (2048+200) ///< Default RX buffer size when IoT_Client_Init_Params::readBufSize is 0. Any message that comes into the device should be less than this buffer size. If a received message is bigger than this buffer size the message will be dropped.
+
 #define MQTT_NUM_SUBSCRIBE_HANDLERS         (6) ///< Maximum number of topic filters the MQTT client can handle at any given time. This should be increased appropriately when using Thing Shadow
+#define MQTT_CONFLATE_BUF_LEN               (256) ///< Staging buffer for conflated (latest-value) subscriptions. Holds topic name and payload of the newest pending message. Larger messages are delivered immediately.
+
+// memory config
+//#define _ENABLE_STATIC_MEMPOOL_ ///< Serve MQTT_MALLOC from a static block pool (mqtt_mempool.h), memory use is fixed at link time and allocation is O(1)
+#define MQTT_MEMPOOL_BLOCK_SIZE             ((MQTT_TX_BUF_LEN > MQTT_RX_BUF_LEN) ? MQTT_TX_BUF_LEN : MQTT_RX_BUF_LEN) ///< Largest buffer the static pool serves
+#define MQTT_MEMPOOL_BLOCK_COUNT            (2) ///< Blocks of the static pool, one TX and one RX buffer per client using default buffers
+#ifdef _ENABLE_STATIC_MEMPOOL_
+#define MQTT_MALLOC(size)                   mqtt_mempool_alloc(size) ///< Allocates the TX/RX buffers mqtt_init() is not given
+#define MQTT_FREE(ptr)                      mqtt_mempool_free(ptr) ///< Releases buffers allocated with MQTT_MALLOC, called by mqtt_free()
+#else
+#define MQTT_MALLOC(size)                   malloc(size) ///< Allocates the TX/RX buffers mqtt_init() is not given. Point it at a pool allocator to keep them off the heap
+#define MQTT_FREE(ptr)                      free(ptr) ///< Releases buffers allocated with MQTT_MALLOC, called by mqtt_free()
+#endif
 
 // if enablle auto reconnect, auto reconnect specific config
-#define MQTT_MIN_RECONNECT_WAIT_INTERVAL    (1000) ///< Minimum time before the First reconnect attempt is made as part of the exponential back-off algorithm
-#define MQTT_MAX_RECONNECT_WAIT_INTERVAL    (20000) ///< Maximum time interval after which exponential back-off will stop attempting to reconnect.
+#define MQTT_FIRST_RECONNECT_WAIT_INTERVAL  (500) ///< Default wait before the first reconnect attempt after a disconnect. Jittered unless the policy is BACKOFF_JITTER_NONE
+#define MQTT_MIN_RECONNECT_WAIT_INTERVAL    (1000) ///< Default base of the exponential back-off algorithm
+#define MQTT_MAX_RECONNECT_WAIT_INTERVAL    (20000) ///< Default cap of a single back-off wait
+#define MQTT_MAX_RECONNECT_ATTEMPTS         (0) ///< Default number of failed reconnect attempts before giving up, 0 = retry forever
+#define _ENABLE_PIPELINED_RECONNECT_ ///< Reconnect writes CONNECT and the resubscribe SUBSCRIBEs in one go instead of waiting for each ack in turn
+
+// keepalive config
+//#define _ENABLE_KEEPALIVE_PROBE_ ///< Measure how long the path (NAT, firewall) keeps an idle connection and ping just inside that, at most every keepAliveIntervalInSec. Pays off when keepAliveIntervalInSec is well above the path's idle timeout, otherwise it only adds the pings of the first, shorter idle periods
+#define MQTT_KEEPALIVE_PROBE_START_SEC      (60) ///< First idle period the probe pings after, at most half of keepAliveIntervalInSec. Kept if the path does not survive it
+#define MQTT_KEEPALIVE_PROBE_STEP_SEC       (30) ///< Idle period added after each PINGREQ that got its PINGRESP following a full idle period
+
+// dead connection detection config
+#define MQTT_PING_TIMEOUT_RTTVAR_MULT       (4) ///< A PINGREQ is given up on after SRTT + this * RTTVAR, the TCP retransmission timeout formula
+#define MQTT_PING_TIMEOUT_MIN_MS            (2000) ///< Lower bound of the PINGRESP timeout, absorbs broker scheduling jitter
+#define MQTT_PING_MAX_MISSES                (2) ///< Unanswered PINGREQs in a row before the connection is dropped. Each retry waits twice as long, riding out a TCP retransmission (lwIP starts at 3 s)
+
+// timer wheel config
+#define MQTT_TIMER_WHEEL_TICK_MS            (10) ///< Resolution of the per-client timer wheel used for keepalive and reconnect deadlines
 
 // rtos config
 //#define _ENABLE_THREAD_SUPPORT_
+#define MQTT_BACKGROUND_TASK_STACK_SIZE     (0x2000) ///< Stack of the network I/O task started by mqtt_start_background(). Message handlers run on this task
+#define MQTT_BACKGROUND_YIELD_MS            (100) ///< Time slice the network I/O task passes to yield per iteration
+#define MQTT_BACKGROUND_STOP_TIMEOUT_MS     (30000) ///< Longest mqtt_stop_background() waits for the network I/O task, a blocking reconnect holds it for its DNS, TCP, TLS and CONNACK timeouts
+#define MQTT_TX_POOL_COUNT                  (4) ///< Buffers publishing tasks serialize into in background mode (1..32)
+#define MQTT_TX_POOL_WAIT_MS                (100) ///< Longest a publish waits for a pooled buffer when all are in use, then it fails with MQTT_TX_QUEUE_FULL_ERROR
+#define MQTT_TX_POOL_BUF_LEN                (512) ///< Size of one pooled buffer, larger publishes use the shared TX buffer. Must be smaller than MQTT_TX_BUF_LEN, clients given a smaller TX buffer only queue publishes that fit it
+#define MQTT_TX_QUEUE_POLL_MS               (10) ///< Longest the network I/O task blocks on the socket before sending queued publishes, only on platforms that cannot select() on a semaphore
+#define MQTT_MAX_PENDING_REQUESTS           (8) ///< Acked requests (QoS1 publish, subscribe, unsubscribe) application tasks can have in flight at once in background mode
+//#define _ENABLE_STACK_WATERMARK_ ///< Threads from aws_iot_thread_create paint their free stack at start so aws_iot_thread_stack_unused() can report the high-water mark. Assumes a stack growing downwards
+#define MQTT_STACK_WATERMARK_RESERVE        (512) ///< Stack the MiCO thread wrapper uses above the entry frame, left unpainted. MiCO does not expose the stack base, raise this if a painted thread overflows at start
+
+// dns cache config
+#define MQTT_DNS_CACHE_MAX_ADDRS            (4) ///< Resolved addresses kept per host. Connect tries them in turn, starting with the last one that worked
+#define MQTT_DNS_CACHE_TTL_MS               (3600000) ///< How long resolved addresses are used before the host is resolved again. gethostbyname does not report the record TTL
+//#define _ENABLE_DNS_ASYNC_REFRESH_
+#define MQTT_DNS_CACHE_REFRESH_AHEAD_MS     (300000) ///< With _ENABLE_DNS_ASYNC_REFRESH_, connects this close to expiry resolve again on a helper task and keep using the cached addresses
+#define MQTT_DNS_CACHE_STALE_MAX_MS         (600000) ///< With _ENABLE_DNS_ASYNC_REFRESH_, longest cached addresses are used past expiry while refreshes fail. After that connects resolve again before connecting
+#define MQTT_DNS_REFRESH_STACK_SIZE         (0x800) ///< Stack of the one-shot resolver task
+
+// connect config
+#define MQTT_TCP_SOCKET_TIMEOUT_MS          (3000) ///< TCP connect timeout per address, also the socket send and receive timeout
+//#define _ENABLE_NONBLOCKING_CONNECT_ ///< mqtt_connect_start() and auto-reconnect connect without blocking, each mqtt_yield() advances DNS, TCP, TLS and CONNACK for at most its timeout
+#define MQTT_TLS_HANDSHAKE_STACK_SIZE       (0x3000) ///< Stack of the task running the TLS handshake of a non-blocking connect, the SSL library has no incremental handshake
+#define MQTT_CONNECT_POLL_MS                (10)     ///< Sleep between polls of DNS, TCP and TLS progress of a non-blocking connect
 
 // ssl config
 #define _ENABLE_SSL_SUPPORT_
 
+// state trace config
+//#define _ENABLE_STATE_TRACE_
+#define MQTT_STATE_TRACE_LEN                (32) ///< Client state transitions kept by the trace ring when _ENABLE_STATE_TRACE_ is defined. Must be a power of two
+
+// health report config
+//#define _ENABLE_HEALTH_REPORT_ ///< mqtt_health_report_start() publishes a compact JSON health record (reconnects, RTT percentiles, queue depth, heap and stack watermarks, TLS handshake time) from the yield loop
+#define MQTT_HEALTH_REPORT_BUF_LEN          (320) ///< Stack buffer the health record is encoded into, fields that do not fit are left out
+
 // debug config
 #define ENABLE_IOT_DEBUG
 //#define ENABLE_IOT_TRACE
 #define ENABLE_IOT_INFO
 #define ENABLE_IOT_WARN
 #define ENABLE_IOT_ERROR
+//#define _ENABLE_BINARY_LOG_ ///< IOT_* macros store compact binary records (format address + integer args) in a lock-free ring instead of printing, see mqtt_log.h
+#define MQTT_LOG_RING_LEN                   (64) ///< Records kept by the binary log ring, power of two. The oldest are overwritten when the drain falls behind
+#define MQTT_LOG_DRAIN_STACK_SIZE           (0x800) ///< Stack of the task started by mqtt_log_start_drain()
+#define MQTT_LOG_DRAIN_PRIORITY             (MICO_APPLICATION_PRIORITY + 1) ///< Below the MQTT tasks, the drain only prints when nothing else runs
+#define MQTT_LOG_DRAIN_INTERVAL_MS          (50) ///< Sleep of the drain task once the ring is empty
+//#define _ENABLE_FUNC_TRACE_ ///< FUNC_ENTRY/FUNC_EXIT_RC and MQTT_TRACE_BEGIN/END record microsecond begin/end events in a ring, mqtt_trace_dump() prints it for tools/mqtt_trace2chrome.py. Takes precedence over ENABLE_IOT_TRACE
+#define MQTT_TRACE_RING_LEN                 (256) ///< Events kept by the trace ring, power of two. The oldest are overwritten
+//#define MQTT_TIMER_US_SOURCE()              (DWT->CYCCNT / (SystemCoreClock / 1000000)) ///< Microsecond clock for trace timestamps. Without it MiCO traces use the 1 ms tick and anything shorter than 1 ms shows as 0, define it when tracing select/recv/handler times
+//#define MQTT_TRACE_TASK_ID()                ((uint32_t) xTaskGetCurrentTaskHandle()) ///< Identifies the calling task so each gets its own track, defaults to mico_rtos_get_current_thread()
 
 #endif /* SRC_SHADOW_IOT_SHADOW_CONFIG_H_ */
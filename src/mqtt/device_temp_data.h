@@ -5,3 +5,11 @@
  */
 
 extern char* config_network_user_device_name;
+
+#define DEVICE_REPORT_FIELD_CODE            (1u << 0)
+#define DEVICE_REPORT_FIELD_TARGET_DEVICE   (1u << 1)
+#define DEVICE_REPORT_FIELD_ALL             (DEVICE_REPORT_FIELD_CODE | DEVICE_REPORT_FIELD_TARGET_DEVICE)
+
+/* Ask the mqtt task to publish the device report, safe from any task. Changes of
+ * config_network_user_device_name are picked up without it */
+void device_report_mark_dirty( uint32_t fields );
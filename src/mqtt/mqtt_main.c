@@ -1,6 +1,8 @@
 #include "mico.h"
 #include "mico_app_define.h"
 #include "mqtt_client_interface.h"
+#include "mqtt_mempool.h"
+#include "mqtt_atomic.h"
 #include "device_temp_data.h"
 #include "json.h"
 #include "hsb2rgb_led.h"
@@ -8,9 +10,214 @@
 
 #define mqtt_log(M, ...) custom_log("mqtt", M, ##__VA_ARGS__)
 
+#define MQTT_MSG_ARENA_SIZE     (MQTT_RX_BUF_LEN + 256)
 
-json_object *recv_json_object=NULL,*rec_json_code=NULL,*rec_json_target_device=NULL,*rec_json_red=NULL,*rec_json_green=NULL,*rec_json_blue=NULL;
+/* Scratch memory of the message being handled by the mqtt task, reset after every
+ * publish and subscribe callback so nothing outlives its message */
+static void *msg_arena_storage[MEM_POOL_STORAGE_WORDS(MQTT_MSG_ARENA_SIZE, 1)];
+static MemArena msg_arena;
 
+#define REPORT_POLL_MS              (100)   /* yield slice, the source is checked once per slice */
+#define REPORT_MIN_INTERVAL_MS      (1000)  /* changes within an interval go out in one publish */
+#define REPORT_REFRESH_INTERVAL_MS  (60000) /* republish unchanged state this often, 0 = only on change */
+
+#define YIELD_BENCHMARK_MSGS        (0)     /* > 0: after connecting, time how fast yield takes in this many messages */
+#define YIELD_BENCHMARK_SETTLE_MS   (500)   /* wait for the broker to echo the burst before timing */
+#define YIELD_BENCHMARK_TOPIC       MQTT_SUB_NAME "/bench"
+
+/* Device report published on MQTT_PUB_NAME. The json object is kept across publishes,
+ * a field is replaced only when its value changed and json-c reuses the object's
+ * print buffer, so an unchanged report costs neither parsing nor allocation */
+typedef struct
+{
+    json_object *object;
+    uint32_t source_hash;       /* of the last config_network_user_device_name parsed */
+    bool has_source;
+    bool has_published;
+    uint32_t last_publish_ms;
+} device_report_t;
+
+static device_report_t device_report;
+static volatile uint32_t device_report_dirty;  /* DEVICE_REPORT_FIELD_* waiting to be published */
+
+void device_report_mark_dirty( uint32_t fields )
+{
+    mqtt_atomic_fetch_or_u32( &device_report_dirty, fields );
+}
+
+static uint32_t device_report_hash( const char *str )
+{
+    uint32_t hash = 2166136261u;
+
+    while ( *str != '\0' )
+    {
+        hash = (hash ^ (uint8_t) *str++) * 16777619u;
+    }
+
+    return hash;
+}
+
+static void device_report_set_field( const char *key, json_object *value, uint32_t field )
+{
+    const char *new_value = json_object_get_string( value );
+    const char *old_value = json_object_get_string( json_object_object_get( device_report.object, key ) );
+
+    if ( new_value == NULL )
+    {
+        new_value = "";
+    }
+    if ( old_value != NULL && strcmp( old_value, new_value ) == 0 )
+    {
+        return;
+    }
+
+    json_object_object_add( device_report.object, key, json_object_new_string( new_value ) );
+    device_report_mark_dirty( field );
+}
+
+/* Source: config_network_user_device_name is written by the configuration code, it is
+ * parsed again only when its content changed */
+static void device_report_poll_source( void )
+{
+    const char *source = config_network_user_device_name;
+    json_object *source_object;
+    uint32_t hash;
+
+    if ( source == NULL )
+    {
+        return;
+    }
+
+    hash = device_report_hash( source );
+    if ( device_report.has_source && hash == device_report.source_hash )
+    {
+        return;
+    }
+    device_report.source_hash = hash;
+    device_report.has_source = true;
+
+    source_object = json_tokener_parse( source );
+    device_report_set_field( "code", json_object_object_get( source_object, "code" ), DEVICE_REPORT_FIELD_CODE );
+    device_report_set_field( "targetdevice", json_object_object_get( source_object, "targetdevicename" ),
+                             DEVICE_REPORT_FIELD_TARGET_DEVICE );
+    json_object_put( source_object );
+}
+
+/* Scheduler: publish the report when a field is dirty, at most once per
+ * REPORT_MIN_INTERVAL_MS, or when the refresh interval elapsed */
+static void device_report_publish_due( MQTT_Client *client )
+{
+    IoT_Publish_Message_Params params;
+    uint32_t now = mico_rtos_get_time( );
+    uint32_t fields;
+    const char *json_string;
+    IoT_Error_t rc;
+
+    if ( !device_report.has_source || !mqtt_is_client_connected( client ) )
+    {
+        return;
+    }
+
+    if ( device_report.has_published )
+    {
+        if ( now - device_report.last_publish_ms < REPORT_MIN_INTERVAL_MS )
+        {
+            return;
+        }
+        if ( device_report_dirty == 0
+             && (REPORT_REFRESH_INTERVAL_MS == 0 || now - device_report.last_publish_ms < REPORT_REFRESH_INTERVAL_MS) )
+        {
+            return;
+        }
+    }
+
+    fields = mqtt_atomic_exchange_u32( &device_report_dirty, 0 );
+    json_string = json_object_to_json_string( device_report.object );
+    mqtt_log("report 0x%x: %s", (unsigned int) fields, json_string);
+
+    params.qos = QOS0;
+    params.isRetained = 0;
+    params.payload = (void *) json_string;
+    params.payloadLen = strlen( json_string );
+    rc = mqtt_publish( client, MQTT_PUB_NAME, strlen( MQTT_PUB_NAME ), &params );
+    if ( MQTT_SUCCESS != rc )
+    {
+        /* Try again next interval */
+        device_report_mark_dirty( fields );
+        mqtt_log("report publish failed: %d", rc);
+    }
+
+    device_report.has_published = true;
+    device_report.last_publish_ms = now;
+}
+
+
+#if YIELD_BENCHMARK_MSGS > 0
+static volatile uint32_t yield_benchmark_received;
+
+static void yield_benchmark_handler( MQTT_Client *pClient, char *topicName, uint16_t topicNameLen,
+                                     IoT_Publish_Message_Params *params, void *pData )
+{
+    yield_benchmark_received++;
+}
+
+/* Time yield on the receive path, the one the hot/cold layout of MQTT_Client is for.
+ * A burst is published to a topic of our own and left to queue up in the socket, then
+ * yield takes it in. The drain is timed as a whole, so the millisecond fallback of
+ * timer_now_us() still gives a usable per message figure. Compare builds before and
+ * after a layout change on the same board and broker */
+static void yield_benchmark( MQTT_Client *client )
+{
+    IoT_Publish_Message_Params params;
+    uint32_t sent, yields = 0, start_us, elapsed_us;
+    IoT_Error_t rc;
+
+    rc = mqtt_subscribe( client, YIELD_BENCHMARK_TOPIC, strlen( YIELD_BENCHMARK_TOPIC ), QOS0,
+                         yield_benchmark_handler, NULL );
+    if ( MQTT_SUCCESS != rc )
+    {
+        mqtt_log("benchmark subscribe failed: %d", rc);
+        return;
+    }
+
+    params.qos = QOS0;
+    params.isRetained = 0;
+    params.isDup = 0;
+    params.id = 0;
+    params.payload = (void *) "0123456789abcdef";
+    params.payloadLen = 16;
+    yield_benchmark_received = 0;
+    for ( sent = 0; sent < YIELD_BENCHMARK_MSGS; sent++ )
+    {
+        if ( MQTT_SUCCESS != mqtt_publish( client, YIELD_BENCHMARK_TOPIC, strlen( YIELD_BENCHMARK_TOPIC ), &params ) )
+        {
+            break;
+        }
+    }
+    mico_rtos_thread_msleep( YIELD_BENCHMARK_SETTLE_MS );
+
+    /* Each yield returns at most 1 ms after the socket ran dry */
+    start_us = timer_now_us( );
+    while ( yield_benchmark_received < sent && yields < sent * 4 )
+    {
+        (void) mqtt_yield( client, 1 );
+        yields++;
+    }
+    elapsed_us = timer_now_us( ) - start_us;
+
+    mqtt_log("yield benchmark: %u of %u messages in %u us, %u yields",
+             (unsigned int) yield_benchmark_received, (unsigned int) sent, (unsigned int) elapsed_us,
+             (unsigned int) yields);
+    if ( yield_benchmark_received != 0 )
+    {
+        mqtt_log("yield benchmark: %u us per message, hot part of MQTT_Client %u bytes",
+                 (unsigned int) (elapsed_us / yield_benchmark_received),
+                 (unsigned int) offsetof( MQTT_Client, timerWheel ));
+    }
+
+    (void) mqtt_unsubscribe( client, YIELD_BENCHMARK_TOPIC, strlen( YIELD_BENCHMARK_TOPIC ) );
+}
+#endif
 
 char *mqtt_client_id_get( char clientid[30] )
 {
@@ -60,12 +267,23 @@ void iot_subscribe_callback_handler( MQTT_Client *pClient, char *topicName,
                                      IoT_Publish_Message_Params *params,
                                      void *pData )
 {
-    char *payload=(params->payload);
+    char *payload;
+    json_object *recv_json_object=NULL,*rec_json_red=NULL,*rec_json_green=NULL,*rec_json_blue=NULL;
 
     IOT_UNUSED( pData );
     IOT_UNUSED( pClient );
     mqtt_log("Subscribe callback");
-    mqtt_log("%.*s\t%.*s", topicNameLen, topicName, (int) params->payloadLen, payload);//(char *)(params->payload));
+    mqtt_log("%.*s\t%.*s", topicNameLen, topicName, (int) params->payloadLen, (char *) params->payload);
+
+    /* The payload is not NUL terminated, the parser needs a terminated copy */
+    payload = mem_arena_alloc( &msg_arena, params->payloadLen + 1 );
+    if ( NULL == payload )
+    {
+        mqtt_log("Subscribe callback: payload of %d bytes too large", (int) params->payloadLen);
+        return;
+    }
+    memcpy( payload, params->payload, params->payloadLen );
+    payload[params->payloadLen] = '\0';
     recv_json_object=json_tokener_parse(payload);
 
     rec_json_red=json_object_object_get(recv_json_object, "r");
@@ -81,6 +299,9 @@ void iot_subscribe_callback_handler( MQTT_Client *pClient, char *topicName,
         mqtt_log("Subscribe callback-->1,%d,%d,%d",ired,igreen,iblue);
     }
     mqtt_log("Subscribe callback-->2");
+
+    json_object_put( recv_json_object );
+    mem_arena_reset( &msg_arena );
 }
 
 static void mqtt_sub_pub_main( mico_thread_arg_t arg )
@@ -88,18 +309,15 @@ static void mqtt_sub_pub_main( mico_thread_arg_t arg )
     IoT_Error_t rc = MQTT_FAILURE;
 
     char clientid[40];
-    char cPayload[100];
-    int i = 0;
     MQTT_Client client;
     IoT_Client_Init_Params mqttInitParams = iotClientInitParamsDefault;
     IoT_Client_Connect_Params connectParams = iotClientConnectParamsDefault;
-    IoT_Publish_Message_Params paramsQOS0;
-    //IoT_Publish_Message_Params paramsQOS1;
 
     /*
-     * Enable Auto Reconnect functionality. Minimum and Maximum time of Exponential backoff are set in aws_iot_config.h
-     *  #AWS_IOT_MQTT_MIN_RECONNECT_WAIT_INTERVAL
-     *  #AWS_IOT_MQTT_MAX_RECONNECT_WAIT_INTERVAL
+     * Enable Auto Reconnect functionality. The backoff schedule is in mqttInitParams.reconnectBackoff,
+     * defaults are set in mqtt_config.h
+     *  #MQTT_MIN_RECONNECT_WAIT_INTERVAL
+     *  #MQTT_MAX_RECONNECT_WAIT_INTERVAL
      */
     mqttInitParams.enableAutoReconnect = true;
     mqttInitParams.pHostURL = MQTT_HOST;
@@ -125,6 +343,8 @@ static void mqtt_sub_pub_main( mico_thread_arg_t arg )
     mqttInitParams.isUseSSL = false;
 #endif
 
+    mem_arena_init( &msg_arena, msg_arena_storage, sizeof(msg_arena_storage) );
+
     rc = mqtt_init( &client, &mqttInitParams );
     if ( MQTT_SUCCESS != rc )
     {
@@ -160,21 +380,26 @@ static void mqtt_sub_pub_main( mico_thread_arg_t arg )
         goto exit;
     }
 
+    /* Only the newest LED setting of a burst matters */
+    rc = mqtt_set_subscription_conflate( &client, MQTT_SUB_NAME, strlen( MQTT_SUB_NAME ), true );
+    if ( MQTT_SUCCESS != rc )
+    {
+        mqtt_log("Error setting conflated delivery : %d, every LED setting is handled", rc);
+    }
+
+#if YIELD_BENCHMARK_MSGS > 0
+    yield_benchmark( &client );
+#endif
+
     mqtt_log("publish...");
-    sprintf( cPayload, "%s : %d ", "hello from SDK", i );
 
-    paramsQOS0.qos = QOS0;
-    paramsQOS0.payload = (void *) cPayload;
-    paramsQOS0.isRetained = 0;
+    device_report.object = json_object_new_object( );
+    json_object_object_add( device_report.object, "deviceid", json_object_new_string( DEVICE_ID ) );
 
-    /*paramsQOS1.qos = QOS1;
-    paramsQOS1.payload = (void *) cPayload;
-    paramsQOS1.isRetained = 0;
-*/
     while ( 1 )
     {
         //Max time the yield function will wait for read messages
-        rc = mqtt_yield( &client, 100 );
+        rc = mqtt_yield( &client, REPORT_POLL_MS );
         if ( NETWORK_ATTEMPTING_RECONNECT == rc )
         {
             // If the client is attempting to reconnect we will skip the rest of the loop.
@@ -183,38 +408,12 @@ static void mqtt_sub_pub_main( mico_thread_arg_t arg )
         } else if ( NETWORK_RECONNECTED == rc )
         {
             mqtt_log("Reconnect Successful");
+            /* The clean session lost whatever was in flight, send the current state */
+            device_report_mark_dirty( DEVICE_REPORT_FIELD_ALL );
         }
 
-
-       // mqtt_log("%s",config_network_user_device_name);
-//        mico_rtos_thread_msleep( 500 );
-
-        if(config_network_user_device_name!=NULL){
-            recv_json_object=json_tokener_parse(config_network_user_device_name);
-            rec_json_code=json_object_object_get(recv_json_object, "code");
-            rec_json_target_device=json_object_object_get(recv_json_object, "targetdevicename");
-
-             struct json_object *device_data_object=NULL;
-
-             device_data_object=json_object_new_object();
-
-             char *char_code=(char*)json_object_get_string(rec_json_code);
-             char *char_targetdevice=(char*)json_object_get_string(rec_json_target_device);
-
-             json_object_object_add(device_data_object, "code", json_object_new_string(char_code));
-             json_object_object_add(device_data_object, "targetdevice", json_object_new_string(char_targetdevice));
-             json_object_object_add(device_data_object, "deviceid", json_object_new_string(DEVICE_ID));
-
-             mqtt_log("-->sleep--->json,%s",json_object_to_json_string(device_data_object));
-            //sprintf( cPayload, "%s : %d ", "hello from SDK QOS0", i++ );
-            sprintf( cPayload, "%s", json_object_to_json_string(device_data_object));
-            paramsQOS0.payloadLen = strlen( cPayload );
-            mqtt_publish( &client, MQTT_PUB_NAME, strlen( MQTT_PUB_NAME ), &paramsQOS0 );
-        }
-        else{
-            mqtt_log("-->sleep");
-        }
-
+        device_report_poll_source( );
+        device_report_publish_due( &client );
     }
 
     if ( MQTT_SUCCESS != rc )